@@ -8,6 +8,11 @@
 
 #include "CompositeBase.h"
 #include "CompositeK2.h"
+#include "CompositeClimb.h"
+#include "CompositeOrder.h"
+#include "CompositePC.h"
+#include "CompositeTree.h"
+#include "CompositeGES.h"
 
 /*!
  * @brief 利用者が入力した命令に適した処理の基本処理を定義します
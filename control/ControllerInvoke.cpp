@@ -4,6 +4,8 @@
 // Description : Bayesian Network Processing in C++, Ansi-style
 //============================================================================
 #include "ControllerInvoke.h"
+#include "ControllerServe.h"
+#include "BayesianTrace.h"
 
 ControllerInvoke::ControllerInvoke() {
 }
@@ -19,28 +21,30 @@ int ControllerInvoke::doProcessing(int argc, char **argv) {
 	LINE("=");
 	cout << "Starting the Bayesian Network Processsing" << endl;
 	LINE("=");
+	// オプションと位置引数を分けます(--model、--saveは常駐時のみ指定できます)
+	ControllerOptions options;
+	if (parseOptions(argc, argv, &options) != 0 || options.args.empty() || !options.model.empty() || !options.save.empty()) {
+		usage();
+		return 1;
+	}
+	vector<string> &args = options.args;
 	// 入力値を保持します
 	string relation;
-	if (argc == 2) {
+	if (args.size() == 1) {
 		relation = RELATION_FILE; // デフォルトのファイル名を利用
-	} else if (argc > 2) {
-		relation = argv[2]; // 指定されたファイル名を利用
 	} else {
-		cout << "[ControllerInvoke::doProcessing]Usage:./network(.exe) [CSV-File] [Relations-File(Optional)]" << endl;
-		return 1;
+		relation = args[1]; // 指定されたファイル名を利用
 	}
 	cout << "[ControllerInvoke::doProcessing]Relation <- " << relation << endl;
 
 	// 簡単な推定デモを行います
-	string csv(argv[1]);
-	ProbabilityBase base(csv);
+	ProbabilityBase base(args[0]);
 	base.load();
 
-	// データからBDMを用いてノード構造を作成します
-	if (argc == 2) {
+	// データからスコア(既定はBDM)を用いてノード構造を作成します
+	if (args.size() == 1) {
 		// Nodeの構造ファイルが指定されない場合は、データから作成します
-		CompositeK2 k2(&base);
-		k2.createNodeRelation();
+		if (createStructure(&base, options.learn, options.score, options.sparse, options.maxParents) != 0) return 2;
 		cout << "[ControllerInvoke::doProcessing]Nodes.csv Created" << endl;
 	} else {
 		cout << "[ControllerInvoke::doProcessing]Nodes.csv Not Created" << endl;
@@ -59,55 +63,209 @@ int ControllerInvoke::doProcessing(int argc, char **argv) {
 
 	// コマンドをパースします
 	string comm, targetn; COND condition;
-	parseCommand(source, &comm, &targetn, &condition);
+	if (parseCommand(source, &comm, &targetn, &condition) != 0) {
+		return 4;
+	}
 
 	// BPで推定します
-	node = new CompositeBase(&base, relation);
+	// 問合せに関わる連結成分のみ事前確率とCPTを作成します
+	node = new CompositeBase(&base, relation, true);
+	if (applyNoisy(node, &options) != 0) {
+		delete node;
+		return 3;
+	}
 	string targetc;
 	for (COND::iterator iter = condition.begin(); iter != condition.end(); iter++) {
-		node->setProb(iter->first, iter->second);
 		cout << "[ControllerInvoke::doProcessing]Evidence:" << iter->first << "=" << iter->second << endl;
 		targetc = iter->first;
 	}
 	cout << "[ControllerInvoke::doProcessing]Evidence:" << targetc << endl;
-	node->calProbs(targetc);
+	// MPE(k|エビデンス)の場合は、エビデンスを与えて最も確からしい説明を上位k件表示します
+	if (comm == "MPE") {
+		int k = atoi(targetn.c_str()), ret = 0;
+		for (COND::iterator iter = condition.begin(); iter != condition.end() && ret == 0; iter++) {
+			ret = node->setProb(iter->first, iter->second);
+		}
+		vector<EXPLAIN> explains;
+		if (ret == 0) ret = node->calMPE(k <= 0 ? 1 : k, &explains);
+		traceFlush();
+		if (ret != 0) {
+			cout << "[ControllerInvoke::doProcessing]Inference Failure <- " << source << endl;
+			delete node;
+			return 5;
+		}
+		LINE("=");
+		cout << "Result" << endl;
+		LINE("=");
+		for (unsigned int i = 0; i < explains.size(); i++) {
+			cout << "[ControllerInvoke::doProcessing]#" << (i + 1) << " " << explains[i].first << "(";
+			for (LINE::iterator iter = explains[i].second.begin(); iter != explains[i].second.end(); iter++) {
+				cout << (iter != explains[i].second.begin() ? "," : "") << iter->first << "=" << iter->second;
+			}
+			cout << ")" << endl;
+		}
+		delete node;
+		return 0;
+	}
+	// コマンド名で推論方式を選択します(P=BP, LW=尤度重み付け法, GS=ギブスサンプリング)
+	int method = INFER_EXACT;
+	if (comm == "LW") method = INFER_LIKELIHOOD;
+	else if (comm == "GS") method = INFER_GIBBS;
+	// 連結成分毎に伝播する為、問合せとして推論します(エビデンスは問合せで与えます)
+	CHARS targets(1, targetn);
+	POSTERIORS posteriors;
+	if (node->query(&condition, &targets, &posteriors, method) != 0) {
+		traceFlush();
+		cout << "[ControllerInvoke::doProcessing]Inference Failure <- " << source << endl;
+		delete node;
+		return 5;
+	}
 
 	// 結果を表示します
-	PROBS result;
-	node->getProb(targetn, &result);
+	PROBS result, errors;
+	if (posteriors.find(targetn) != posteriors.end()) result = posteriors[targetn];
+	node->getError(targetn, &errors);
+	// トレースを書き終えてから結果を表示します
+	traceFlush();
 	LINE("=");
 	cout << "Result" << endl;
 	LINE("=");
 	for (PROBS::iterator iter = result.begin(); iter != result.end(); iter++) {
-		cout << "[ControllerInvoke::doProcessing]" << iter->second << "(" << iter->first << ")" << endl;
+		cout << "[ControllerInvoke::doProcessing]" << iter->second;
+		// 近似推論の場合は標準誤差を併せて表示します
+		PROBS::iterator error = errors.find(iter->first);
+		if (error != errors.end()) cout << "(+-" << error->second << ")";
+		cout << "(" << iter->first << ")" << endl;
 	}
 	delete node;
 
 	return 0;
 }
 
+/*!
+ * @brief 実データからネットワーク構造を学習して構造定義ファイル(Nodes.csv)を作成します
+ */
+int ControllerInvoke::createStructure(ProbabilityBase *base, string learn, string score, int sparse, int maxParents) {
+	// 学習方式を選択します(k2=K2、hc=山登り法、order=順序探索付きK2、pc(:g2|chi2)=PCアルゴリズム、tree=Chow-Liu木、tan:クラス列=TAN、ges=GES)
+	CompositeStructure *learner = NULL;
+	if (learn.empty() || learn == "k2") learner = new CompositeK2(base);
+	else if (learn == "hc") learner = new CompositeClimb(base);
+	else if (learn == "order") learner = new CompositeOrder(base);
+	else if (learn == "pc" || learn == "pc:g2") learner = new CompositePC(base);
+	else if (learn == "pc:chi2") {
+		CompositePC *pc = new CompositePC(base);
+		pc->test = PC_TEST_CHI2;
+		learner = pc;
+	} else if (learn == "tree") learner = new CompositeTree(base);
+	else if (learn == "ges") learner = new CompositeGES(base);
+	else if (learn.compare(0, 4, "tan:") == 0 && learn.size() > 4) {
+		CompositeTree *tree = new CompositeTree(base);
+		tree->classname = learn.substr(4);
+		learner = tree;
+	} else {
+		cout << "[ControllerInvoke::createStructure]Unknown Learner <- " << learn << endl;
+		return 1;
+	}
+	learner->sparse     = sparse;
+	learner->maxParents = maxParents;
+	int ret = 0;
+	if (!score.empty() && learner->score.parse(score) != 0) {
+		cout << "[ControllerInvoke::createStructure]Invalid Score <- " << score << endl;
+		ret = 2;
+	} else {
+		TRACE(TRACE_INFO, "[ControllerInvoke::createStructure]Learner <- " << (learn.empty() ? "k2" : learn) << ", Score <- " << learner->score.name()
+			<< ", Sparse <- " << sparse << ", Max Parents <- " << maxParents);
+		if (learner->createNodeRelation() != 0) {
+			cout << "[ControllerInvoke::createStructure]Structure Learning Failure" << endl;
+			ret = 3;
+		}
+	}
+	delete learner;
+	return ret;
+}
+
+/*!
+ * @brief コマンドラインをオプションと位置引数に分解します
+ */
+int ControllerInvoke::parseOptions(int argc, char **argv, ControllerOptions *options) {
+	options->args.clear();
+	options->serve = false;
+	options->socket = options->model = options->save = options->learn = options->score = "";
+	options->sparse = options->maxParents = 0;
+	options->noisy.clear();
+	for (int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--serve") options->serve = true;
+		else if (arg.compare(0, 8, "--serve=") == 0) options->serve = true, options->socket = arg.substr(8);
+		else if (arg.compare(0, 8, "--model=") == 0) options->model = arg.substr(8);
+		else if (arg.compare(0, 7, "--save=") == 0) options->save = arg.substr(7);
+		else if (arg.compare(0, 8, "--learn=") == 0) options->learn = arg.substr(8);
+		else if (arg.compare(0, 8, "--score=") == 0) options->score = arg.substr(8);
+		else if (arg.compare(0, 9, "--sparse=") == 0) options->sparse = atoi(arg.substr(9).c_str());
+		else if (arg.compare(0, 14, "--max-parents=") == 0) options->maxParents = atoi(arg.substr(14).c_str());
+		else if (arg.compare(0, 8, "--noisy=") == 0 && arg.size() > 8) {
+			// ノード名:状態名/状態名/...の形式で状態の程度の順を指定できます
+			string value = arg.substr(8);
+			string::size_type pos = value.find(':');
+			CHARS &order = options->noisy[value.substr(0, pos)];
+			order.clear();
+			for (string::size_type begin = pos; begin != string::npos; ) {
+				string::size_type end = value.find('/', begin + 1);
+				order.push_back(value.substr(begin + 1, end == string::npos ? string::npos : end - begin - 1));
+				begin = end;
+			}
+		}
+		else if (arg.compare(0, 2, "--") == 0) {
+			cout << "[ControllerInvoke::parseOptions]Unknown Option <- " << arg << endl;
+			return 1;
+		} else options->args.push_back(arg);
+	}
+	return 0;
+}
+
+/*!
+ * @brief --noisyで指定したノードを雑音付きOR/MAXとします
+ */
+int ControllerInvoke::applyNoisy(CompositeBase *node, ControllerOptions *options) {
+	for (map<string, CHARS>::iterator iter = options->noisy.begin(); iter != options->noisy.end(); iter++) {
+		if (node->setNoisy(iter->first, &iter->second) != 0) return 1;
+		TRACE(TRACE_INFO, "[ControllerInvoke::applyNoisy]Noisy-OR/MAX <- " << iter->first);
+	}
+	return 0;
+}
+
+/*!
+ * @brief 使い方を表示します
+ */
+void ControllerInvoke::usage() {
+	cout << "[ControllerInvoke::usage]Usage:./network(.exe) [CSV-File] [Relations-File(Optional)] [--serve(=Socket-File)] [--save=Model-File]"
+		<< " [--learn=k2|hc|order|pc(:g2|chi2)|tree|tan:Class|ges] [--score=k2|bdeu(:ESS)|bic|mdl|aic] [--sparse=Candidates] [--max-parents=Count]"
+		<< " [--noisy=Node(:State1/State2/...)]" << endl;
+	cout << "[ControllerInvoke::usage]Usage:./network(.exe) --model=Model-File --serve(=Socket-File)" << endl;
+}
+
 /*!
  * @brief 命令文を分解して返します
  */
 int ControllerInvoke::parseCommand(string source, string *comm, string *targetn, COND *condition) {
 	condition->clear();
 	// コマンドを取得します
-	unsigned int pos1 = source.find("("), pos2 = source.find(")");
+	string::size_type pos1 = source.find("("), pos2 = source.find(")");
 	if (pos1 == string::npos || pos2 == string::npos) {
-		cout << "[ControllerInvoke::parseCommand]Invalid Command <- " << source << endl;
+		TRACE(TRACE_ERROR, "[ControllerInvoke::parseCommand]Invalid Command <- " << source);
 		return 1;
 	}
 	*comm = source.substr(0, pos1);
-	cout << "[ControllerInvoke::parseCommand]Command <- " << *comm << endl;
+	TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Command <- " << *comm);
 
 	// 条件部分前の対象ノードを取得します
 	string next = source.substr(pos1 + 1);
-	unsigned int pos = source.find("|");
+	string::size_type pos = source.find("|");
 	if (pos == string::npos) {
 		// 対象ノードの取得
 		pos = next.find(")");
 		if (pos == string::npos) {
-			cout << "[ControllerInvoke::parseCommand]Invalid Command <- " << source << endl;
+			TRACE(TRACE_ERROR, "[ControllerInvoke::parseCommand]Invalid Command <- " << source);
 			return 2;
 		}
 		// 「=」以降は省略します
@@ -115,10 +273,10 @@ int ControllerInvoke::parseCommand(string source, string *comm, string *targetn,
 		pos = next.find("=");
 		if (pos != string::npos) {
 			next = next.substr(0, pos);
-			cout << "[ControllerInvoke::parseCommand]Revise Node <- " << next << endl;
+			TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Revise Node <- " << next);
 		}
 		*targetn = next;
-		cout << "[ControllerInvoke::parseCommand]Target Node <- " << *targetn << endl;
+		TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Target Node <- " << *targetn);
 		return 0;
 	}
 
@@ -129,10 +287,10 @@ int ControllerInvoke::parseCommand(string source, string *comm, string *targetn,
 	if (pos1 != string::npos) {
 		// 「|」以前の「=」以降は省略します
 		before = before.substr(0, pos1);
-		cout << "[ControllerInvoke::parseCommand]Revise Node <- " << before << endl;
+		TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Revise Node <- " << before);
 	}
 	*targetn = before;
-	cout << "[ControllerInvoke::parseCommand]Target Node <- " << *targetn << endl;
+	TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Target Node <- " << *targetn);
 
 	// 「|」の条件以降を処理します
 	next = next.substr(pos + 1);
@@ -142,11 +300,11 @@ int ControllerInvoke::parseCommand(string source, string *comm, string *targetn,
 			// 「,」がない場合
 			pos1 = next.find(")");
 			if (pos1 == string::npos) {
-				cout << "[ControllerInvoke::parseCommand]Invalid Command <- " << next << endl;
+				TRACE(TRACE_ERROR, "[ControllerInvoke::parseCommand]Invalid Command <- " << next);
 				return 3;
 			}
 			string cond = next.substr(0, pos1);
-			cout << "[ControllerInvoke::parseCommand]Condition <- " << cond << endl;
+			TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Condition <- " << cond);
 			string key, value;
 			if (parseCondition(cond, &key, &value) != 0) return 4;
 			condition->push_back(COND_PAIR(key, value));
@@ -155,7 +313,7 @@ int ControllerInvoke::parseCommand(string source, string *comm, string *targetn,
 			// 「,」がある場合
 			pos1 = next.find(",");
 			string cond = next.substr(0, pos1);
-			cout << "[ControllerInvoke::parseCommand]Condition <- " << cond << endl;
+			TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Condition <- " << cond);
 			string key, value;
 			if (parseCondition(cond, &key, &value) != 0) return 4;
 			condition->push_back(COND_PAIR(key, value));
@@ -171,15 +329,15 @@ int ControllerInvoke::parseCommand(string source, string *comm, string *targetn,
  * @brief 条件を分解して返します
  */
 inline int ControllerInvoke::parseCondition(string source, string *key, string *value) {
-	unsigned int pos = source.find("=");
+	string::size_type pos = source.find("=");
 	if (pos == string::npos) {
-		cout << "[ControllerInvoke::parseCommand]Invalid Condition <- " << source << endl;
+		TRACE(TRACE_ERROR, "[ControllerInvoke::parseCommand]Invalid Condition <- " << source);
 		return 1;
 	}
 	*key = source.substr(0, pos);
 	*value = source.substr(pos + 1);
-	cout << "[ControllerInvoke::parseCommand]Key <- " << *key << endl;
-	cout << "[ControllerInvoke::parseCommand]Value <- " << *value << endl;
+	TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Key <- " << *key);
+	TRACE(TRACE_DEBUG, "[ControllerInvoke::parseCommand]Value <- " << *value);
 	return 0;
 }
 
@@ -187,6 +345,13 @@ inline int ControllerInvoke::parseCondition(string source, string *key, string *
  * @brief BN処理を開始します
  */
 int main(int argc, char **argv) {
+	// --serve(=ソケットのパス)の指定がある場合は常駐して命令を繰り返し処理します
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]).compare(0, 7, "--serve") == 0) {
+			ControllerServe serve;
+			return serve.doProcessing(argc, argv);
+		}
+	}
 	ControllerInvoke invoke;
-	invoke.doProcessing(argc, argv);
+	return invoke.doProcessing(argc, argv);
 }
@@ -8,6 +8,22 @@
 
 #include "ControllerBase.h"
 
+/*!
+ * @brief コマンドラインのオプションと位置引数を定義します(ControllerInvoke、ControllerServeで共有します)
+ */
+struct ControllerOptions {
+	vector<string> args; // 位置引数(実データ、構造定義ファイル)
+	bool serve;          // --serveの指定有無
+	string socket;       // --serve=UNIXドメインソケットのパス
+	string model;        // --model=モデルファイル
+	string save;         // --save=モデルファイル
+	string learn;        // --learn=学習方式
+	string score;        // --score=スコア名
+	int sparse;          // --sparse=親候補数
+	int maxParents;      // --max-parents=親の最大数
+	map<string, CHARS> noisy; // --noisy=ノード名(:状態名/状態名/...)、雑音付きOR/MAXとするノードと状態の程度の順
+};
+
 /*!
  * @brief シンプルにBNを起動する処理を行います
  */
@@ -26,10 +42,45 @@ public:
 
 	/*!
 	 * @brief 主処理を呼び出します
+	 * ./network [CSV-File] [Relations-File(Optional)] [--learn=k2|hc|order|pc(:g2|chi2)|tree|tan:クラス列|ges] [--score=k2|bdeu(:等価標本サイズ)|bic|mdl|aic] [--sparse=親候補数] [--max-parents=親の最大数] [--noisy=ノード名(:状態名/...)]
+	 * 構造定義ファイルの指定がない場合は、--learnで選択した方式(既定はK2)と--scoreで選択したスコア(既定はK2、GESはBDeu)で構造を学習します
+	 * --sparseを指定した場合は、相互情報量で事前選択した親候補のみを探索します(列数が多い場合に指定します)
+	 * --noisyを指定したノードは条件付き確率表を展開せず雑音付きOR/MAXとします(3状態以上のノードは状態名を程度の低い順に指定します)
 	 */
 	int doProcessing(int argc, char **argv);
 
 protected:
+	/*!
+	 * @brief 実データからネットワーク構造を学習して構造定義ファイル(Nodes.csv)を作成します
+	 * @param[in] ProbabilityBase* 実データ
+	 * @param[in] string           学習方式(k2=K2、hc=山登り法、order=順序探索付きK2、pc=PCアルゴリズム、tree=Chow-Liu木、tan:クラス列=TAN、ges=GES、空の場合はK2)
+	 * @param[in] string           スコア名(空の場合はK2、GESはBDeu)
+	 * @param[in] int              ノード毎の親候補数(0の場合は事前選択しません)
+	 * @param[in] int              ノード毎の親の最大数(0の場合は無制限)
+	 * @return 0=正常終了
+	 */
+	int createStructure(ProbabilityBase *base, string learn, string score, int sparse = 0, int maxParents = 0);
+
+	/*!
+	 * @brief コマンドラインをオプションと位置引数に分解します
+	 * @param[in]  int                argc
+	 * @param[in]  char**             argv
+	 * @param[out] ControllerOptions* オプションと位置引数
+	 * @return 0=正常終了、1=不明なオプション
+	 */
+	int parseOptions(int argc, char **argv, ControllerOptions *options);
+
+	/*!
+	 * @brief --noisyで指定したノードを雑音付きOR/MAXとします
+	 * @return 0=正常終了
+	 */
+	int applyNoisy(CompositeBase *node, ControllerOptions *options);
+
+	/*!
+	 * @brief 使い方を表示します
+	 */
+	static void usage();
+
 	/*!
 	 * @brief 命令文を分解して返します
 	 */
@@ -0,0 +1,265 @@
+//============================================================================
+// Name        : ControllerServe.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "ControllerServe.h"
+#include "BayesianTrace.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+ControllerServe::ControllerServe() {
+	this->node   = NULL;
+	this->served = 0;
+}
+
+ControllerServe::~ControllerServe() {
+	if (node != NULL) delete node;
+}
+
+/*!
+ * @brief 主処理を呼び出します
+ */
+int ControllerServe::doProcessing(int argc, char **argv) {
+	// オプションと位置引数を分けます
+	ControllerOptions options;
+	// 雑音付きOR/MAXの母数は実データから求める為、構築済みモデルには指定できません
+	if (parseOptions(argc, argv, &options) != 0 || (options.args.empty() && options.model.empty()) || (!options.model.empty() && !options.noisy.empty())) {
+		usage();
+		return 1;
+	}
+	vector<string> &args = options.args;
+	string &model = options.model, &save = options.save;
+	// 応答を読み取り易くする為、トレースの指定がない場合はエラーのみとします
+	// トレースは応答の行と混ざらないように標準エラー出力に書き込みます(エラーの内容は応答の"message"にも返します)
+	if (getenv("BAYESIAN_TRACE") == NULL) traceLevel() = TRACE_ERROR;
+	traceOutput() = stderr;
+
+	int ret = 0;
+	ProbabilityBase *base = NULL;
+	if (!model.empty()) {
+		// 構築済みモデルを割り当てます(実データは読み込みません)
+		node = new CompositeBase(model);
+	} else {
+		// 実データを一度だけ読み込みます
+		string relation = (args.size() == 1 ? string(RELATION_FILE) : args[1]);
+		base = new ProbabilityBase(args[0]);
+		if (base->load() != 0) {
+			delete base;
+			return 2;
+		}
+		// ノード構造の指定がない場合は、データから作成します
+		if (args.size() == 1 && createStructure(base, options.learn, options.score, options.sparse, options.maxParents) != 0) {
+			delete base;
+			return 5;
+		}
+		// BNを一度だけ構築します(問合せに関わる連結成分のみ事前確率とCPTを作成します)
+		node = new CompositeBase(base, relation, true);
+		if (applyNoisy(node, &options) != 0) ret = 6;
+	}
+	if (ret != 0) {
+		cout << "[ControllerServe::doProcessing]Noisy-OR/MAX Failure" << endl;
+	} else if (node->nodes.empty()) {
+		cout << "[ControllerServe::doProcessing]Network Create Failure <- " << (model.empty() ? args.back() : model) << endl;
+		ret = 3;
+	} else if (!save.empty() && node->save(save) != 0) {
+		// 全連結成分を作成して構築済みモデルとして出力します
+		cout << "[ControllerServe::doProcessing]Model Save Failure -> " << save << endl;
+		ret = 4;
+	}
+	traceFlush();
+	if (ret == 0) ret = (options.socket.empty() ? serveStream() : serveSocket(options.socket));
+	delete node;
+	node = NULL;
+	if (base != NULL) delete base;
+	return ret;
+}
+
+/*!
+ * @brief 標準入力から命令を受け付けます
+ */
+int ControllerServe::serveStream() {
+	string source, response;
+	while (getline(cin, source)) {
+		if (!source.empty() && source[source.size() - 1] == '\r') source.erase(source.size() - 1);
+		if (source.empty()) continue;
+		int ret = answer(source, &response);
+		traceFlush();
+		cout << response << endl;
+		if (ret != 0) break;
+	}
+	return 0;
+}
+
+/*!
+ * @brief UNIXドメインソケットで接続を受け付け、接続毎に命令を処理します
+ * @param[in] string ソケットのパス
+ */
+int ControllerServe::serveSocket(string path) {
+	struct sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		cout << "[ControllerServe::serveSocket]Too Long Path <- " << path << endl;
+		return 1;
+	}
+	int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0) {
+		cout << "[ControllerServe::serveSocket]Socket Create Failure(" << strerror(errno) << ")" << endl;
+		return 2;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	unlink(path.c_str());
+	if (bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 16) != 0) {
+		cout << "[ControllerServe::serveSocket]Socket Bind Failure(" << strerror(errno) << ") <- " << path << endl;
+		close(server);
+		return 3;
+	}
+	cout << "[ControllerServe::serveSocket]Listening <- " << path << endl;
+	// BNは共有している為、接続は1件ずつ処理します
+	bool quit = false;
+	while (!quit) {
+		int client = accept(server, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		string buffer, response;
+		char chunk[4096];
+		ssize_t size;
+		while (!quit && (size = read(client, chunk, sizeof(chunk))) > 0) {
+			buffer.append(chunk, size);
+			// 改行までを1命令として処理します
+			string::size_type pos;
+			while (!quit && (pos = buffer.find('\n')) != string::npos) {
+				string source = buffer.substr(0, pos);
+				buffer.erase(0, pos + 1);
+				if (!source.empty() && source[source.size() - 1] == '\r') source.erase(source.size() - 1);
+				if (source.empty()) continue;
+				quit = (answer(source, &response) != 0);
+				response += '\n';
+				// 切断済みの場合もSIGPIPEで終了しないようにします
+				for (string::size_type sent = 0; sent < response.size(); ) {
+					ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+					if (n <= 0) break;
+					sent += n;
+				}
+			}
+		}
+		close(client);
+	}
+	close(server);
+	unlink(path.c_str());
+	return 0;
+}
+
+/*!
+ * @brief 1命令を処理して応答(JSON、改行なし)を返します
+ * {"id":1,"command":"P(B|A=a1)","status":"ok","cached":false,"latency_ms":0.42,"result":{"b1":0.03,"b2":0.97}}
+ * LW、GSは標準誤差を"error"に、MPEは説明の配列を"result"に返します
+ * @param[in]  string  命令文
+ * @param[out] string* 応答
+ * @return 0=継続、1=終了要求
+ */
+int ControllerServe::answer(string source, string *response) {
+	double begin = nowtime();
+	stringstream out;
+	out.precision(12);
+	out << "{\"id\":" << ++served << ",\"command\":" << quote(source);
+	if (source == "QUIT") {
+		out << ",\"status\":\"bye\"}";
+		*response = out.str();
+		return 1;
+	}
+	// 命令をパースします
+	string comm, targetn; COND condition;
+	if (parseCommand(source, &comm, &targetn, &condition) != 0) {
+		out << ",\"status\":\"error\",\"message\":\"invalid command\"}";
+		*response = out.str();
+		return 0;
+	}
+	stringstream result;
+	result.precision(12);
+	int ret = 0;
+	bool cached = false;
+	if (comm == "MPE") {
+		// 最も確からしい説明を上位k件求めます
+		int k = atoi(targetn.c_str());
+		node->format();
+		for (COND::iterator iter = condition.begin(); iter != condition.end() && ret == 0; iter++) {
+			ret = node->setProb(iter->first, iter->second);
+		}
+		vector<EXPLAIN> explains;
+		if (ret == 0) ret = node->calMPE(k <= 0 ? 1 : k, &explains);
+		result << ",\"result\":[";
+		for (unsigned int i = 0; i < explains.size(); i++) {
+			result << (i == 0 ? "" : ",") << "{\"p\":" << explains[i].first << ",\"assignment\":{";
+			for (LINE::iterator iter = explains[i].second.begin(); iter != explains[i].second.end(); iter++) {
+				result << (iter != explains[i].second.begin() ? "," : "") << quote(iter->first) << ":" << quote(iter->second);
+			}
+			result << "}}";
+		}
+		result << "]";
+	} else {
+		// コマンド名で推論方式を選択します(P=BP, LW=尤度重み付け法, GS=ギブスサンプリング)
+		int method = INFER_EXACT;
+		if (comm == "LW") method = INFER_LIKELIHOOD;
+		else if (comm == "GS") method = INFER_GIBBS;
+		else if (comm != "P") ret = -1;
+		POSTERIORS posteriors;
+		CHARS targets(1, targetn);
+		long hits = node->cache.hits;
+		if (ret == 0) ret = node->query(&condition, &targets, &posteriors, method);
+		cached = (node->cache.hits != hits);
+		PROBS &probs = posteriors[targetn];
+		result << ",\"result\":{";
+		for (PROBS::iterator iter = probs.begin(); iter != probs.end(); iter++) {
+			result << (iter != probs.begin() ? "," : "") << quote(iter->first) << ":" << iter->second;
+		}
+		result << "}";
+		// 標準誤差は今回計算した場合のみ返します
+		PROBS errors;
+		if (ret == 0 && !cached && method != INFER_EXACT && node->getError(targetn, &errors) == 0 && !errors.empty()) {
+			result << ",\"error\":{";
+			for (PROBS::iterator iter = errors.begin(); iter != errors.end(); iter++) {
+				result << (iter != errors.begin() ? "," : "") << quote(iter->first) << ":" << iter->second;
+			}
+			result << "}";
+		}
+	}
+	if (ret != 0) {
+		string message = (ret < 0 ? "unknown command " + comm : node->work->message);
+		out << ",\"status\":\"error\",\"message\":" << quote(message.empty() ? string("inference failed") : message);
+	} else {
+		out << ",\"status\":\"ok\",\"cached\":" << (cached ? "true" : "false");
+	}
+	out << ",\"latency_ms\":" << (nowtime() - begin);
+	if (ret == 0) out << result.str();
+	out << "}";
+	*response = out.str();
+	return 0;
+}
+
+/*!
+ * @brief JSONの文字列として引用符を付けて返します
+ */
+string ControllerServe::quote(const string &text) {
+	string result("\"");
+	for (string::const_iterator iter = text.begin(); iter != text.end(); iter++) {
+		unsigned char c = *iter;
+		if (c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		} else if (c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			result += escape;
+		} else {
+			result += c;
+		}
+	}
+	result += '"';
+	return result;
+}
@@ -0,0 +1,77 @@
+//============================================================================
+// Name        : ControllerServe.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef CONTROLLERSERVE_H_
+#define CONTROLLERSERVE_H_
+
+#include "ControllerInvoke.h"
+
+/*!
+ * @brief 実データとBNを一度だけ構築して常駐し、命令を繰り返し処理します
+ * 命令はControllerInvokeと同じ書式(P(B|A=a1)、LW(...)、GS(...)、MPE(k|...))で1行ずつ受け付け、
+ * 結果は1行のJSON(処理時間を含みます)で返します、QUITで終了します
+ */
+class ControllerServe : public ControllerInvoke {
+
+public:
+	/*!
+	 * @brief
+	 */
+	ControllerServe();
+
+	/*!
+	 * @brief
+	 */
+	virtual ~ControllerServe();
+
+	/*!
+	 * @brief 主処理を呼び出します
+	 * ./network [CSV-File] [Relations-File(Optional)] --serve[=UNIXドメインソケットのパス] [--save=モデルファイル] [--learn=学習方式] [--score=スコア名] [--sparse=親候補数] [--max-parents=親の最大数]
+	 * ./network --model=モデルファイル --serve[=UNIXドメインソケットのパス]
+	 * ソケットの指定がない場合は標準入力から命令を受け付けて標準出力に返します
+	 * --saveは構築したBNを構築済みモデルとして出力し、--modelはそれを実データなしで割り当てます
+	 * モデルファイルの拡張子が.bif、.xml、.xmlbifの場合はBIF/XMLBIFとして出力、読み込みします
+	 */
+	int doProcessing(int argc, char **argv);
+
+protected:
+	/*!
+	 * @brief 常駐するBNを保持します
+	 */
+	CompositeBase *node;
+
+	/*!
+	 * @brief 処理した命令数を保持します
+	 */
+	long served;
+
+protected:
+	/*!
+	 * @brief 標準入力から命令を受け付けます
+	 */
+	int serveStream();
+
+	/*!
+	 * @brief UNIXドメインソケットで接続を受け付け、接続毎に命令を処理します
+	 * @param[in] string ソケットのパス
+	 */
+	int serveSocket(string path);
+
+	/*!
+	 * @brief 1命令を処理して応答(JSON、改行なし)を返します
+	 * @param[in]  string  命令文
+	 * @param[out] string* 応答
+	 * @return 0=継続、1=終了要求
+	 */
+	int answer(string source, string *response);
+
+	/*!
+	 * @brief JSONの文字列として引用符を付けて返します
+	 */
+	static string quote(const string &text);
+
+};
+
+#endif /* CONTROLLERSERVE_H_ */
@@ -0,0 +1,143 @@
+//============================================================================
+// Name        : BayesianArena.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef BAYESIANARENA_H_
+#define BAYESIANARENA_H_
+
+#include "BayesianDefine.h"
+
+//----------------------------------------------------------------------------
+// 問合せ単位の一時領域を切り出す単調増加アロケータを定義します
+// 領域は先頭から順に切り出すのみで個別には解放せず、mark/releaseで位置を戻すか
+// resetで全体を戻します、確保したブロックは破棄まで保持する為、同程度の問合せを
+// 繰り返す定常状態ではヒープを確保しません(1スレッド専用です)
+//----------------------------------------------------------------------------
+/*! @brief 1ブロックの既定の大きさ(バイト)を定義します */
+#define ARENA_BLOCK (64UL * 1024)
+
+/*! @brief 切り出す領域の境界(バイト)を定義します */
+#define ARENA_ALIGN 16UL
+
+/*!
+ * @brief 切り出し位置(ブロック番号とブロック内の位置)を保持します
+ */
+struct ArenaMark {
+	size_t block;   // ブロック番号
+	size_t offset;  // ブロック内の位置
+};
+
+/*!
+ * @brief 単調増加アロケータです
+ */
+class BayesianArena {
+
+private:
+	/*!
+	 * @brief 複製は許可しません(ブロックの二重解放を防ぐ為)
+	 */
+	BayesianArena(const BayesianArena&);
+	BayesianArena &operator=(const BayesianArena&);
+
+public:
+	/*!
+	 * @brief 1ブロックの大きさを指定します(ブロックは初回の切り出し時に確保します)
+	 * @param[in] size_t 1ブロックの大きさ(バイト)
+	 */
+	BayesianArena(size_t block = ARENA_BLOCK) {
+		this->block   = block;
+		this->current = 0;
+		this->offset  = 0;
+	}
+
+	/*!
+	 * @brief 全ブロックを解放します
+	 */
+	~BayesianArena() {
+		for (unsigned int i = 0; i < blocks.size(); i++) free(blocks[i]);
+	}
+
+	/*!
+	 * @brief 指定型の配列を切り出します(初期化はしません)
+	 * @param[in] size_t 要素数
+	 * @return 配列の先頭
+	 */
+	template<class T> T *allocate(size_t count) {
+		return (T*)allocate(count * sizeof(T));
+	}
+
+	/*!
+	 * @brief 指定バイト数の領域を切り出します
+	 * 現在のブロックに収まらない場合は次のブロックに進み、収まるブロックがない場合は確保します
+	 * @param[in] size_t バイト数
+	 * @return 領域の先頭
+	 */
+	void *allocate(size_t bytes) {
+		bytes = (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+		while (current < blocks.size() && offset + bytes > sizes[current]) {
+			current++;
+			offset = 0;
+		}
+		if (current >= blocks.size()) {
+			size_t size = (bytes > block ? bytes : block);
+			void *memory = NULL;
+			if (posix_memalign(&memory, ARENA_ALIGN, size) != 0) {
+				printf("[BayesianArena::allocate]could not allocate %lu bytes\n", (unsigned long)size);
+				abort();
+			}
+			blocks.push_back((char*)memory);
+			sizes.push_back(size);
+			current = blocks.size() - 1;
+			offset = 0;
+		}
+		void *result = blocks[current] + offset;
+		offset += bytes;
+		return result;
+	}
+
+	/*!
+	 * @brief 現在の切り出し位置を返します
+	 */
+	ArenaMark mark() const {
+		ArenaMark result;
+		result.block  = current;
+		result.offset = offset;
+		return result;
+	}
+
+	/*!
+	 * @brief 切り出し位置を戻し、以降に切り出した領域を一括で解放します
+	 * @param[in] ArenaMark markで取得した位置
+	 */
+	void release(const ArenaMark &position) {
+		current = position.block;
+		offset  = position.offset;
+	}
+
+	/*!
+	 * @brief 全ての領域を一括で解放します(ブロックは再利用の為に保持します)
+	 */
+	void reset() {
+		current = 0;
+		offset  = 0;
+	}
+
+	/*!
+	 * @brief 確保済みのブロックの合計(バイト)を返します
+	 */
+	size_t capacity() const {
+		size_t total = 0;
+		for (unsigned int i = 0; i < sizes.size(); i++) total += sizes[i];
+		return total;
+	}
+
+private:
+	vector<char*> blocks;  // 確保したブロック
+	vector<size_t> sizes;  // ブロック毎の大きさ
+	size_t block;          // 1ブロックの既定の大きさ
+	size_t current;        // 切り出し中のブロック番号
+	size_t offset;         // 切り出し中のブロック内の位置
+};
+
+#endif /* BAYESIANARENA_H_ */
@@ -78,6 +78,12 @@ typedef vector<SSORT> PROBO;
 /*! @brief ノード集合の代理名を定義します */
 typedef map<string, CompositeNode*> NODES;
 
+/*! @brief ノード名と事後確率の関係を定義します */
+typedef map<string, PROBS> POSTERIORS;
+
+/*! @brief 説明(同時確率とノード名=状態名の組)を定義します */
+typedef pair<UD, LINE> EXPLAIN;
+
 /*! @brief 頻度を保持する代理名を定義します */
 typedef map<string, vector<int>* > FREQ;
 
@@ -90,23 +96,33 @@ typedef map<string, vector<int>* > FREQ;
 /*! @brief ノード親子関係定義ファイル名を定義します */
 #define RELATION_FILE "Nodes.csv"
 
+/*! @brief 辺の一覧形式の親子関係定義ファイルの見出し行を定義します */
+#define RELATION_EDGES "parent,child"
+
+/*! @brief ノード数がこれを超える場合、親子関係定義ファイルを隣接行列ではなく辺の一覧で出力します */
+#define RELATION_DENSE_LIMIT 256
+
+/*! @brief 推論方式(BPによる厳密推論)を定義します */
+#define INFER_EXACT 0
+
+/*! @brief 推論方式(尤度重み付け法による近似推論)を定義します */
+#define INFER_LIKELIHOOD 1
+
+/*! @brief 推論方式(ギブスサンプリングによる近似推論)を定義します */
+#define INFER_GIBBS 2
+
 //----------------------------------------------------------------------------
 // 本ソフトウェア特有の静的共通処理を定義します
 //----------------------------------------------------------------------------
 /*!
- * @brief 現在時刻をマイクロ秒単位で取得します
+ * @brief 単調増加する現在時刻をマイクロ秒の精度で取得します
  * @return double 現在時刻(ミリ秒)
  */
 inline double nowtime() {
-	// 現在経過マイクロ秒を取得して返します(Linux用)
-    /*
-	struct timeval nowtime;
-    char now[64];
-    gettimeofday(&nowtime, NULL);
-    sprintf(now, "%d.%06d", (int)nowtime.tv_sec, (int)nowtime.tv_usec);
-    return strtod(now, NULL);
-    */
-	return 0.0;
+	// 時刻の変更に影響されない単調増加の時計を用います(Linux用)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
 }
 
 /*!
@@ -0,0 +1,174 @@
+//============================================================================
+// Name        : BayesianProfile.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef BAYESIANPROFILE_H_
+#define BAYESIANPROFILE_H_
+
+#include "BayesianDefine.h"
+
+//----------------------------------------------------------------------------
+// 処理段階毎の計測(時間、回数)と件数の集計を定義します
+// PROFILEを定義してコンパイルした場合のみ計測し、終了時に環境変数
+// BAYESIAN_PROFILEのファイル(既定はprofile.json、拡張子.csvの場合はCSV)に出力します
+// 定義しない場合は、計測用のマクロは空となり処理は残りません
+//----------------------------------------------------------------------------
+/*! @brief 処理段階(CSV読み込み)を定義します */
+#define PROFILE_LOAD      0
+
+/*! @brief 処理段階(K2による構造学習のスコア計算)を定義します */
+#define PROFILE_K2        1
+
+/*! @brief 処理段階(ネットワーク構築)を定義します */
+#define PROFILE_NETWORK   2
+
+/*! @brief 処理段階(初期化)を定義します */
+#define PROFILE_FORMAT    3
+
+/*! @brief 処理段階(確率伝播、近似推論)を定義します */
+#define PROFILE_PROPAGATE 4
+
+/*! @brief 処理段階の数を定義します */
+#define PROFILE_PHASES    5
+
+/*! @brief 件数(prob呼び出し回数)を定義します */
+#define PROFILE_PROB      0
+
+/*! @brief 件数(走査した行数)を定義します */
+#define PROFILE_ROWS      1
+
+/*! @brief 件数(転送したメッセージ数)を定義します */
+#define PROFILE_MESSAGES  2
+
+/*! @brief 件数の数を定義します */
+#define PROFILE_COUNTERS  3
+
+#ifdef PROFILE
+
+/*!
+ * @brief 全スレッドで共有する計測結果を保持します
+ */
+struct BayesianProfile {
+	volatile long long elapsed[PROFILE_PHASES];  // 処理段階毎の経過ナノ秒
+	volatile long long calls[PROFILE_PHASES];    // 処理段階毎の呼び出し回数
+	volatile long long counts[PROFILE_COUNTERS]; // 件数
+	double begin;                                // 計測開始時刻(ミリ秒)
+};
+
+/*!
+ * @brief 単調増加する時刻をナノ秒単位で返します
+ */
+inline long long profileClock() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+inline void profileReport();
+
+/*!
+ * @brief 計測結果を初期化し、終了時の出力を登録します
+ */
+inline BayesianProfile *profileCreate() {
+	static BayesianProfile storage;
+	for (int i = 0; i < PROFILE_PHASES; i++) storage.elapsed[i] = storage.calls[i] = 0;
+	for (int i = 0; i < PROFILE_COUNTERS; i++) storage.counts[i] = 0;
+	storage.begin = nowtime();
+	atexit(profileReport);
+	return &storage;
+}
+
+/*!
+ * @brief 計測結果を返します(初回呼び出し時に初期化します)
+ */
+inline BayesianProfile &profile() {
+	static BayesianProfile *instance = profileCreate();
+	return *instance;
+}
+
+/*!
+ * @brief 処理段階の名前を返します
+ */
+inline const char *profilePhase(int phase) {
+	static const char *names[PROFILE_PHASES] = { "load", "k2", "network", "format", "propagate" };
+	return names[phase];
+}
+
+/*!
+ * @brief 件数の名前を返します
+ */
+inline const char *profileCounter(int counter) {
+	static const char *names[PROFILE_COUNTERS] = { "prob", "rows", "messages" };
+	return names[counter];
+}
+
+/*!
+ * @brief 計測結果をJSON又はCSVで出力します
+ */
+inline void profileReport() {
+	BayesianProfile &result = profile();
+	const char *file = getenv("BAYESIAN_PROFILE");
+	if (file == NULL || *file == '\0') file = "profile.json";
+	string name(file);
+	bool csv = (name.size() >= 4 && name.compare(name.size() - 4, 4, ".csv") == 0);
+	FILE *fp = fopen(file, "w");
+	if (fp == NULL) {
+		printf("[profileReport]could not open %s\n", file);
+		return;
+	}
+	double total = (nowtime() - result.begin) / 1000.0;
+	if (csv) {
+		fprintf(fp, "kind,name,seconds,calls\n");
+		for (int i = 0; i < PROFILE_PHASES; i++) {
+			fprintf(fp, "phase,%s,%.9f,%lld\n", profilePhase(i), result.elapsed[i] / 1e9, result.calls[i]);
+		}
+		for (int i = 0; i < PROFILE_COUNTERS; i++) {
+			fprintf(fp, "counter,%s,,%lld\n", profileCounter(i), result.counts[i]);
+		}
+		fprintf(fp, "total,wall,%.9f,\n", total);
+	} else {
+		fprintf(fp, "{\n  \"wall\": %.9f,\n  \"phases\": {", total);
+		for (int i = 0; i < PROFILE_PHASES; i++) {
+			fprintf(fp, "%s\n    \"%s\": { \"seconds\": %.9f, \"calls\": %lld }", (i == 0 ? "" : ","),
+					profilePhase(i), result.elapsed[i] / 1e9, result.calls[i]);
+		}
+		fprintf(fp, "\n  },\n  \"counters\": {");
+		for (int i = 0; i < PROFILE_COUNTERS; i++) {
+			fprintf(fp, "%s\n    \"%s\": %lld", (i == 0 ? "" : ","), profileCounter(i), result.counts[i]);
+		}
+		fprintf(fp, "\n  }\n}\n");
+	}
+	fclose(fp);
+}
+
+/*!
+ * @brief 生成から破棄までの時間を処理段階に加算します
+ */
+class ProfileScope {
+public:
+	ProfileScope(int phase) { this->phase = phase; this->begin = profileClock(); }
+	~ProfileScope() {
+		BayesianProfile &result = profile();
+		__sync_fetch_and_add(&result.elapsed[phase], profileClock() - begin);
+		__sync_fetch_and_add(&result.calls[phase], 1LL);
+	}
+private:
+	int phase;        // 処理段階
+	long long begin;  // 開始時刻(ナノ秒)
+};
+
+/*! @brief 現在のスコープの終了までを処理段階の時間として計測します */
+#define PROFILE_SCOPE(phase) ProfileScope profileScope##phase(phase)
+
+/*! @brief 件数を加算します */
+#define PROFILE_COUNT(counter, n) __sync_fetch_and_add(&profile().counts[counter], (long long)(n))
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, n)
+
+#endif /* PROFILE */
+
+#endif /* BAYESIANPROFILE_H_ */
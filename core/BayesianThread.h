@@ -0,0 +1,94 @@
+//============================================================================
+// Name        : BayesianThread.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef BAYESIANTHREAD_H_
+#define BAYESIANTHREAD_H_
+
+#include "BayesianDefine.h"
+#include <pthread.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------------------
+// POSIXスレッドを用いた簡易な並列処理を定義します
+// 処理対象は operator()(long index, int thread) を持つ関数オブジェクトとし、
+// 各スレッドは処理番号を先着順に取得して処理します
+//----------------------------------------------------------------------------
+/*!
+ * @brief 全スレッドで共有する処理状態を保持します
+ */
+template<class F> struct ParallelShared {
+	F *func;             // 処理本体
+	long size;           // 処理番号の総数
+	volatile long next;  // 次に処理する処理番号
+};
+
+/*!
+ * @brief スレッド毎の処理状態を保持します
+ */
+template<class F> struct ParallelWorker {
+	ParallelShared<F> *shared; // 共有処理状態
+	int thread;                // スレッド番号(0開始)
+};
+
+/*!
+ * @brief スレッドの処理本体です、処理番号がなくなるまで処理を繰り返します
+ */
+template<class F> void *parallelEntry(void *arg) {
+	ParallelWorker<F> *worker = (ParallelWorker<F>*)arg;
+	ParallelShared<F> *shared = worker->shared;
+	long index;
+	while ((index = __sync_fetch_and_add(&shared->next, 1)) < shared->size) {
+		(*shared->func)(index, worker->thread);
+	}
+	return NULL;
+}
+
+/*!
+ * @brief 利用可能なCPU数を返します
+ * @return int CPU数(取得できない場合は1)
+ */
+inline int parallelCores() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cores <= 0 ? 1 : (int)cores);
+}
+
+/*!
+ * @brief 処理番号0からsize-1までを指定スレッド数で並列に処理します
+ * @param[in] int  スレッド数(0以下の場合はCPU数)
+ * @param[in] long 処理番号の総数
+ * @param[in] F*   処理本体(operator()(long index, int thread))
+ * @return 0=正常終了
+ */
+template<class F> int parallel(int threads, long size, F *func) {
+	if (threads <= 0) threads = parallelCores();
+	if (threads > size) threads = (int)size;
+	// 1スレッドの場合はスレッドを作成せずに処理します
+	if (threads <= 1) {
+		for (long index = 0; index < size; index++) (*func)(index, 0);
+		return 0;
+	}
+	ParallelShared<F> shared;
+	shared.func = func;
+	shared.size = size;
+	shared.next = 0;
+	vector<pthread_t> handles(threads);
+	vector<ParallelWorker<F> > workers(threads);
+	int created = 0;
+	for (int i = 0; i < threads; i++) {
+		workers[i].shared = &shared;
+		workers[i].thread = i;
+		if (i == 0) continue; // 0番は呼び出し元スレッドが担当します
+		if (pthread_create(&handles[i], NULL, parallelEntry<F>, &workers[i]) != 0) {
+			printf("[parallel]Thread Create Failure(%d)\n", i);
+			break;
+		}
+		created = i;
+	}
+	parallelEntry<F>(&workers[0]);
+	for (int i = 1; i <= created; i++) pthread_join(handles[i], NULL);
+	return 0;
+}
+
+#endif /* BAYESIANTHREAD_H_ */
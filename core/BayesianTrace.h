@@ -0,0 +1,214 @@
+//============================================================================
+// Name        : BayesianTrace.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef BAYESIANTRACE_H_
+#define BAYESIANTRACE_H_
+
+#include "BayesianDefine.h"
+#include <pthread.h>
+#include <ctype.h>
+
+//----------------------------------------------------------------------------
+// 水準付きのトレース出力を定義します
+// TRACE_COMPILEDを超える水準はコンパイル時に除去し、それ以下の水準は実行時に
+// 環境変数BAYESIAN_TRACE(既定はTRACE_INFO)と比較してから文字列を作成します
+// 既定ではTRACE_INFOまでを残す為、DEBUG、DETAILのトレースを出力する場合は
+// -DTRACE_COMPILED=3(又は4)を指定してコンパイルして下さい
+// 出力はリングバッファに積み、出力用スレッドが出力先(既定は標準出力)へまとめて書き込みます
+//----------------------------------------------------------------------------
+/*! @brief トレース水準(エラー)を定義します */
+#define TRACE_ERROR  1
+
+/*! @brief トレース水準(処理単位の情報)を定義します */
+#define TRACE_INFO   2
+
+/*! @brief トレース水準(メッセージ、ノード単位の情報)を定義します */
+#define TRACE_DEBUG  3
+
+/*! @brief トレース水準(全ノードの状態の表示)を定義します */
+#define TRACE_DETAIL 4
+
+/*! @brief コンパイル時に残すトレース水準を定義します(既定はTRACE_INFO、-DTRACE_COMPILED=n で変更します) */
+#ifndef TRACE_COMPILED
+#define TRACE_COMPILED TRACE_INFO
+#endif
+
+/*! @brief リングバッファの行数を定義します */
+#define TRACE_CAPACITY 8192
+
+/*!
+ * @brief 出力用スレッドと共有するリングバッファを保持します
+ */
+struct TraceSink {
+	pthread_mutex_t mutex;   // 排他制御
+	pthread_cond_t ready;    // 出力待ちの行が追加された通知
+	pthread_cond_t space;    // 行が取り出された、又は書き込まれた通知
+	pthread_t thread;        // 出力用スレッド
+	vector<string> slots;    // リングバッファ
+	unsigned long head;      // 追加した行数
+	unsigned long tail;      // 取り出した行数
+	unsigned long done;      // 書き込んだ行数
+	bool stop;               // 終了要求
+	bool running;            // 出力用スレッドの起動有無
+};
+
+/*!
+ * @brief トレース水準の指定(0～4の数値、又はERROR、INFO、DEBUG、DETAIL、大文字小文字は区別しません)を水準に変換します
+ * @param[in] char* 指定の文字列
+ * @return 水準(解釈できない場合は-1)
+ */
+inline int traceParse(const char *text) {
+	string name;
+	for (const char *p = text; *p != '\0'; p++) name += (char)toupper((unsigned char)*p);
+	if (name == "ERROR")  return TRACE_ERROR;
+	if (name == "INFO")   return TRACE_INFO;
+	if (name == "DEBUG")  return TRACE_DEBUG;
+	if (name == "DETAIL") return TRACE_DETAIL;
+	char *end;
+	long level = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || level < 0 || level > TRACE_DETAIL) return -1;
+	return (int)level;
+}
+
+/*!
+ * @brief 環境変数BAYESIAN_TRACEからトレース水準を求めます(解釈できない場合は警告してTRACE_INFOとします)
+ */
+inline int traceDefault() {
+	const char *text = getenv("BAYESIAN_TRACE");
+	if (text == NULL) return TRACE_INFO;
+	int level = traceParse(text);
+	if (level < 0) {
+		fprintf(stderr, "[traceDefault]Invalid BAYESIAN_TRACE <- %s(use 0-4 or ERROR, INFO, DEBUG, DETAIL)\n", text);
+		return TRACE_INFO;
+	}
+	return level;
+}
+
+/*!
+ * @brief 実行時のトレース水準を返します(変更する場合は代入します)
+ */
+inline int &traceLevel() {
+	static int level = traceDefault();
+	return level;
+}
+
+/*!
+ * @brief トレースの出力先を返します(変更する場合は出力前に代入します)
+ */
+inline FILE *&traceOutput() {
+	static FILE *output = stdout;
+	return output;
+}
+
+/*! @brief 指定水準のトレースが有効か否かを返します(無効な場合は文字列を作成しないで下さい) */
+#define TRACE_ON(level) ((level) <= TRACE_COMPILED && (level) <= traceLevel())
+
+/*! @brief 指定水準が有効な場合のみ、ストリーム形式の式を1行としてトレースします */
+#define TRACE(level, expr) do { \
+	if (TRACE_ON(level)) { stringstream traceText; traceText << expr << '\n'; tracePush(traceText.str()); } \
+} while (0)
+
+/*!
+ * @brief 出力用スレッドの処理本体です、積まれた行をまとめて出力先に書き込みます
+ */
+inline void *traceEntry(void *arg) {
+	TraceSink *sink = (TraceSink*)arg;
+	vector<string> batch;
+	pthread_mutex_lock(&sink->mutex);
+	while (true) {
+		while (sink->head == sink->tail && !sink->stop) pthread_cond_wait(&sink->ready, &sink->mutex);
+		if (sink->head == sink->tail) break;
+		// 積まれた行を取り出して、ロックを外してから書き込みます
+		unsigned long last = sink->head;
+		batch.clear();
+		for (; sink->tail != last; sink->tail++) {
+			batch.push_back(string());
+			batch.back().swap(sink->slots[sink->tail % TRACE_CAPACITY]);
+		}
+		pthread_cond_broadcast(&sink->space);
+		pthread_mutex_unlock(&sink->mutex);
+		for (vector<string>::iterator iter = batch.begin(); iter != batch.end(); iter++) {
+			fwrite(iter->data(), 1, iter->size(), traceOutput());
+		}
+		fflush(traceOutput());
+		pthread_mutex_lock(&sink->mutex);
+		sink->done = last;
+		pthread_cond_broadcast(&sink->space);
+	}
+	pthread_mutex_unlock(&sink->mutex);
+	return NULL;
+}
+
+inline void traceClose();
+
+/*!
+ * @brief リングバッファを作成して出力用スレッドを起動します
+ */
+inline TraceSink *traceCreate() {
+	static TraceSink sink;
+	pthread_mutex_init(&sink.mutex, NULL);
+	pthread_cond_init(&sink.ready, NULL);
+	pthread_cond_init(&sink.space, NULL);
+	sink.slots.resize(TRACE_CAPACITY);
+	sink.head = sink.tail = sink.done = 0;
+	sink.stop = false;
+	sink.running = (pthread_create(&sink.thread, NULL, traceEntry, &sink) == 0);
+	atexit(traceClose);
+	return &sink;
+}
+
+/*!
+ * @brief リングバッファを返します(初回呼び出し時に作成します)
+ */
+inline TraceSink *traceSink() {
+	static TraceSink *sink = traceCreate();
+	return sink;
+}
+
+/*!
+ * @brief 1行(改行を含む)をリングバッファに積みます(満杯の場合は空くまで待ちます)
+ * @param[in] string 出力する行
+ */
+inline void tracePush(const string &text) {
+	TraceSink *sink = traceSink();
+	// 出力用スレッドがない場合は直接書き込みます
+	if (!sink->running) {
+		fwrite(text.data(), 1, text.size(), traceOutput());
+		return;
+	}
+	pthread_mutex_lock(&sink->mutex);
+	while (sink->head - sink->tail >= TRACE_CAPACITY) pthread_cond_wait(&sink->space, &sink->mutex);
+	sink->slots[sink->head % TRACE_CAPACITY] = text;
+	sink->head++;
+	pthread_cond_signal(&sink->ready);
+	pthread_mutex_unlock(&sink->mutex);
+}
+
+/*!
+ * @brief 積まれた全ての行が書き込まれるまで待ちます(直接出力する前に呼び出します)
+ */
+inline void traceFlush() {
+	TraceSink *sink = traceSink();
+	if (!sink->running) return;
+	pthread_mutex_lock(&sink->mutex);
+	while (sink->done != sink->head) pthread_cond_wait(&sink->space, &sink->mutex);
+	pthread_mutex_unlock(&sink->mutex);
+}
+
+/*!
+ * @brief 積まれた行を全て書き込んで出力用スレッドを終了します(終了時に呼び出されます)
+ */
+inline void traceClose() {
+	TraceSink *sink = traceSink();
+	if (!sink->running) return;
+	pthread_mutex_lock(&sink->mutex);
+	sink->stop = true;
+	pthread_cond_signal(&sink->ready);
+	pthread_mutex_unlock(&sink->mutex);
+	pthread_join(sink->thread, NULL);
+	sink->running = false;
+}
+
+#endif /* BAYESIANTRACE_H_ */
@@ -4,20 +4,196 @@
 // Description : Bayesian Network Processing in C++, Ansi-style
 //============================================================================
 #include "CompositeBase.h"
+#include "BayesianProfile.h"
+#include "BayesianTrace.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief 事後確率キャッシュの既定の保持容量(バイト)を定義します
+ */
+#define CACHE_CAPACITY (64UL * 1024 * 1024)
+
+/*!
+ * @brief invoke時に全ノード分のメッセージ転送手順を作成する最大ノード数を定義します
+ * これを超える場合は、手順を初回の伝播時に作成します(手順の総量がノード数の2乗となる為)
+ */
+#define SCHEDULE_PRECOMPILE 1024
+
+/*!
+ * @brief 構築済みモデルファイルの識別子を定義します
+ */
+#define MODEL_MAGIC "BNMODEL"
+
+/*!
+ * @brief 構築済みモデルファイルの版数を定義します
+ */
+#define MODEL_VERSION 1
+
+/*!
+ * @brief 構築済みモデルファイルのバイト順の確認値を定義します
+ */
+#define MODEL_ENDIAN 0x01020304U
+
+/*!
+ * @brief 構築済みモデルファイルの見出しを定義します
+ * 位置は全てファイル先頭からのバイト数で、各領域は8バイト境界に配置します
+ * 見出し、ノード(ModelNode×ノード数)、親(ノード番号×辺数)、トポロジカル順(ノード番号×ノード数)、
+ * 文字列(ModelString×文字列数)、文字列本体、確率(double)の順に並べます
+ */
+struct ModelHeader {
+	char magic[8];                  // 識別子(MODEL_MAGIC)
+	unsigned int version;           // 版数(MODEL_VERSION)
+	unsigned int endian;            // バイト順の確認値(MODEL_ENDIAN)
+	unsigned int count;             // ノード数
+	unsigned int edges;             // 辺数
+	unsigned long long nodes;       // ノードの位置
+	unsigned long long parents;     // 親の位置
+	unsigned long long order;       // トポロジカル順の位置
+	unsigned long long strings;     // 文字列の位置
+	unsigned long long texts;       // 文字列本体の位置
+	unsigned long long values;      // 確率の位置
+	unsigned long long size;        // ファイルの大きさ
+};
+
+/*!
+ * @brief 構築済みモデルファイルの1ノードを定義します
+ * 文字列は文字列番号、確率は確率領域の先頭からの要素番号で参照します
+ */
+struct ModelNode {
+	unsigned int name;              // ノード名の文字列番号
+	unsigned int states;            // 状態数
+	unsigned int state;             // 先頭の状態名の文字列番号(状態名は連続して並べます)
+	unsigned int count;             // 親の数
+	unsigned long long parent;      // 先頭の親の位置(親領域の要素番号、parentsの順)
+	unsigned long long prior;       // 事前確率の要素番号(状態数分)
+	unsigned long long value;       // CPTの要素番号
+	unsigned long long cells;       // CPTの要素数
+};
+
+/*!
+ * @brief 構築済みモデルファイルの文字列を定義します
+ */
+struct ModelString {
+	unsigned long long offset;      // 文字列本体の先頭からの位置
+	unsigned long long length;      // 長さ
+};
+
+/*!
+ * @brief 8バイト境界に切り上げます
+ */
+static inline unsigned long long modelAlign(unsigned long long size) {
+	return (size + 7) & ~7ULL;
+}
+
+/*!
+ * @brief ノードの事前確率又はCPTを並列に作成する処理を定義します
+ */
+struct CompositeMaterialize {
+	vector<CompositeNode*> *targets; // 対象ノード
+	bool compile;                    // false=事前確率、true=CPT
+	volatile long errors;            // 失敗したノード数
+	void operator()(long index, int thread) {
+		CompositeNode *target = (*targets)[index];
+		if ((compile ? target->compile() : target->materialize()) != 0) {
+			__sync_fetch_and_add(&errors, 1);
+		}
+	}
+};
+
+/*!
+ * @brief ノードの事前確率(要素名の順)を返します
+ * @param[in]  CompositeNode* 対象ノード
+ * @param[out] UD*            事前確率(要素数分の領域)
+ */
+static void priorOf(CompositeNode *target, UD *result) {
+	for (unsigned int k = 0; k < target->elements.size(); k++) {
+		PROBS::iterator found = target->prior.find(target->elements[k]);
+		result[k] = (found == target->prior.end() ? 0.0 : found->second);
+	}
+}
+
+/*!
+ * @brief 連結成分の事前確率とCPTが作成済みか否かを返します(作成したスレッドの書き込みを参照できます)
+ * @param[in] vector<char>& 連結成分毎の作成有無
+ * @param[in] int           連結成分の番号
+ */
+static inline bool isReady(vector<char> &ready, int component) {
+	return __sync_fetch_and_or(&ready[component], 0) != 0;
+}
 
 /*!
  * @brief BN構造とCPT引数を元にBN処理を行います
  * @param[in] ProbabilityBase* データを保持した確率処理(CPTを提供)
+ * @param[in] bool             true=事前確率とCPTを問合せで到達した連結成分のみ遅延して作成します
  */
-CompositeBase::CompositeBase(ProbabilityBase *vfile, string relations) {
+CompositeBase::CompositeBase(ProbabilityBase *vfile, string relations, bool lazy) : sampler(&nodes), cache(CACHE_CAPACITY) {
 	// CPT処理とパース処理を保持します
 	this->vfile = vfile;
+	this->maxDepth = 0;
+	// 事前確率とCPTの作成方法を保持します
+	this->lazy = lazy;
+	this->threads = 0;
+	// 構造の更新回数を初期化します
+	this->revision = 0;
+	this->cacheRevision = -1;
+	this->cacheData = -1;
+	// 既定のワークスペースはネットワーク構築時に作成します
+	this->work = NULL;
+	pthread_mutex_init(&mutex, NULL);
+	this->mapping = NULL;
+	this->mappingSize = 0;
 	// ファイル名を保持します
 	this->relations = relations;
 	// BNを作成します
 	invoke();
 }
 
+/*!
+ * @brief 構築済みモデルファイル(saveで出力)を割り当ててBN処理を行います(実データは不要です)
+ * @param[in] string モデルファイル名
+ */
+CompositeBase::CompositeBase(string model) : sampler(&nodes), cache(CACHE_CAPACITY) {
+	// 実データは持たず、全ノードの事前確率とCPTはモデルファイルから割り当てます
+	this->vfile = NULL;
+	this->maxDepth = 0;
+	this->lazy = false;
+	this->threads = 0;
+	// 構造の更新回数を初期化します
+	this->revision = 0;
+	this->cacheRevision = -1;
+	this->cacheData = -1;
+	// 既定のワークスペースはネットワーク構築時に作成します
+	this->work = NULL;
+	pthread_mutex_init(&mutex, NULL);
+	this->mapping = NULL;
+	this->mappingSize = 0;
+	// ファイル名を保持します
+	this->relations = model;
+	// BNを作成します
+	invoke();
+}
+
+/*!
+ * @brief 既定のワークスペースと割り当てたモデルファイルを解放します
+ */
+CompositeBase::~CompositeBase() {
+	if (work != NULL) delete work;
+	if (mapping != NULL) munmap(mapping, mappingSize);
+	pthread_mutex_destroy(&mutex);
+}
+
+/*!
+ * @brief 本モデルに問い合わせる為のワークスペースを作成します(呼び出し元で解放して下さい)
+ * @return ワークスペース
+ */
+CompositeWork *CompositeBase::createWork() {
+	return new CompositeWork(nodes.size(), components.size());
+}
+
 /*!
  * @brief BayesianNetworkを作成します
  * @return 0=正常終了
@@ -25,12 +201,9 @@ CompositeBase::CompositeBase(ProbabilityBase *vfile, string relations) {
 int CompositeBase::invoke() {
 	// 各ノードの親子関係と隣接はCSVファイルで手動定義します
 	// 同時に事前確率も読み込んで保持しています
-	LINE("=");
-	cout << "Starting the Belif Propagation" << endl;
-	LINE("=");
-	LINE("=");
-	cout << "Creating Network" << endl;
-	LINE("=");
+	// 常駐時に応答と混ざらないように、見出しはトレースとします
+	TRACE(TRACE_INFO, string(70, '=') << "\nStarting the Belif Propagation\n" << string(70, '='));
+	TRACE(TRACE_INFO, string(70, '=') << "\nCreating Network\n" << string(70, '='));
 	createNetwork();
     // 各ノードに階層レベルを設定します
     for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
@@ -40,16 +213,32 @@ int CompositeBase::invoke() {
     for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
 		if (maxDepth < iter->second->depth) maxDepth = iter->second->depth;
 	}
+    // 各ノードを起点とするメッセージ転送手順を作成します
+    if (nodes.size() <= SCHEDULE_PRECOMPILE) {
+        for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+            createSchedule(iter->second, &schedules[iter->first]);
+        }
+    }
     // 構築したBayesianNetworkを初期化します
     format();
     return 0;
 }
 
+/*!
+ * @brief BIF/XMLBIFを読み込んでノードと親子関係、事前確率とCPTを作成します(実データは用いません)
+ * @return 0=正常終了
+ */
+int CompositeBase::convertBifToCsv() {
+	CompositeBif bif(relations);
+	return bif.load(&nodes);
+}
+
 /*!
  * @brief BayesianNetworkを構造情報を元に構築します
  * @return 0=正常終了
  */
 int CompositeBase::createNetwork() {
+    PROFILE_SCOPE(PROFILE_NETWORK);
 #ifdef TIME
     double begin = nowtime();
 #endif
@@ -62,10 +251,85 @@ int CompositeBase::createNetwork() {
      	delete targetn;
      	nodes.erase(nodes.begin());
     }
+    // 割り当て済みのモデルファイルを解放します
+    if (mapping != NULL) {
+        munmap(mapping, mappingSize);
+        mapping = NULL;
+    }
 
+    // 構造が変わる為、事後確率のキャッシュとメッセージ転送手順を無効にします
+    revision++;
+    schedules.clear();
+
+    // 構築済みモデルの場合はファイルを割り当て(BIF/XMLBIFの場合は読み込み)、それ以外はノード構造定義CSVファイルを読み込みます
+    int ret = 0;
+    if ((vfile == NULL ? (CompositeBif::isBif(relations) ? convertBifToCsv() : loadModel()) : createRelation()) != 0) {
+        // 作成途中のノードを破棄し、空のネットワークとして以降を処理します
+        for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) delete iter->second;
+        nodes.clear();
+        ret = 1;
+    }
+    // ノード番号(ワークスペースの添字)と親子の配列を作成します
+    int id = 0;
+    for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+        CompositeNode *target = iter->second;
+        target->id = id++;
+        target->parentNodes.clear();
+        target->childNodes.clear();
+        target->slots.clear();
+        for (NODES::iterator iterp = target->parents.begin(); iterp != target->parents.end(); iterp++) {
+            target->parentNodes.push_back(iterp->second);
+        }
+        for (NODES::iterator iterc = target->children.begin(); iterc != target->children.end(); iterc++) {
+            target->childNodes.push_back(iterc->second);
+        }
+        // 指定したノードのみ条件付き確率表を展開せず、雑音付きOR/MAXとします(実データから構築する場合のみ)
+        map<string, CHARS>::iterator found = noisy.find(iter->first);
+        if (vfile != NULL && !target->compiled && found != noisy.end()) {
+            target->model = NODE_NOISY_MAX;
+            target->degreeOrder = found->second;
+        }
+    }
+    for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+        CompositeNode *target = iter->second;
+        for (unsigned int i = 0; i < target->childNodes.size(); i++) {
+            vector<CompositeNode*> &pnodes = target->childNodes[i]->parentNodes;
+            target->slots.push_back(find(pnodes.begin(), pnodes.end(), target) - pnodes.begin());
+        }
+    }
+    // 連結成分を求めます
+    createComponent();
+    ready.assign(components.size(), 0);
+    // 既定のワークスペースを作成し直します
+    if (work != NULL) delete work;
+    work = createWork();
+    // 遅延しない場合は、全ノードの事前確率とCPTを並列に作成します
+    if (!lazy) {
+        for (unsigned int i = 0; i < components.size(); i++) {
+            if (materialize(&components[i]) != 0) return 2;
+            ready[i] = 1;
+        }
+    }
+#ifdef TIME
+    printf("%f=createNodeWithPrior\n", (nowtime() - begin) / 1000.0);
+#endif
+    return ret;
+}
+
+/*!
+ * @brief ノード構造定義CSVファイルを読み込んでノードと親子関係を作成します
+ * @return 0=正常終了
+ */
+int CompositeBase::createRelation() {
     // ノード構造定義CSVファイル（名前+.csv）を読み込んで保持します
     ifstream fin(relations.c_str(), ios::in);
     if (!fin) return 1;
+    // 隣接行列は見出し行が空欄(カンマ)から始まります、それ以外は辺の一覧として読み込みます
+    if (fin.peek() != ',') {
+        int ret = createEdges(fin);
+        fin.close();
+        return ret;
+    }
 
     // 事前確率を保持した確率変数を関連付けます
     string line;
@@ -89,7 +353,7 @@ int CompositeBase::createNetwork() {
                     // 生成ノード列挙登録
 					nodes.insert(pair<string, CompositeNode*>(element, target));
                     targets.push_back(target);
-					printf("[CompositeBase::createNetwork]Created %s\n", element.c_str());
+					TRACE(TRACE_DEBUG, "[CompositeBase::createNetwork]Created " << element);
                 } else {
 			        // 0!=親子関係ありとして関連を作成します
 				    int depth = atoi(element.c_str());
@@ -97,7 +361,7 @@ int CompositeBase::createNetwork() {
                         // 親子関係を作成します
 						targets[col - 1]->addParent(targets[row - 1]);
                         targets[row - 1]->addChild (targets[col - 1]);
-						printf("[CompositeBase::createNetwork]Created %s part-of %s\n", targets[col - 1]->name.c_str(), targets[row - 1]->name.c_str());
+						TRACE(TRACE_DEBUG, "[CompositeBase::createNetwork]Created " << targets[col - 1]->name << " part-of " << targets[row - 1]->name);
 					}
 				}
 			}
@@ -108,10 +372,442 @@ int CompositeBase::createNetwork() {
     }
     fin.close();
     targets.clear();
+    return 0;
+}
+
+/*!
+ * @brief 辺の一覧形式のノード構造定義CSVを読み込んでノードと親子関係を作成します
+ * @param[in] istream& ノード構造定義CSV
+ * @return 0=正常終了
+ */
+int CompositeBase::createEdges(istream &fin) {
+    ProbabilityParse parse(fin);
+    int row = 0, edges = 0;
+    while (!parse.isEof()) {
+        // 1行分の項目を取得します
+        CHARS fields;
+        while (!parse.isBreak()) {
+            string element;
+            parse >> element;
+            if (!element.empty() && element[element.size() - 1] == '\r') element.erase(element.size() - 1);
+            fields.push_back(element);
+        }
+        parse >> endl;
+        row++;
+        // 1行目は見出し行、空行は読み飛ばします
+        if (row == 1 || (fields.size() == 1 && fields[0].empty())) continue;
+        if (fields.size() == 1) {
+            // 辺を持たないノードを宣言します
+            createNode(fields[0]);
+        } else if (fields.size() == 2 && !fields[0].empty() && !fields[1].empty() && fields[0] != fields[1]) {
+            // 親子関係を作成します
+            CompositeNode *parent = createNode(fields[0]), *child = createNode(fields[1]);
+            child->addParent(parent);
+            parent->addChild(child);
+            edges++;
+            TRACE(TRACE_DEBUG, "[CompositeBase::createEdges]Created " << child->name << " part-of " << parent->name);
+        } else {
+            printf("[CompositeBase::createEdges]invalid edge at line %d in %s\n", row, relations.c_str());
+            return 1;
+        }
+    }
+    TRACE(TRACE_INFO, "[CompositeBase::createEdges]Created " << nodes.size() << " nodes and " << edges << " edges <- " << relations);
+    return 0;
+}
+
+/*!
+ * @brief 指定名のノードを返します(存在しない場合は作成します)
+ * @param[in] string ノード名
+ */
+CompositeNode *CompositeBase::createNode(string name) {
+    NODES::iterator found = nodes.find(name);
+    if (found != nodes.end()) return found->second;
+    CompositeNode *target = new CompositeNode(name, vfile);
+    nodes.insert(pair<string, CompositeNode*>(name, target));
+    TRACE(TRACE_DEBUG, "[CompositeBase::createNode]Created " << name);
+    return target;
+}
+
+/*!
+ * @brief 構築済みモデルファイルを割り当ててノードと親子関係、事前確率とCPTを作成します
+ * 文字列以外(CPT)は複製せずに割り当てた領域を直接参照します
+ * @return 0=正常終了
+ */
+int CompositeBase::loadModel() {
+	// ファイル全体を読み込み専用で割り当てます(同じファイルを用いるプロセス間でページを共有します)
+	int fd = open(relations.c_str(), O_RDONLY);
+	if (fd < 0) {
+		printf("[CompositeBase::loadModel]could not open %s(%s)\n", relations.c_str(), strerror(errno));
+		return 1;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(ModelHeader)) {
+		printf("[CompositeBase::loadModel]not a model file %s\n", relations.c_str());
+		close(fd);
+		return 2;
+	}
+	void *memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED) {
+		printf("[CompositeBase::loadModel]could not map %s(%s)\n", relations.c_str(), strerror(errno));
+		return 3;
+	}
+	mapping = memory;
+	mappingSize = info.st_size;
+	// 見出しと各領域の範囲を確認します
+	const char *base = (const char*)memory;
+	const ModelHeader *header = (const ModelHeader*)base;
+	unsigned long long n = header->count;
+	if (memcmp(header->magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0 || header->version != MODEL_VERSION
+			|| header->endian != MODEL_ENDIAN || header->size != mappingSize
+			|| header->nodes < sizeof(ModelHeader) || header->nodes + n * sizeof(ModelNode) > header->parents
+			|| header->parents + header->edges * sizeof(unsigned int) > header->order
+			|| header->order + n * sizeof(unsigned int) > header->strings
+			|| header->strings > header->texts || header->texts > header->values
+			|| header->values > header->size || (header->values % sizeof(UD)) != 0) {
+		printf("[CompositeBase::loadModel]broken or incompatible model file %s\n", relations.c_str());
+		return 4;
+	}
+	const ModelNode *records = (const ModelNode*)(base + header->nodes);
+	const unsigned int *parents = (const unsigned int*)(base + header->parents);
+	const unsigned int *order = (const unsigned int*)(base + header->order);
+	const ModelString *strings = (const ModelString*)(base + header->strings);
+	const char *texts = base + header->texts;
+	const UD *values = (const UD*)(base + header->values);
+	unsigned long long scount = (header->texts - header->strings) / sizeof(ModelString);
+	unsigned long long tsize = header->values - header->texts;
+	unsigned long long vcount = (header->size - header->values) / sizeof(UD);
+	// ノード、状態名、事前確率を作成し、CPTは割り当てた領域を参照します
+	vector<CompositeNode*> targets(n);
+	for (unsigned long long i = 0; i < n; i++) {
+		const ModelNode &record = records[i];
+		if (record.name >= scount || record.state + (unsigned long long)record.states > scount
+				|| record.parent + record.count > header->edges || record.prior + record.states > vcount
+				|| record.value + record.cells > vcount) {
+			printf("[CompositeBase::loadModel]broken node record %llu in %s\n", i, relations.c_str());
+			return 5;
+		}
+		for (unsigned long long j = record.state; j < record.state + record.states; j++) {
+			if (strings[j].offset + strings[j].length > tsize) {
+				printf("[CompositeBase::loadModel]broken string %llu in %s\n", j, relations.c_str());
+				return 5;
+			}
+		}
+		const ModelString &label = strings[record.name];
+		if (label.offset + label.length > tsize) {
+			printf("[CompositeBase::loadModel]broken string %u in %s\n", record.name, relations.c_str());
+			return 5;
+		}
+		CompositeNode *target = new CompositeNode(string(texts + label.offset, label.length), NULL);
+		for (unsigned int k = 0; k < record.states; k++) {
+			const ModelString &state = strings[record.state + k];
+			target->elements.push_back(string(texts + state.offset, state.length));
+			target->prior.insert(PROBS_PAIR(target->elements.back(), values[record.prior + k]));
+		}
+		target->values   = values + record.value;
+		target->cells    = record.cells;
+		target->compiled = true;
+		target->materialized = true;
+		nodes.insert(pair<string, CompositeNode*>(target->name, target));
+		targets[i] = target;
+	}
+	// 親子関係を作成し、CPTの大きさと桁の重み(parentsの順)を求めます
+	for (unsigned long long i = 0; i < n; i++) {
+		const ModelNode &record = records[i];
+		CompositeNode *target = targets[i];
+		unsigned long long cells = target->elements.size();
+		target->strides.assign(record.count, 1);
+		for (int j = (int)record.count - 1; j >= 0; j--) {
+			unsigned int parent = parents[record.parent + j];
+			if (parent >= n) {
+				printf("[CompositeBase::loadModel]broken parent of %s in %s\n", target->name.c_str(), relations.c_str());
+				return 6;
+			}
+			target->addParent(targets[parent]);
+			targets[parent]->addChild(target);
+			target->strides[j] = cells / target->elements.size();
+			cells *= targets[parent]->elements.size();
+		}
+		if (cells != record.cells || target->parents.size() != record.count) {
+			printf("[CompositeBase::loadModel]cpt size mismatch of %s in %s\n", target->name.c_str(), relations.c_str());
+			return 7;
+		}
+	}
+	// 親が子より先に並んでいることを確認します
+	vector<unsigned long long> position(n, n);
+	for (unsigned long long i = 0; i < n; i++) {
+		if (order[i] < n) position[order[i]] = i;
+	}
+	for (unsigned long long i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < records[i].count; j++) {
+			if (position[i] >= n || position[parents[records[i].parent + j]] >= position[i]) {
+				printf("[CompositeBase::loadModel]broken topological order in %s\n", relations.c_str());
+				return 8;
+			}
+		}
+	}
+	TRACE(TRACE_INFO, "[CompositeBase::loadModel]Mapped " << n << " nodes <- " << relations);
+	return 0;
+}
+
+/*!
+ * @brief 文字列を登録して文字列番号を返します
+ * @param[in,out] vector<ModelString>* 文字列
+ * @param[in,out] string*              文字列本体
+ * @param[in]     string               登録する文字列
+ */
+static unsigned int modelString(vector<ModelString> *strings, string *texts, const string &text) {
+	ModelString entry;
+	entry.offset = texts->size();
+	entry.length = text.size();
+	texts->append(text);
+	strings->push_back(entry);
+	return strings->size() - 1;
+}
+
+/*!
+ * @brief 全ノードの事前確率とCPTを作成し、構築済みモデルファイルとして出力します
+ * @param[in] string 出力するファイル名
+ * @return 0=正常終了
+ */
+int CompositeBase::save(string model) {
+	// 全ノードの事前確率とCPTを作成します
+	if (materialize() != 0) return 1;
+	// 雑音付きOR/MAXは条件付き確率表を持たない為、出力できません(決定木は表に展開して出力します)
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		if (iter->second->model == NODE_NOISY_OR || iter->second->model == NODE_NOISY_MAX) {
+			printf("[CompositeBase::save]%s is a noisy-OR/MAX node without a full cpt\n", iter->first.c_str());
+			return 3;
+		}
+	}
+	// BIF/XMLBIFの拡張子の場合は交換形式で出力します
+	if (CompositeBif::isBif(model)) return CompositeBif::save(model, &nodes);
+	// 入次数を元にトポロジカル順を求めます
+	unsigned int n = nodes.size();
+	vector<CompositeNode*> index(n);
+	vector<unsigned int> order, degrees(n);
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		CompositeNode *target = iter->second;
+		index[target->id] = target;
+		degrees[target->id] = target->parentNodes.size();
+		if (target->parentNodes.empty()) order.push_back(target->id);
+	}
+	for (unsigned int i = 0; i < order.size(); i++) {
+		vector<CompositeNode*> &children = index[order[i]]->childNodes;
+		for (unsigned int j = 0; j < children.size(); j++) {
+			if (--degrees[children[j]->id] == 0) order.push_back(children[j]->id);
+		}
+	}
+	if (order.size() != n) {
+		printf("[CompositeBase::save]network has a cycle(%d/%d)\n", (int)order.size(), (int)n);
+		return 2;
+	}
+	// ノード番号の順に、文字列、親、事前確率とCPTを並べます
+	vector<ModelNode> records(n);
+	vector<unsigned int> parents;
+	vector<ModelString> strings;
+	string texts;
+	vector<UD> values;
+	for (unsigned int i = 0; i < n; i++) {
+		CompositeNode *target = index[i];
+		ModelNode &record = records[i];
+		record.name   = modelString(&strings, &texts, target->name);
+		record.states = target->elements.size();
+		record.state  = strings.size();
+		for (unsigned int k = 0; k < record.states; k++) modelString(&strings, &texts, target->elements[k]);
+		record.count  = target->parentNodes.size();
+		record.parent = parents.size();
+		for (unsigned int j = 0; j < record.count; j++) parents.push_back(target->parentNodes[j]->id);
+		record.prior  = values.size();
+		for (unsigned int k = 0; k < record.states; k++) {
+			PROBS::iterator found = target->prior.find(target->elements[k]);
+			values.push_back(found == target->prior.end() ? 0.0 : found->second);
+		}
+		record.value  = values.size();
+		target->expand(&values);
+		record.cells  = values.size() - record.value;
+	}
+	// 見出しを作成します
+	ModelHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+	header.version = MODEL_VERSION;
+	header.endian  = MODEL_ENDIAN;
+	header.count   = n;
+	header.edges   = parents.size();
+	header.nodes   = modelAlign(sizeof(ModelHeader));
+	header.parents = modelAlign(header.nodes + n * sizeof(ModelNode));
+	header.order   = modelAlign(header.parents + parents.size() * sizeof(unsigned int));
+	header.strings = modelAlign(header.order + n * sizeof(unsigned int));
+	header.texts   = header.strings + strings.size() * sizeof(ModelString);
+	header.values  = modelAlign(header.texts + texts.size());
+	header.size    = header.values + values.size() * sizeof(UD);
+	// 一時ファイルに書き込んでから置き換えます(割り当て中のファイルを壊さない為)
+	string temporary = model + ".tmp";
+	FILE *fp = fopen(temporary.c_str(), "wb");
+	if (fp == NULL) {
+		printf("[CompositeBase::save]could not open %s\n", temporary.c_str());
+		return 3;
+	}
+	const char zeros[8] = { 0 };
+	unsigned long long written = 0;
+	bool failed = false;
+	const void *blocks[7] = { &header, records.empty() ? NULL : &records[0], parents.empty() ? NULL : &parents[0],
+			&order[0], strings.empty() ? NULL : &strings[0], texts.data(), values.empty() ? NULL : &values[0] };
+	unsigned long long offsets[7] = { 0, header.nodes, header.parents, header.order, header.strings, header.texts, header.values };
+	unsigned long long sizes[7] = { sizeof(ModelHeader), n * sizeof(ModelNode), parents.size() * sizeof(unsigned int),
+			n * sizeof(unsigned int), strings.size() * sizeof(ModelString), texts.size(), values.size() * sizeof(UD) };
+	for (int i = 0; i < 7 && !failed; i++) {
+		// 境界までを0で埋めます
+		if (offsets[i] > written) {
+			failed = (fwrite(zeros, 1, offsets[i] - written, fp) != offsets[i] - written);
+			written = offsets[i];
+		}
+		if (!failed && sizes[i] > 0) failed = (fwrite(blocks[i], 1, sizes[i], fp) != sizes[i]);
+		written += sizes[i];
+	}
+	if (fclose(fp) != 0) failed = true;
+	if (failed || rename(temporary.c_str(), model.c_str()) != 0) {
+		printf("[CompositeBase::save]could not write %s(%s)\n", model.c_str(), strerror(errno));
+		unlink(temporary.c_str());
+		return 4;
+	}
+	TRACE(TRACE_INFO, "[CompositeBase::save]Saved " << n << " nodes -> " << model << "(" << header.size << "bytes)");
+	return 0;
+}
+
+/*!
+ * @brief 構築されたBayesianNetworkの連結成分を求めます
+ * @return 0=正常終了
+ */
+int CompositeBase::createComponent() {
+	components.clear();
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		iter->second->component = -1;
+	}
+	// 親子を辿って未所属のノードに成分番号を与えます
+	int count = 0;
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		if (iter->second->component >= 0) continue;
+		vector<CompositeNode*> stack;
+		iter->second->component = count;
+		stack.push_back(iter->second);
+		while (!stack.empty()) {
+			CompositeNode *target = stack.back();
+			stack.pop_back();
+			for (int i = 0; i < 2; i++) {
+				NODES *links = (i == 0 ? &target->parents : &target->children);
+				for (NODES::iterator iterl = links->begin(); iterl != links->end(); iterl++) {
+					if (iterl->second->component >= 0) continue;
+					iterl->second->component = count;
+					stack.push_back(iterl->second);
+				}
+			}
+		}
+		count++;
+	}
+	// 成分毎のノードはnodesの順に並べます(初期化の順序を保つ為)
+	components.resize(count);
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		components[iter->second->component].push_back(iter->second);
+	}
+	return 0;
+}
+
+/*!
+ * @brief 未作成の全ノードの事前確率とCPTを作成します
+ * @return 0=正常終了
+ */
+int CompositeBase::materialize() {
+	for (unsigned int i = 0; i < components.size(); i++) {
+		if (materialize(components[i].front()) != 0) return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief 指定ノードの連結成分が未作成の場合、事前確率とCPTを作成します(複数スレッドから呼び出せます)
+ * @param[in] CompositeNode* 対象ノード
+ * @return 0=正常終了
+ */
+int CompositeBase::materialize(CompositeNode *node) {
+	int component = node->component;
+	if (isReady(ready, component)) return 0;
+	// 作成は1スレッドのみが行い、他のスレッドは作成完了を待ちます
+	pthread_mutex_lock(&mutex);
+	int ret = 0;
+	if (!isReady(ready, component)) {
+		PROFILE_SCOPE(PROFILE_NETWORK);
+		if (materialize(&components[component]) != 0) ret = 1;
+		else __sync_fetch_and_or(&ready[component], 1); // CPTの書き込みを完了してから作成済みとします
+	}
+	pthread_mutex_unlock(&mutex);
+	return ret;
+}
+
+/*!
+ * @brief ワークスペースの全ての連結成分を利用可能にします(モデルを作成し、未初期化の成分を初期化します)
+ * @param[in] CompositeWork* ワークスペース
+ * @return 0=正常終了
+ */
+int CompositeBase::activate(CompositeWork *work) {
+	for (unsigned int i = 0; i < components.size(); i++) {
+		if (activate(work, components[i].front()) != 0) return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief ワークスペースの指定ノードの連結成分を利用可能にします(モデルを作成し、未初期化の場合は初期化します)
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] CompositeNode* 対象ノード
+ * @return 0=正常終了
+ */
+int CompositeBase::activate(CompositeWork *work, CompositeNode *node) {
+	if (work->ready[node->component]) return 0;
+	// 未作成の場合は事前確率とCPTを作成します
+	if (materialize(node) != 0) return fail(work, "Composite could not create the network of " + node->name + "(activate:1)", 1);
+	// 当該連結成分のみを初期化します(他の連結成分のエビデンスは保ちます)
+	if (format(work, &components[node->component]) != 0) return 2;
+	return 0;
+}
+
+/*!
+ * @brief 指定ノードの事前確率とCPTを並列に作成します(事前確率を全て作成後にCPTを作成します)
+ * @param[in] vector<CompositeNode*>* 対象ノード(親ノードを全て含むこと)
+ * @return 0=正常終了
+ */
+int CompositeBase::materialize(vector<CompositeNode*> *targets) {
 #ifdef TIME
-    printf("%f=createNodeWithPrior\n", (nowtime() - begin) / 1000.0);
+	double begin = nowtime();
 #endif
-    return 0;
+	// 並列に参照する前に、対象列の一意値のキャッシュを作成します(作成済みのノードは除きます)
+	CHARS names;
+	for (vector<CompositeNode*>::iterator iter = targets->begin(); iter != targets->end(); iter++) {
+		if (!(*iter)->materialized) names.push_back((*iter)->name);
+	}
+	if (!names.empty() && vfile->prepare(&names, threads) != 0) return 1;
+	// 事前確率(要素名)を作成します
+	CompositeMaterialize work;
+	work.targets = targets;
+	work.compile = false;
+	work.errors  = 0;
+	parallel(threads, targets->size(), &work);
+	if (work.errors != 0) {
+		TRACE(TRACE_ERROR, "[CompositeBase::materialize]could not create " << work.errors << " priors");
+		return 2;
+	}
+	// 親の要素名が揃った為、CPTを作成します
+	work.compile = true;
+	parallel(threads, targets->size(), &work);
+	if (work.errors != 0) {
+		TRACE(TRACE_ERROR, "[CompositeBase::materialize]could not create " << work.errors << " cpts");
+		return 3;
+	}
+#ifdef TIME
+	printf("%f=materialize(%d nodes)\n", (nowtime() - begin) / 1000.0, (int)targets->size());
+#endif
+	return 0;
 }
 
 /*!
@@ -133,90 +829,174 @@ int CompositeBase::createDepth(int depth, CompositeNode *node) {
      return 0;
 }
 
+/*!
+ * @brief 指定ノードを起点とするメッセージ転送手順を作成します
+ * 親を優先した深さ優先順に、未受信のノードへ1度ずつ転送する手順を平坦な配列にします
+ * @param[in]  CompositeNode* 伝播起点のノード
+ * @param[out] SCHEDULE*      メッセージ転送手順
+ * @return 0=正常終了
+ */
+int CompositeBase::createSchedule(CompositeNode *root, SCHEDULE *steps) {
+	steps->clear();
+	// 各ノードの受信状態を受付可能に初期化します(ノード番号毎、true=受信済み)
+	vector<char> received(nodes.size(), 0);
+	// 再帰の代わりに(ノード, 次に調べる隣接番号)を積んだスタックで走査します
+	// 隣接は親(λメッセージ)を先に、子(πメッセージ)を後に調べます
+	SCHEDULE distribute;
+	vector<pair<CompositeNode*, unsigned int> > stack;
+	received[root->id] = 1;
+	stack.push_back(pair<CompositeNode*, unsigned int>(root, 0));
+	while (!stack.empty()) {
+		CompositeNode *from = stack.back().first;
+		unsigned int next = stack.back().second++;
+		unsigned int psize = from->parentNodes.size();
+		CompositeNode *to; int kind, slot;
+		if (next < psize) {
+			// 子から親へのメッセージは、自身の親における親の番号に格納します
+			to = from->parentNodes[next]; kind = MESSAGE_LAMBDA; slot = next;
+		} else if (next < psize + from->childNodes.size()) {
+			// 親から子へのメッセージは、子の親における自身の番号に格納します
+			to = from->childNodes[next - psize]; kind = MESSAGE_PAI; slot = from->slots[next - psize];
+		} else {
+			// 全ての隣接を調べ終えた為、呼び出し元に戻ります
+			stack.pop_back();
+			continue;
+		}
+		if (received[to->id]) continue;
+		// 転送手順を追加して受信ノードを次の送信ノードとします
+		CompositeStep step;
+		step.from = from;
+		step.to   = to;
+		step.kind = kind;
+		step.slot = slot;
+		distribute.push_back(step);
+		received[to->id] = 1;
+		stack.push_back(pair<CompositeNode*, unsigned int>(to, 0));
+	}
+	// 収集手順は走査の逆順に、逆向きのメッセージを転送します(子孫から受信した後に送信します)
+	// これにより起点以外のエビデンスも起点に集められます
+	for (SCHEDULE::reverse_iterator iter = distribute.rbegin(); iter != distribute.rend(); iter++) {
+		CompositeStep step;
+		step.from = iter->to;
+		step.to   = iter->from;
+		step.kind = (iter->kind == MESSAGE_LAMBDA ? MESSAGE_PAI : MESSAGE_LAMBDA);
+		step.slot = iter->slot; // 同じ辺の為、格納位置も同じです
+		steps->push_back(step);
+	}
+	steps->insert(steps->end(), distribute.begin(), distribute.end());
+	return 0;
+}
+
 /*!
  * @brief BPの処理用に全てのノードを初期化します
  * @return 0=正常終了
  */
 int CompositeBase::format() {
+	return format(work);
+}
+
+/*!
+ * @brief ワークスペースを初期化します(与えたエビデンスを破棄し、各連結成分は次の参照時に初期化します)
+ * @param[in] CompositeWork* ワークスペース
+ * @return 0=正常終了
+ */
+int CompositeBase::format(CompositeWork *work) {
 	#ifdef TIME
 	    double begin = nowtime();
 	#endif
-	// BP用変数が変動済みの場合を考慮して一度初期化します
-	for (NODES::iterator iter1 = nodes.begin(); iter1 != nodes.end(); iter1++) {
-		// 対象ノードを引き当てます
-		CompositeNode *target = iter1->second;
-		// 対象ノードの子供に保持されているπ・λメッセージを初期化します
-		for (NODES::iterator iter3 = target->children.begin(); iter3 != target->children.end(); iter3++) {
-			CompositeNode *child = iter3->second;
-			child->msgLambda.clear();
-			child->msgPai.clear();
-		}
-		// 対象ノードに保持されている事後確率、π・λエビデンスを初期化します
-		target->posterior.clear();
-		target->eviLambda.clear();
-		target->eviPai.clear();
-	}
-	// BP用変数を初期化します
-	UD prior;
-	for (NODES::iterator iter1 = nodes.begin(); iter1 != nodes.end(); iter1++) {
+	// エビデンスを破棄し、前回の問合せの一時領域を一括で解放します
+	work->evidences.clear();
+	work->message.clear();
+	work->arena.reset();
+	// 作成済みの連結成分を初期化します
+	for (unsigned int i = 0; i < components.size(); i++) {
+		work->ready[i] = 0;
+		if (!isReady(ready, i)) continue;
+		if (format(work, &components[i]) != 0) return 1;
+	}
+#ifdef TIME
+	printf("%f=format\n", (nowtime() - begin) / 1000.0);
+#endif
+	TRACE(TRACE_DETAIL, string(70, '-'));
+
+	return 0;
+}
+
+/*!
+ * @brief 指定ノードをBPの処理用に初期化します
+ * @param[in] CompositeWork*          ワークスペース
+ * @param[in] vector<CompositeNode*>* 対象ノード(連結成分単位)
+ * @return 0=正常終了
+ */
+int CompositeBase::format(CompositeWork *work, vector<CompositeNode*> *targets) {
+	PROFILE_SCOPE(PROFILE_FORMAT);
+	// BP用変数を初期化します(事前確率は要素名の順に一時領域へ展開します)
+	// 配列は前回の問合せの領域を再利用する為、定常状態ではヒープを確保しません
+	ArenaMark mark = work->arena.mark();
+	for (vector<CompositeNode*>::iterator iter1 = targets->begin(); iter1 != targets->end(); iter1++) {
 		// 対象ノードを引き当てます
-		CompositeNode *target = iter1->second;
-		for (CHARS::iterator iter2 = target->elements.begin(); iter2 != target->elements.end(); iter2++) {
-			// 全ての事後確率を事前確率として初期化します
-			if (target->calPrior(*iter2, &prior) != 0) {
-				printf("%s not found prior value for %s(:2)\n", target->name.c_str(), iter2->c_str());
-				return 1;
-			}
-			target->posterior.insert(pair<string, UD>(*iter2, prior));
-			// 全てのλエビデンスを1.0に初期化します
-			target->eviLambda.insert(pair<string, UD>(*iter2, 1.0));
-			// 全てのπエビデンスを初期化します
-			if (target->parents.empty()) {
-				// 全ての根ノードにおいてπエビデンスを事前確率（P(X)）に初期化します
-				target->eviPai.insert(pair<string, UD>(*iter2, prior));
-			} else {
-				// （教科書に記述なし、又は自分の理解不足）
-				// 全てのπエビデンスを1.0(事前確率）にして計算してみます
-				target->eviPai.insert(pair<string, UD>(*iter2, 1.0));
-			}
-			// πメッセージ、λメッセージは子供に自分の名前で代入します
-			for (NODES::iterator iter3 = target->children.begin(); iter3 != target->children.end(); iter3++) {
-				CompositeNode *child = iter3->second;
-				// 全てのλメッセージを1.0に初期化します
-				child->msgLambda.insert(pair<string, UD>(*iter2, 1.0));
-				// 全てのπメッセージを1.0に初期化します
-				child->msgPai.insert(pair<string, UD>(*iter2, prior/*1.0*/));
-			}
+		CompositeNode *target = *iter1;
+		CompositeState &state = work->states[target->id];
+		unsigned int size = target->elements.size();
+		UD *prior = work->arena.allocate<UD>(size);
+		priorOf(target, prior);
+		// 全ての事後確率を事前確率として初期化します
+		state.posterior.assign(prior, prior + size);
+		// 全てのλエビデンスを1.0に初期化します
+		state.eviLambda.assign(size, 1.0);
+		// 全てのπエビデンスを初期化します
+		if (target->parentNodes.empty()) {
+			// 全ての根ノードにおいてπエビデンスを事前確率（P(X)）に初期化します
+			state.eviPai.assign(prior, prior + size);
+		} else {
+			// （教科書に記述なし、又は自分の理解不足）
+			// 全てのπエビデンスを1.0(事前確率）にして計算してみます
+			state.eviPai.assign(size, 1.0);
 		}
+		state.likelihood.clear();
+		state.deviation.clear();
+		// πメッセージを親の事前確率に、λメッセージを1.0に初期化します(親毎に保持します)
+		state.msgPai.resize(target->parentNodes.size());
+		state.msgLambda.resize(target->parentNodes.size());
+		for (unsigned int j = 0; j < target->parentNodes.size(); j++) {
+			CompositeNode *parent = target->parentNodes[j];
+			UD *pprior = work->arena.allocate<UD>(parent->elements.size());
+			priorOf(parent, pprior);
+			state.msgPai[j].assign(pprior, pprior + parent->elements.size());
+			state.msgLambda[j].assign(parent->elements.size(), 1.0);
+		}
+		work->arena.release(mark);
 	}
 	// 現在のＢＮの状態を表示します
-	this->now("Initialized");
+	if (TRACE_ON(TRACE_DETAIL)) {
+		for (vector<CompositeNode*>::iterator iter1 = targets->begin(); iter1 != targets->end(); iter1++) {
+			(*iter1)->now(work, "Initialized");
+		}
+	}
 
 	// 階層番号を元に各階層の全ノードを処理してより次階層を処理します
 	// 確率を伝播させずにネットワーク上の階層レベルを用いて個々のノードで初期化を行います
 	// πメッセージを伝播させます
 	for (int i = 1; i <= maxDepth; i++) {
-		for (NODES::iterator iter1 = nodes.begin(); iter1 != nodes.end(); iter1++) {
-			CompositeNode *target = iter1->second;
+		for (vector<CompositeNode*>::iterator iter1 = targets->begin(); iter1 != targets->end(); iter1++) {
+			CompositeNode *target = *iter1;
 			if (target->depth == i) {
 				// πエビデンスを更新します
-				if (target->calEviPai() != 0) return 2;
+				if (target->calEviPai(work) != 0) return 2;
 				// 事後確率を更新します
-				if (target->calProb() != 0) return 3;
+				if (target->calProb(work) != 0) return 3;
 				// 初期化(format)時に既にπメッセージ伝播と同じ値を設定しています
 			}
 		}
 	}
 	// λメッセージの伝播は初期化時には必要ありません
 	// 現在のＢＮの状態を表示します
-	this->now("P Message Transfermed(for init)");
-
-#ifdef TIME
-	printf("%f=format\n", (nowtime() - begin) / 1000.0);
-#endif
-	for (int i = 0; i < 70; i++) cout << "-";
-	cout << endl;
-
+	if (TRACE_ON(TRACE_DETAIL)) {
+		for (vector<CompositeNode*>::iterator iter1 = targets->begin(); iter1 != targets->end(); iter1++) {
+			(*iter1)->now(work, "P Message Transfermed(for init)");
+		}
+	}
+	work->ready[targets->front()->component] = 1;
 	return 0;
 }
 
@@ -227,37 +1007,122 @@ int CompositeBase::format() {
  * @return 0=正常終了
  */
 int CompositeBase::setProb(string targetn, string targets) {
+	return setProb(work, targetn, targets);
+}
+
+/*!
+ * @brief 指定ノードの指定要素にエビデンスを与えます
+ * @param[in]  CompositeWork* ワークスペース
+ * @param[in]  string         対象ノード名を指定します
+ * @param[in]  string         対象ノードの状態名を指定します
+ * @return 0=正常終了
+ */
+int CompositeBase::setProb(CompositeWork *work, string targetn, string targets) {
 	// 指定ノードのエビデンスが決定された為、
 	// πメッセージとλメッセージを伝播させます
 	// 指定ノードを取得します
 	NODES::iterator iter1 = nodes.find(targetn);
-	if (iter1 == nodes.end()) {
-		printf("Composite did not get the node of %s(calProb:1)\n", targetn.c_str());
-		return 1;
-	}
-	// 自身の状態のλエビデンスを1.0に更新します
-	// それ以外のλエビデンスを0.0に更新します
+	if (iter1 == nodes.end()) return fail(work, "Composite did not get the node of " + targetn + "(calProb:1)", 1);
+	// 未作成の場合は事前確率とCPTを作成します
+	if (activate(work, iter1->second) != 0) return 3;
 	CompositeNode *target = iter1->second;
-	for (PROBS::iterator iter2 = target->eviLambda.begin(); iter2 != target->eviLambda.end(); iter2++) {
-		iter2->second = (iter2->first == targets ? 1.0 : 0.0);
-	}
-	// 同様に事後確率も更新します
-	for (PROBS::iterator iter2 = target->posterior.begin(); iter2 != target->posterior.end(); iter2++) {
-		iter2->second = (iter2->first == targets ? 1.0 : 0.0);
+	CompositeState &state = work->states[target->id];
+	int index = target->index(targets);
+	// 未知の状態は全ての状態を0とし、確率を求められない為、エラーとします
+	if (index < 0) return fail(work, "Composite did not get the state of " + targetn + "=" + targets + "(calProb:2)", 2);
+	unsigned int size = target->elements.size();
+	// 自身の状態のλエビデンスと事後確率を1.0に、それ以外を0.0に更新します
+	// メッセージ受信後もエビデンスを保つ為、尤度としても保持します
+	state.likelihood.assign(size, 0.0);
+	for (unsigned int k = 0; k < size; k++) {
+		UD value = ((int)k == index ? 1.0 : 0.0);
+		state.eviLambda[k] = value;
+		state.posterior[k] = value;
+		state.likelihood[k] = value;
 	}
 	// πメッセージの値πVi(X)のX*のみ1.0にして他を0.0に更新します
-	for (NODES::iterator iter2 = target->children.begin(); iter2 != target->children.end(); iter2++) {
-		CompositeNode *child = iter2->second;
-		for (CHARS::iterator iter3 = target->elements.begin(); iter3 != target->elements.end(); iter3++) {
-			PROBS::iterator iter4 = child->msgPai.find(*iter3);
-			if (iter4 == child->msgPai.end()) {
-				printf("%s not found msg of pai for %s(calProb:2)\n", child->name.c_str(), iter3->c_str());
-				return 2;
-			}
-			iter4->second = (*iter3 == targets ? 1.0 : 0.0);
+	for (unsigned int i = 0; i < target->childNodes.size(); i++) {
+		vector<UD> &pai = work->states[target->childNodes[i]->id].msgPai[target->slots[i]];
+		for (unsigned int k = 0; k < size; k++) pai[k] = ((int)k == index ? 1.0 : 0.0);
+	}
+	// 近似推論用にエビデンスを保持します
+	work->evidences[targetn] = targets;
+	if (TRACE_ON(TRACE_DETAIL)) now(work, string("Evidence(") + targetn + string("=") + targets + string(")"));
+	return 0;
+}
+
+/*!
+ * @brief 指定ノードの条件付き確率表を展開せず、実データから雑音付きOR/MAXの母数を求めるようにします
+ * @param[in] string 対象ノード名を指定します
+ * @param[in] CHARS* 自身の状態名の程度の低い順(NULL又は空の場合は2状態のノードのみ要素名の順)
+ * @return 0=正常終了
+ */
+int CompositeBase::setNoisy(string targetn, CHARS *order) {
+	NODES::iterator iter = nodes.find(targetn);
+	if (iter == nodes.end()) {
+		printf("[CompositeBase::setNoisy]not found node of %s\n", targetn.c_str());
+		return 1;
+	}
+	if (vfile == NULL) {
+		printf("[CompositeBase::setNoisy]%s has no data to fit noisy parameters\n", targetn.c_str());
+		return 2;
+	}
+	CompositeNode *target = iter->second;
+	pthread_mutex_lock(&mutex);
+	noisy[targetn] = (order == NULL ? CHARS() : *order);
+	target->model = NODE_NOISY_MAX;
+	target->degreeOrder = noisy[targetn];
+	// 作成済みの場合は、当該ノードのみ展開し直すように連結成分を未作成に戻します
+	target->compiled = false;
+	ready[target->component] = 0;
+	if (work != NULL) work->ready[target->component] = 0;
+	revision++;
+	pthread_mutex_unlock(&mutex);
+	return 0;
+}
+
+/*!
+ * @brief 指定ノードの状態毎に尤度を与えます(尤度0の状態を除外する場合等に利用します)
+ * @param[in]  string        対象ノード名を指定します
+ * @param[in]  PROBS*        状態毎の尤度(指定のない状態は0.0とします)
+ * @return 0=正常終了
+ */
+int CompositeBase::setLikelihood(string targetn, PROBS *likelihood) {
+	return setLikelihood(work, targetn, likelihood);
+}
+
+/*!
+ * @brief 指定ノードの状態毎に尤度を与えます(尤度0の状態を除外する場合等に利用します)
+ * @param[in]  CompositeWork* ワークスペース
+ * @param[in]  string         対象ノード名を指定します
+ * @param[in]  PROBS*         状態毎の尤度(指定のない状態は0.0とします)
+ * @return 0=正常終了
+ */
+int CompositeBase::setLikelihood(CompositeWork *work, string targetn, PROBS *likelihood) {
+	NODES::iterator iter1 = nodes.find(targetn);
+	if (iter1 == nodes.end()) return fail(work, "Composite did not get the node of " + targetn + "(setLikelihood:1)", 1);
+	if (activate(work, iter1->second) != 0) return 2;
+	CompositeNode *target = iter1->second;
+	CompositeState &state = work->states[target->id];
+	unsigned int size = target->elements.size();
+	state.likelihood.assign(size, 0.0);
+	UD normal = 0.0;
+	for (unsigned int k = 0; k < size; k++) {
+		PROBS::iterator found = likelihood->find(target->elements[k]);
+		UD value = (found == likelihood->end() ? 0.0 : found->second);
+		state.likelihood[k] = value;
+		// λエビデンスと事後確率、子に保持されているπメッセージに尤度を掛けます
+		state.eviLambda[k] = value;
+		state.posterior[k] *= value;
+		normal += state.posterior[k];
+		for (unsigned int i = 0; i < target->childNodes.size(); i++) {
+			work->states[target->childNodes[i]->id].msgPai[target->slots[i]][k] *= value;
 		}
 	}
-	now(string("Evidence(") + targetn + string("=") + targets + string(")"));
+	// 事後確率を正規化します
+	for (unsigned int k = 0; k < size; k++) {
+		state.posterior[k] = (normal == 0.0 ? 0.0 : state.posterior[k] / normal);
+	}
 	return 0;
 }
 
@@ -266,24 +1131,87 @@ int CompositeBase::setProb(string targetn, string targets) {
  * @param[in] string 対象ノード名を指定します
  */
 int CompositeBase::calProbs(string targetn) {
+	return calProbs(work, targetn);
+}
+
+/*!
+ * @brief BPを用いた推定（又は事後）確率を計算します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] string         対象ノード名を指定します
+ */
+int CompositeBase::calProbs(CompositeWork *work, string targetn) {
 	// 対象ノードを取得します
 	NODES::iterator iter1 = nodes.find(targetn);
-	if (iter1 == nodes.end()) {
-		printf("Composite did not get the node of %s(calProb:1)\n", targetn.c_str());
-		return 1;
+	if (iter1 == nodes.end()) return fail(work, "Composite did not get the node of " + targetn + "(calProb:1)", 1);
+	if (activate(work, iter1->second) != 0) return 2;
+	PROFILE_SCOPE(PROFILE_PROPAGATE);
+	// 厳密推論では標準誤差はありません
+	for (unsigned int i = 0; i < work->states.size(); i++) {
+		work->states[i].deviation.clear();
 	}
-	// メッセージ伝播を行う前に各ノードの受信状態を受付可能に初期化します
-	for (NODES::iterator all = nodes.begin(); all != nodes.end(); all++) {
-		all->second->recv = true;
+	// 指定ノードを起点とするメッセージ転送手順を取得します(未作成の場合は作成して再利用します)
+	// 手順は全ワークスペースで共有する為、取得と作成は排他制御します(作成済みの手順は変更しません)
+	pthread_mutex_lock(&mutex);
+	map<string, SCHEDULE>::iterator found = schedules.find(targetn);
+	if (found == schedules.end()) {
+		found = schedules.insert(pair<string, SCHEDULE>(targetn, SCHEDULE())).first;
+		createSchedule(iter1->second, &found->second);
 	}
+	pthread_mutex_unlock(&mutex);
 	// 計算時間の計測を開始します
 	double begin = nowtime();
-	// 指定ノードを中心にλメッセージを優先して、π・λメッセージを伝播させます
-	CompositeNode *target = iter1->second;
-	target->transMessage(NULL);
+	// 指定ノードを中心にλメッセージを優先して、π・λメッセージを手順通りに伝播させます
+	SCHEDULE &steps = found->second;
+	unsigned int size = steps.size();
+	for (unsigned int i = 0; i < size; i++) {
+		// 次の手順の受信ノードの状態を先読みします
+		if (i + 1 < size) __builtin_prefetch(&work->states[steps[i + 1].to->id]);
+		steps[i].from->sendMessage(work, steps[i].to, steps[i].kind, steps[i].slot);
+	}
 
 	// 計算時間を表示します
-	printf("Caluculate times for all probs(%fsec)\n",  (nowtime() - begin));
+	TRACE(TRACE_INFO, "Caluculate times for all probs(" << (nowtime() - begin) / 1000.0 << "sec)");
+	return 0;
+}
+
+/*!
+ * @brief 指定した推論方式で推定（又は事後）確率を計算します
+ * @param[in] string 対象ノード名を指定します(近似推論では利用しません)
+ * @param[in] int    推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+ */
+int CompositeBase::calProbs(string targetn, int method) {
+	return calProbs(work, targetn, method);
+}
+
+/*!
+ * @brief 指定した推論方式で推定（又は事後）確率を計算します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] string         対象ノード名を指定します(近似推論では利用しません)
+ * @param[in] int            推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+ */
+int CompositeBase::calProbs(CompositeWork *work, string targetn, int method) {
+	if (method == INFER_EXACT) return calProbs(work, targetn);
+	// サンプリングは全ノードを用いる為、未作成のノードを作成します
+	if (activate(work) != 0) return 4;
+	PROFILE_SCOPE(PROFILE_PROPAGATE);
+	// 計算時間の計測を開始します
+	double begin = nowtime();
+	// 設定を複製して問合せ毎に推論します(集計領域を共有しない為)
+	CompositeSampling local(sampler);
+	int ret = 0;
+	if (method == INFER_LIKELIHOOD) {
+		ret = local.likelihood(&work->evidences, work);
+	} else if (method == INFER_GIBBS) {
+		ret = local.gibbs(&work->evidences, work);
+	} else {
+		stringstream message;
+		message << "Composite did not support the method of " << method << "(calProbs:2)";
+		return fail(work, message.str(), 2);
+	}
+	if (ret != 0) return fail(work, "Composite could not sample the network(calProbs:3)", 3);
+	if (work == this->work) sampler.generated = local.generated;
+	// 計算時間を表示します
+	TRACE(TRACE_INFO, "Caluculate times for all probs by " << local.generated << " samples(" << (nowtime() - begin) / 1000.0 << "sec)");
 	return 0;
 }
 
@@ -293,28 +1221,393 @@ int CompositeBase::calProbs(string targetn) {
  * @param[OUT] map<string, double> 各状態の確率
  */
 int CompositeBase::getProb(string targetn, PROBS *probs) {
+	return getProb(work, targetn, probs);
+}
+
+/*!
+ * @brief BPを用いた推定（又は事後）確率を返します （対象ノードの全ての状態の確率を返します）
+ * @param[in]  CompositeWork*      ワークスペース
+ * @param[in]  string              確率を取得したい対象ノード名
+ * @param[OUT] map<string, double> 各状態の確率
+ */
+int CompositeBase::getProb(CompositeWork *work, string targetn, PROBS *probs) {
 	// 対象ノードを取得します
 	NODES::iterator iter = nodes.find(targetn);
-	if (iter == nodes.end()) {
-		printf("Composite did not get the target node of %s(getProb)\n", targetn.c_str());
-		return 1;
-	}
+	if (iter == nodes.end()) return fail(work, "Composite did not get the target node of " + targetn + "(getProb)", 1);
 	CompositeNode *target = iter->second;
+	if (activate(work, target) != 0) return 2;
 	// ノード内の確率を返します
 	probs->clear();
-	for (PROBS::iterator iter = target->posterior.begin(); iter != target->posterior.end(); iter++) {
-		probs->insert(pair<string, UD>(iter->first, iter->second));
+	vector<UD> &posterior = work->states[target->id].posterior;
+	for (unsigned int k = 0; k < posterior.size(); k++) {
+		probs->insert(pair<string, UD>(target->elements[k], posterior[k]));
+	}
+	return 0;
+}
+
+/*!
+ * @brief 近似推論で求めた確率の標準誤差を返します （対象ノードの全ての状態の標準誤差を返します）
+ * @param[in]  string              標準誤差を取得したい対象ノード名
+ * @param[OUT] map<string, double> 各状態の標準誤差(厳密推論の場合は空)
+ */
+int CompositeBase::getError(string targetn, PROBS *errors) {
+	return getError(work, targetn, errors);
+}
+
+/*!
+ * @brief 近似推論で求めた確率の標準誤差を返します （対象ノードの全ての状態の標準誤差を返します）
+ * @param[in]  CompositeWork*      ワークスペース
+ * @param[in]  string              標準誤差を取得したい対象ノード名
+ * @param[OUT] map<string, double> 各状態の標準誤差(厳密推論の場合は空)
+ */
+int CompositeBase::getError(CompositeWork *work, string targetn, PROBS *errors) {
+	// 対象ノードを取得します
+	NODES::iterator iter = nodes.find(targetn);
+	if (iter == nodes.end()) return fail(work, "Composite did not get the target node of " + targetn + "(getError)", 1);
+	errors->clear();
+	vector<UD> &deviation = work->states[iter->second->id].deviation;
+	for (unsigned int k = 0; k < deviation.size(); k++) {
+		errors->insert(PROBS_PAIR(iter->second->elements[k], deviation[k]));
 	}
 	return 0;
 }
 
 /*!
- * @brief 現在の状態をログ出力します
+ * @brief 上位k件の説明を求める際の候補(分割された探索空間とその最良の説明)を定義します
+ */
+struct CompositeCandidate {
+	UD value;                   // 最良の説明の同時確率
+	LINE assignment;            // 最良の説明
+	LINE fixed;                 // 固定した状態
+	map<string, CHARS> excluded; // 除外した状態
+};
+
+/*!
+ * @brief エビデンスの下で未観測の全ノードの最も確からしい説明(MPE)を上位k件返します
+ * 最良の説明は最大積の伝播で求め、k件の説明は最良の説明を除いた探索空間を
+ * 「先頭から順に状態を固定し、次のノードの状態を除外する」分割により求めます(Lawler-Murty法)
+ * @param[in]  int              求める説明の件数
+ * @param[out] vector<EXPLAIN>* 同時確率P(説明,エビデンス)の降順の説明(エビデンスのノードは含めません)
+ * @return 0=正常終了
+ */
+int CompositeBase::calMPE(int k, vector<EXPLAIN> *results) {
+	return calMPE(work, k, results);
+}
+
+/*!
+ * @brief エビデンスの下で未観測の全ノードの最も確からしい説明(MPE)を上位k件返します
+ * @param[in]  CompositeWork*   ワークスペース
+ * @param[in]  int              求める説明の件数
+ * @param[out] vector<EXPLAIN>* 同時確率P(説明,エビデンス)の降順の説明(エビデンスのノードは含めません)
+ * @return 0=正常終了
+ */
+int CompositeBase::calMPE(CompositeWork *work, int k, vector<EXPLAIN> *results) {
+	results->clear();
+	if (nodes.empty()) return 1;
+	// 説明は全ノードに渡る為、未作成のノードを作成します
+	if (activate(work) != 0) return 3;
+	// 与えられているエビデンスを退避して最大積に切り替えます
+	LINE observed(work->evidences);
+	setMaximum(work, true);
+	// エビデンスのみを固定した最良の説明を求めます
+	vector<CompositeCandidate> candidates;
+	CompositeCandidate first;
+	first.fixed = observed;
+	int ret = decodeMPE(work, &first.fixed, &first.excluded, &first.assignment, &first.value);
+	if (ret == 0 && first.value > 0.0) candidates.push_back(first);
+	while ((int)results->size() < k && !candidates.empty()) {
+		// 同時確率が最大の候補を取り出します
+		unsigned int best = 0;
+		for (unsigned int i = 1; i < candidates.size(); i++) {
+			if (candidates[i].value > candidates[best].value) best = i;
+		}
+		CompositeCandidate current = candidates[best];
+		candidates.erase(candidates.begin() + best);
+		// エビデンス以外のノードの状態を説明として保持します
+		EXPLAIN explain;
+		explain.first = current.value;
+		for (LINE::iterator iter = current.assignment.begin(); iter != current.assignment.end(); iter++) {
+			if (observed.find(iter->first) == observed.end()) explain.second.insert(*iter);
+		}
+		results->push_back(explain);
+		if ((int)results->size() >= k) break;
+		// 取り出した説明を除く探索空間を分割し、各々の最良の説明を候補とします
+		LINE fixed(current.fixed);
+		for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+			if (current.fixed.find(iter->first) != current.fixed.end()) continue;
+			string state = current.assignment[iter->first];
+			CompositeCandidate next;
+			next.fixed = fixed;
+			next.excluded = current.excluded;
+			next.excluded[iter->first].push_back(state);
+			if (decodeMPE(work, &next.fixed, &next.excluded, &next.assignment, &next.value) == 0 && next.value > 0.0) {
+				candidates.push_back(next);
+			}
+			fixed[iter->first] = state;
+		}
+	}
+	// 和積に戻してエビデンスを与え直します
+	setMaximum(work, false);
+	format(work);
+	for (LINE::iterator iter = observed.begin(); iter != observed.end(); iter++) {
+		setProb(work, iter->first, iter->second);
+	}
+	if (results->empty()) return fail(work, "Composite did not find any explanation(calMPE:2)", 2);
+	return 0;
+}
+
+/*!
+ * @brief 固定した状態と除外した状態の下で最大積の伝播を行い、最も確からしい全ノードの状態を求めます
+ * @param[in]  CompositeWork*    ワークスペース
+ * @param[in]  LINE*             固定するノードの状態
+ * @param[in]  map<string,CHARS> 除外するノードの状態
+ * @param[out] LINE*             全ノードの状態
+ * @param[out] UD*               同時確率
+ * @return 0=正常終了
+ */
+int CompositeBase::decodeMPE(CompositeWork *work, LINE *fixed, map<string, CHARS> *excluded, LINE *assignment, UD *value) {
+	LINE clamped(*fixed);
+	*value = 0.0;
+	while (true) {
+		// 固定した状態と除外した状態を与えて最大積で伝播します
+		if (format(work) != 0) return 1;
+		for (map<string, CHARS>::iterator iter = excluded->begin(); iter != excluded->end(); iter++) {
+			if (clamped.find(iter->first) != clamped.end()) continue;
+			NODES::iterator inode = nodes.find(iter->first);
+			if (inode == nodes.end()) return 2;
+			PROBS likelihood;
+			for (CHARS::iterator iters = inode->second->elements.begin(); iters != inode->second->elements.end(); iters++) {
+				bool out = (find(iter->second.begin(), iter->second.end(), *iters) != iter->second.end());
+				likelihood.insert(PROBS_PAIR(*iters, out ? 0.0 : 1.0));
+			}
+			if (setLikelihood(work, iter->first, &likelihood) != 0) return 2;
+		}
+		for (LINE::iterator iter = clamped.begin(); iter != clamped.end(); iter++) {
+			if (setProb(work, iter->first, iter->second) != 0) return 3;
+		}
+		// 伝播は連結成分内に限られる為、連結成分毎に固定したノード(なければ除外したノード、いずれもなければ先頭のノード)を起点に伝播します
+		for (unsigned int c = 0; c < components.size(); c++) {
+			CompositeNode *root = NULL;
+			for (vector<CompositeNode*>::iterator iterc = components[c].begin(); iterc != components[c].end(); iterc++) {
+				if (clamped.find((*iterc)->name) != clamped.end()) { root = *iterc; break; }
+				if (root == NULL && excluded->find((*iterc)->name) != excluded->end()) root = *iterc;
+			}
+			if (root == NULL) root = components[c].front();
+			if (calProbs(work, root->name) != 0) return 4;
+		}
+		// 最大周辺確率の最大の状態を求めます
+		LINE decided;
+		string tiedn, tieds;
+		for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+			if (clamped.find(iter->first) != clamped.end()) continue;
+			UD first = -1.0, second = -1.0; string state;
+			vector<UD> &posterior = work->states[iter->second->id].posterior;
+			for (unsigned int k = 0; k < posterior.size(); k++) {
+				if (posterior[k] > first) {
+					second = first;
+					first = posterior[k];
+					state = iter->second->elements[k];
+				} else if (posterior[k] > second) {
+					second = posterior[k];
+				}
+			}
+			// 全ての状態が0の場合は、条件を満たす説明がありません
+			if (first <= 0.0) return 5;
+			// 最大の状態が一意でない場合は、最初のノードのみ固定して伝播し直します
+			if (second >= first * (1.0 - 1e-9)) {
+				if (tiedn.empty()) { tiedn = iter->first; tieds = state; }
+			} else {
+				decided[iter->first] = state;
+			}
+		}
+		if (tiedn.empty()) {
+			clamped.insert(decided.begin(), decided.end());
+			break;
+		}
+		clamped[tiedn] = tieds;
+	}
+	// 連結成分は独立な為、全ノードのCPTの積は連結成分毎の最大値の積となります
+	*assignment = clamped;
+	return calJoint(assignment, value);
+}
+
+/*!
+ * @brief 全ノードの状態の同時確率を条件付き確率表の積で求めます
+ * @param[in]  LINE* 全ノードの状態
+ * @param[out] UD*   同時確率
+ * @return 0=正常終了
+ */
+int CompositeBase::calJoint(LINE *assignment, UD *value) {
+	*value = 1.0;
+	for (NODES::iterator iter = nodes.begin(); iter != nodes.end(); iter++) {
+		CompositeNode *target = iter->second;
+		if (target->compile() != 0) return 1;
+		// 親の状態の組から条件付き確率の行を求めます
+		vector<unsigned int> digits(target->parentNodes.size());
+		vector<UD> scratch(target->elements.size());
+		for (unsigned int j = 0; j < target->parentNodes.size(); j++) {
+			int state = target->parentNodes[j]->index((*assignment)[target->parentNodes[j]->name]);
+			if (state < 0) return 2;
+			digits[j] = state;
+		}
+		int state = target->index((*assignment)[iter->first]);
+		if (state < 0) return 3;
+		*value *= target->conditional(digits.empty() ? NULL : &digits[0], &scratch[0])[state];
+	}
+	return 0;
+}
+
+/*!
+ * @brief ワークスペースの計算方法を和積又は最大積に切り替えます
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] bool           true=最大積
+ */
+int CompositeBase::setMaximum(CompositeWork *work, bool maximum) {
+	work->maximum = maximum;
+	return 0;
+}
+
+/*!
+ * @brief 問合せのエラーをトレース(TRACE_ERROR)に出力し、ワークスペースに保持します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] string         エラーの内容
+ * @param[in] int            戻り値
+ * @return 指定の戻り値
+ */
+int CompositeBase::fail(CompositeWork *work, string message, int code) {
+	TRACE(TRACE_ERROR, message);
+	work->message = message;
+	return code;
+}
+
+/*!
+ * @brief エビデンスを与えて指定ノードの事後確率を返します(同一条件の結果はキャッシュから返します)
+ * @param[in]  COND*       エビデンス(ノード名=状態名)
+ * @param[in]  CHARS*      対象とするノード名
+ * @param[out] POSTERIORS* 対象ノード毎の事後確率
+ * @param[in]  int         推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+ * @return 0=正常終了
+ */
+int CompositeBase::query(COND *evidence, CHARS *targets, POSTERIORS *results, int method) {
+	return query(work, evidence, targets, results, method);
+}
+
+/*!
+ * @brief エビデンスを与えて指定ノードの事後確率を返します(同一条件の結果はキャッシュから返します)
+ * @param[in]  CompositeWork* ワークスペース
+ * @param[in]  COND*          エビデンス(ノード名=状態名)
+ * @param[in]  CHARS*         対象とするノード名
+ * @param[out] POSTERIORS*    対象ノード毎の事後確率
+ * @param[in]  int            推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+ * @return 0=正常終了
+ */
+int CompositeBase::query(CompositeWork *work, COND *evidence, CHARS *targets, POSTERIORS *results, int method) {
+	// 構造又は実データが更新されている場合は、キャッシュを破棄します
+	// (モデルファイルから構築した場合は実データの更新はありません)
+	pthread_mutex_lock(&mutex);
+	long data = (vfile == NULL ? 0 : vfile->revcnt());
+	if (cacheRevision != revision || cacheData != data) {
+		invalidate();
+		cacheRevision = revision;
+		cacheData = data;
+	}
+	pthread_mutex_unlock(&mutex);
+	// 順序に依存しないようにエビデンスと対象ノードを整列してキーを作成します
+	// 同一ノードに複数のエビデンスがある場合は、後のエビデンスを有効とします
+	LINE sortede;
+	for (COND::iterator iter = evidence->begin(); iter != evidence->end(); iter++) {
+		sortede[iter->first] = iter->second;
+	}
+	CHARS sortedt(*targets);
+	sort(sortedt.begin(), sortedt.end());
+	sortedt.erase(unique(sortedt.begin(), sortedt.end()), sortedt.end());
+	stringstream key;
+	key << method << "|";
+	for (LINE::iterator iter = sortede.begin(); iter != sortede.end(); iter++) {
+		key << iter->first.size() << ":" << iter->first << "=" << iter->second.size() << ":" << iter->second << ",";
+	}
+	key << "|";
+	for (CHARS::iterator iter = sortedt.begin(); iter != sortedt.end(); iter++) {
+		key << iter->size() << ":" << *iter << ",";
+	}
+	// 近似推論の推定値はサンプリングの設定に依存する為、設定もキーに含めます
+	// 時間予算を指定した場合は同じ設定でも推定値が変わる為、キャッシュを用いません
+	bool cacheable = true;
+	if (method != INFER_EXACT) {
+		key << "|" << sampler.samples << "," << sampler.burnin << "," << sampler.threads << "," << sampler.seed;
+		cacheable = (sampler.seconds <= 0.0);
+	}
+	// キャッシュに存在する場合はそれを返します
+	if (cacheable && cache.find(key.str(), results)) return 0;
+
+	// BPで推定します
+	results->clear();
+	if (format(work) != 0) return 1;
+	string targetc;
+	for (LINE::iterator iter = sortede.begin(); iter != sortede.end(); iter++) {
+		if (setProb(work, iter->first, iter->second) != 0) return 2;
+		targetc = iter->first;
+	}
+	if (method != INFER_EXACT) {
+		// 近似推論は全ノードを用いる為、一度のみ推論します
+		if (calProbs(work, targetc, method) != 0) return 3;
+	} else if (!targetc.empty()) {
+		// 厳密推論の伝播は連結成分内に限られる為、エビデンス又は対象ノードを含む連結成分毎に伝播します
+		// 起点はエビデンスのノードを優先し、エビデンスのない連結成分は対象ノードとします
+		// (エビデンスが全くない場合は初期化時の確率が解となります)
+		map<int, string> roots;
+		for (LINE::iterator iter = sortede.begin(); iter != sortede.end(); iter++) {
+			roots[nodes.find(iter->first)->second->component] = iter->first;
+		}
+		for (CHARS::iterator iter = sortedt.begin(); iter != sortedt.end(); iter++) {
+			NODES::iterator found = nodes.find(*iter);
+			if (found != nodes.end()) roots.insert(pair<int, string>(found->second->component, *iter));
+		}
+		for (map<int, string>::iterator iter = roots.begin(); iter != roots.end(); iter++) {
+			if (calProbs(work, iter->second) != 0) return 3;
+		}
+	}
+	// 結果を取得してキャッシュに保持します
+	unsigned long bytes = 0;
+	for (CHARS::iterator iter = sortedt.begin(); iter != sortedt.end(); iter++) {
+		PROBS probs;
+		if (getProb(work, *iter, &probs) != 0) return 4;
+		bytes += iter->size() + sizeof(PROBS);
+		for (PROBS::iterator iterp = probs.begin(); iterp != probs.end(); iterp++) {
+			// 文字列と木構造の要素の大きさを概算します
+			bytes += iterp->first.size() + sizeof(PROBS_PAIR) + 4 * sizeof(void*);
+		}
+		results->insert(pair<string, PROBS>(*iter, probs));
+	}
+	if (cacheable) cache.insert(key.str(), *results, bytes);
+	return 0;
+}
+
+/*!
+ * @brief 事後確率のキャッシュを破棄します
+ * @return 0=正常終了
+ */
+int CompositeBase::invalidate() {
+	cache.clear();
+	return 0;
+}
+
+/*!
+ * @brief 現在の状態をトレース出力します(TRACE_DETAIL水準)
  */
 int CompositeBase::now(string title) {
+	return now(work, title);
+}
+
+/*!
+ * @brief ワークスペースの現在の状態をトレース出力します(TRACE_DETAIL水準)
+ */
+int CompositeBase::now(CompositeWork *work, string title) {
+	if (!TRACE_ON(TRACE_DETAIL)) return 0;
 	for (NODES::iterator iter1 = nodes.begin(); iter1 != nodes.end(); iter1++) {
 		CompositeNode *target = iter1->second;
-		target->now(title);
+		if (!work->ready[target->component]) continue;
+		target->now(work, title);
 	}
 	return 0;
 }
@@ -3,10 +3,20 @@
 // Version     : 1.0
 // Description : Bayesian Network Processing in C++, Ansi-style
 //============================================================================
+#ifndef COMPOSITEBASE_H_
+#define COMPOSITEBASE_H_
+
 #include "CompositeNode.h"
+#include "CompositeWork.h"
+#include "CompositeSampling.h"
+#include "CompositeCache.h"
+#include "CompositeBif.h"
 
 /*!
  * @brief BayesianNetwork全体に関わる処理、及びUI部分を受け持ちます
+ * ネットワーク構造と条件付き確率表(モデル)は全問合せで共有し、BPの状態はCompositeWorkに保持します
+ * createWorkで作成したワークスペースをスレッド毎に用いれば、1つのモデルに同時に問い合わせできます
+ * (ワークスペースを引数に取らない処理は既定のワークスペースを用います)
  */
 class CompositeBase {
 
@@ -21,8 +31,20 @@ public:
 	 * @brief BN構造とCPT引数を元にBN処理を行います
 	 * @param[in] CompositeParse*  BN構造であるXML-Document
 	 * @param[in] ProbabilityBase* データを保持した確率処理(CPTを提供)
+	 * @param[in] bool             true=事前確率とCPTを問合せで到達した連結成分のみ遅延して作成します
+	 */
+	CompositeBase(ProbabilityBase *vfile, string relations, bool lazy = false);
+
+	/*!
+	 * @brief 構築済みモデルファイル(saveで出力)を割り当てて、又はBIF/XMLBIF(拡張子.bif、.xml、.xmlbif)を読み込んでBN処理を行います(実データは不要です)
+	 * @param[in] string モデルファイル名
+	 */
+	explicit CompositeBase(string model);
+
+	/*!
+	 * @brief 既定のワークスペースと割り当てたモデルファイルを解放します
 	 */
-	CompositeBase(ProbabilityBase *vfile, string relations);
+	virtual ~CompositeBase();
 
 public:
 	/*!
@@ -40,12 +62,89 @@ public:
 	 */
 	int maxDepth;
 
+	/*!
+	 * @brief 事前確率とCPTを遅延して作成するか否かを保持します
+	 */
+	bool lazy;
+
+	/*!
+	 * @brief 事前確率とCPTの作成に用いるスレッド数を保持します(0以下の場合はCPU数)
+	 */
+	int threads;
+
+	/*!
+	 * @brief 伝播起点のノード名毎に作成済みのメッセージ転送手順を保持します
+	 */
+	map<string, SCHEDULE> schedules;
+
+	/*!
+	 * @brief 既定のワークスペースを保持します(ワークスペースを引数に取らない処理で用います)
+	 */
+	CompositeWork *work;
+
+	/*!
+	 * @brief サンプリングによる近似推論の設定を保持します(サンプル数等はここで指定します)
+	 * 推論は問合せ毎に設定を複製して行います
+	 */
+	CompositeSampling sampler;
+
+	/*!
+	 * @brief 事後確率のLRUキャッシュを保持します(キー=エビデンス、対象ノード、推論方式、近似推論の場合はサンプリングの設定)
+	 * 容量の変更はcache.resize、ヒット率はcache.hits/cache.misses/cache.rate()で参照します
+	 */
+	CompositeCache<POSTERIORS> cache;
+
 protected:
 	/*!
 	 * @brief データファイル名(実データ)を保持します
 	 */
 	ProbabilityBase *vfile;
 
+	/*!
+	 * @brief ネットワーク構造の更新回数を保持します
+	 */
+	long revision;
+
+	/*!
+	 * @brief キャッシュ作成時のネットワーク構造の更新回数を保持します
+	 */
+	long cacheRevision;
+
+	/*!
+	 * @brief キャッシュ作成時の実データの更新回数を保持します
+	 */
+	long cacheData;
+
+	/*!
+	 * @brief 雑音付きOR/MAXとするノード名毎の状態の程度の順を保持します(ネットワークを構築し直す場合も適用します)
+	 */
+	map<string, CHARS> noisy;
+
+	/*!
+	 * @brief 連結成分毎のノード(nodesの順)を保持します
+	 */
+	vector<vector<CompositeNode*> > components;
+
+	/*!
+	 * @brief 割り当てたモデルファイルの先頭を保持します(データから構築した場合はNULL)
+	 */
+	void *mapping;
+
+	/*!
+	 * @brief 割り当てたモデルファイルの大きさ(バイト)を保持します
+	 */
+	size_t mappingSize;
+
+	/*!
+	 * @brief 連結成分毎の事前確率とCPTの作成有無を保持します
+	 */
+	vector<char> ready;
+
+	/*!
+	 * @brief モデルの遅延作成、メッセージ転送手順の作成、キャッシュの確認を排他制御します
+	 */
+	pthread_mutex_t mutex;
+
 protected:
     /*!
      * @brief BayesianNetwokを作成します
@@ -54,7 +153,7 @@ protected:
     int invoke();
 
 	/*!
-	 * @brief BIFをBN構造CSVに変換します
+	 * @brief BIF/XMLBIFを読み込んでノードと親子関係、事前確率とCPTを作成します(実データは用いません)
      * @return 0=正常終了
 	 */
 	int convertBifToCsv();
@@ -65,6 +164,35 @@ protected:
 	 */
 	int createNetwork();
 
+	/*!
+	 * @brief ノード構造定義CSVファイルを読み込んでノードと親子関係を作成します
+	 * 先頭がカンマの場合は隣接行列(行=親、列=子)、それ以外は辺の一覧(createEdges)として読み込みます
+     * @return 0=正常終了
+	 */
+	int createRelation();
+
+	/*!
+	 * @brief 辺の一覧形式のノード構造定義CSVを読み込んでノードと親子関係を作成します
+	 * 1行目は見出し行(parent,child)、以降は1行1辺(親,子)とし、辺を持たないノードは名前のみの行で宣言します
+	 * 読み込みは辺の数に比例し、ノード数の2乗の走査は行いません
+	 * @param[in] istream& ノード構造定義CSV
+     * @return 0=正常終了
+	 */
+	int createEdges(istream &fin);
+
+	/*!
+	 * @brief 指定名のノードを返します(存在しない場合は作成します)
+	 * @param[in] string ノード名
+	 */
+	CompositeNode *createNode(string name);
+
+	/*!
+	 * @brief 構築済みモデルファイルを割り当ててノードと親子関係、事前確率とCPTを作成します
+	 * 文字列以外(CPT)は複製せずに割り当てた領域を直接参照します
+     * @return 0=正常終了
+	 */
+	int loadModel();
+
 	/*!
 	 * @brief 構築されたBayesianNetworkから各ノードの階層レベルを定義します
 	 * @param[in] int 			  現在の階層レベル
@@ -73,20 +201,122 @@ protected:
 	 */
 	int createDepth(int depth, CompositeNode *node);
 
+	/*!
+	 * @brief 指定ノードを起点とするメッセージ転送手順を作成します
+	 * 親を優先した深さ優先順に全ノードを走査し、起点へ向かう収集手順(走査の逆順)と
+	 * 起点から広がる分配手順(走査順)を平坦な配列にします
+	 * @param[in]  CompositeNode* 伝播起点のノード
+	 * @param[out] SCHEDULE*      メッセージ転送手順
+     * @return 0=正常終了
+	 */
+	int createSchedule(CompositeNode *root, SCHEDULE *steps);
+
+	/*!
+	 * @brief 構築されたBayesianNetworkの連結成分を求めます
+     * @return 0=正常終了
+	 */
+	int createComponent();
+
+	/*!
+	 * @brief 未作成の全ノードの事前確率とCPTを作成します
+     * @return 0=正常終了
+	 */
+	int materialize();
+
+	/*!
+	 * @brief 指定ノードの連結成分が未作成の場合、事前確率とCPTを作成します(複数スレッドから呼び出せます)
+	 * @param[in] CompositeNode* 対象ノード
+     * @return 0=正常終了
+	 */
+	int materialize(CompositeNode *node);
+
+	/*!
+	 * @brief 指定ノードの事前確率とCPTを並列に作成します(事前確率を全て作成後にCPTを作成します)
+	 * @param[in] vector<CompositeNode*>* 対象ノード(親ノードを全て含むこと)
+     * @return 0=正常終了
+	 */
+	int materialize(vector<CompositeNode*> *targets);
+
+	/*!
+	 * @brief ワークスペースの全ての連結成分を利用可能にします(モデルを作成し、未初期化の成分を初期化します)
+	 * @param[in] CompositeWork* ワークスペース
+     * @return 0=正常終了
+	 */
+	int activate(CompositeWork *work);
+
+	/*!
+	 * @brief ワークスペースの指定ノードの連結成分を利用可能にします(モデルを作成し、未初期化の場合は初期化します)
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] CompositeNode* 対象ノード
+     * @return 0=正常終了
+	 */
+	int activate(CompositeWork *work, CompositeNode *node);
+
     /*
-     * @brief BayesianNetworkに初期値を設定します
+     * @brief 指定ノードに初期値を設定します
+	 * @param[in] CompositeWork*          ワークスペース
+	 * @param[in] vector<CompositeNode*>* 対象ノード(連結成分単位)
      * @return 0=正常終了
      */
-	int format();
+	int format(CompositeWork *work, vector<CompositeNode*> *targets);
 
 public:
+	/*!
+	 * @brief 全ノードの事前確率とCPTを作成し、構築済みモデルファイルとして出力します
+	 * ノード名、状態名、親子関係、事前確率、CPT、トポロジカル順を含みます
+	 * 拡張子が.bif、.xml、.xmlbifの場合はBIF/XMLBIFとして出力します(事前確率とトポロジカル順は含みません)
+	 * @param[in] string 出力するファイル名
+     * @return 0=正常終了
+	 */
+	int save(string model);
+
+	/*!
+	 * @brief 本モデルに問い合わせる為のワークスペースを作成します(呼び出し元で解放して下さい)
+	 * ネットワークを構築し直した場合は、作成済みのワークスペースは利用できません
+	 * @return ワークスペース
+	 */
+	CompositeWork *createWork();
+
+    /*
+     * @brief BayesianNetworkに初期値を設定します(与えたエビデンスを破棄します)
+     * @return 0=正常終了
+     */
+	int format();
+
+    /*
+     * @brief ワークスペースを初期化します(与えたエビデンスを破棄し、各連結成分は次の参照時に初期化します)
+	 * @param[in] CompositeWork* ワークスペース
+     * @return 0=正常終了
+     */
+	int format(CompositeWork *work);
+
 	/*!
 	 * @brief 指定ノードの指定要素にエビデンスを与えます
 	 * @param[in] string 対象とするノード名
 	 * @param[in] string 対象とするノード名の要素
-     * @return 0=正常終了
+     * @return 0=正常終了、1=未知のノード、2=未知の状態
 	 */
 	int setProb(string targetn, string targets);
+	int setProb(CompositeWork *work, string targetn, string targets);
+
+	/*!
+	 * @brief 指定ノードの条件付き確率表を展開せず、実データから雑音付きOR/MAXの母数を求めるようにします(既定は全ての親の状態の組の表です)
+	 * 親の影響が独立であるとみなす近似の為、親の組み合わせによる影響(交互作用)は表せず、構築済みモデルとして保存できません
+	 * 作成済みの場合は次の問合せで作成し直します(既定以外のワークスペースは作成し直して下さい)
+	 * @param[in] string 対象とするノード名(実データから構築したネットワークのみ)
+	 * @param[in] CHARS* 自身の状態名の程度の低い順(先頭が正常状態、NULL又は空の場合は2状態のノードのみ要素名の順)
+	 * @return 0=正常終了
+	 */
+	int setNoisy(string targetn, CHARS *order);
+
+	/*!
+	 * @brief 指定ノードの状態毎に尤度を与えます(尤度0の状態を除外する場合等に利用します)
+	 * @param[in] string 対象とするノード名
+	 * @param[in] PROBS* 状態毎の尤度
+     * @return 0=正常終了
+	 */
+	int setLikelihood(string targetn, PROBS *likelihood);
+	int setLikelihood(CompositeWork *work, string targetn, PROBS *likelihood);
 
 	/*!
 	 * @brief BPを用いた推定（又は事後）確率を計算します
@@ -94,6 +324,16 @@ public:
      * @return 0=正常終了
 	 */
 	int calProbs(string targetn);
+	int calProbs(CompositeWork *work, string targetn);
+
+	/*!
+	 * @brief 指定した推論方式で推定（又は事後）確率を計算します
+	 * @param[in] string 確率伝播の起点とするノード名(近似推論では利用しません)
+	 * @param[in] int    推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+     * @return 0=正常終了
+	 */
+	int calProbs(string targetn, int method);
+	int calProbs(CompositeWork *work, string targetn, int method);
 
 	/*!
 	 * @brief BPを用いた推定（又は事後）確率を返します（全ノードの指定状態の確率を返します）
@@ -102,13 +342,87 @@ public:
      * @return 0=正常終了
 	 */
 	int getProb(string targets, PROBS *probs);
+	int getProb(CompositeWork *work, string targets, PROBS *probs);
+
+	/*!
+	 * @brief 近似推論で求めた確率の標準誤差を返します（全ノードの指定状態の標準誤差を返します）
+	 * @param[in] string 対象とするノード名
+	 * @param[in] string 対象ノードの標準誤差
+     * @return 0=正常終了
+	 */
+	int getError(string targets, PROBS *errors);
+	int getError(CompositeWork *work, string targets, PROBS *errors);
+
+	/*!
+	 * @brief エビデンスの下で未観測の全ノードの最も確からしい説明(MPE)を上位k件返します
+	 * @param[in]  int              求める説明の件数
+	 * @param[out] vector<EXPLAIN>* 同時確率P(説明,エビデンス)の降順の説明(エビデンスのノードは含めません)
+     * @return 0=正常終了
+	 */
+	int calMPE(int k, vector<EXPLAIN> *results);
+	int calMPE(CompositeWork *work, int k, vector<EXPLAIN> *results);
 
 	/*!
-	 * @brief 現在の状態をログ出力します
+	 * @brief エビデンスを与えて指定ノードの事後確率を返します(同一条件の結果はキャッシュから返します)
+	 * 厳密推論ではエビデンス又は対象ノードを含む連結成分毎に伝播します
+	 * @param[in]  COND*       エビデンス(ノード名=状態名)
+	 * @param[in]  CHARS*      対象とするノード名
+	 * @param[out] POSTERIORS* 対象ノード毎の事後確率
+	 * @param[in]  int         推論方式(INFER_EXACT, INFER_LIKELIHOOD, INFER_GIBBS)
+     * @return 0=正常終了
+	 */
+	int query(COND *evidence, CHARS *targets, POSTERIORS *results, int method);
+	int query(CompositeWork *work, COND *evidence, CHARS *targets, POSTERIORS *results, int method);
+
+	/*!
+	 * @brief 事後確率のキャッシュを破棄します
+     * @return 0=正常終了
+	 */
+	int invalidate();
+
+	/*!
+	 * @brief 現在の状態をトレース出力します(TRACE_DETAIL水準)
 	 */
 	int now(string title);
+	int now(CompositeWork *work, string title);
 
-};
+protected:
+	/*!
+	 * @brief ワークスペースの計算方法を和積又は最大積に切り替えます
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] bool           true=最大積
+	 */
+	int setMaximum(CompositeWork *work, bool maximum);
 
+	/*!
+	 * @brief 問合せのエラーをトレース(TRACE_ERROR)に出力し、ワークスペースに保持します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] string         エラーの内容
+	 * @param[in] int            戻り値
+	 * @return 指定の戻り値
+	 */
+	int fail(CompositeWork *work, string message, int code);
 
+	/*!
+	 * @brief 固定した状態と除外した状態の下で最大積の伝播を行い、最も確からしい全ノードの状態を求めます
+	 * 最大周辺確率の最大の状態が一意でないノードがある場合は、1ノードずつ固定して伝播を繰り返します
+	 * @param[in]  CompositeWork*    ワークスペース
+	 * @param[in]  LINE*             固定するノードの状態
+	 * @param[in]  map<string,CHARS> 除外するノードの状態
+	 * @param[out] LINE*             全ノードの状態
+	 * @param[out] UD*               同時確率
+     * @return 0=正常終了
+	 */
+	int decodeMPE(CompositeWork *work, LINE *fixed, map<string, CHARS> *excluded, LINE *assignment, UD *value);
+
+	/*!
+	 * @brief 全ノードの状態の同時確率を条件付き確率表の積で求めます
+	 * @param[in]  LINE* 全ノードの状態
+	 * @param[out] UD*   同時確率
+     * @return 0=正常終了
+	 */
+	int calJoint(LINE *assignment, UD *value);
+
+};
 
+#endif /* COMPOSITEBASE_H_ */
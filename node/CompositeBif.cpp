@@ -0,0 +1,719 @@
+//============================================================================
+// Name        : CompositeBif.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeBif.h"
+#include "BayesianTrace.h"
+#include <string.h>
+#include <unistd.h>
+
+/*! @brief 読み込みのバッファの大きさ(バイト)を定義します */
+#define BIF_BUFFER (1024 * 1024)
+
+/*!
+ * @brief ファイル名の拡張子を小文字で返します
+ */
+static string bifExtension(const string &path) {
+	string::size_type pos = path.rfind('.');
+	if (pos == string::npos || path.find('/', pos) != string::npos) return "";
+	string result = path.substr(pos + 1);
+	for (unsigned int i = 0; i < result.size(); i++) result[i] = tolower(result[i]);
+	return result;
+}
+
+/*!
+ * @brief XMLBIFの拡張子か否かを返します
+ */
+static bool isXml(const string &path) {
+	string extension = bifExtension(path);
+	return (extension == "xml" || extension == "xmlbif");
+}
+
+/*!
+ * @brief XMLの文字参照に置き換えて返します
+ */
+static string escapeXml(const string &text) {
+	string result;
+	for (string::const_iterator iter = text.begin(); iter != text.end(); iter++) {
+		if (*iter == '&') result += "&amp;";
+		else if (*iter == '<') result += "&lt;";
+		else if (*iter == '>') result += "&gt;";
+		else if (*iter == '"') result += "&quot;";
+		else result += *iter;
+	}
+	return result;
+}
+
+/*!
+ * @brief XMLの文字参照を元の文字に戻して返します
+ */
+static string unescapeXml(const string &text) {
+	static const char *entities[][2] = {{"&amp;", "&"}, {"&lt;", "<"}, {"&gt;", ">"}, {"&quot;", "\""}, {"&apos;", "'"}};
+	string result;
+	for (string::size_type i = 0; i < text.size(); i++) {
+		bool replaced = false;
+		for (unsigned int j = 0; text[i] == '&' && j < sizeof(entities) / sizeof(entities[0]); j++) {
+			if (text.compare(i, strlen(entities[j][0]), entities[j][0]) == 0) {
+				result += entities[j][1];
+				i += strlen(entities[j][0]) - 1;
+				replaced = true;
+				break;
+			}
+		}
+		if (!replaced) result += text[i];
+	}
+	return result;
+}
+
+/*!
+ * @brief BIFの名前として引用符が必要な場合は付けて返します
+ */
+static string quoteBif(const string &text) {
+	for (string::const_iterator iter = text.begin(); iter != text.end(); iter++) {
+		if (isspace((unsigned char)*iter) || strchr("{}()[],;|\"/", *iter) != NULL) return "\"" + text + "\"";
+	}
+	return text;
+}
+
+CompositeBif::CompositeBif(string path) {
+	this->path = path;
+	this->fp   = NULL;
+	this->line = 1;
+	this->xml  = isXml(path);
+}
+
+CompositeBif::~CompositeBif() {
+	if (fp != NULL) fclose(fp);
+}
+
+/*!
+ * @brief ファイル名がBIF又はXMLBIFの拡張子か否かを返します
+ * @param[in] string ファイル名
+ */
+bool CompositeBif::isBif(string path) {
+	return (bifExtension(path) == "bif" || isXml(path));
+}
+
+/*!
+ * @brief ファイルを読み込んでノード、親子関係、CPT、事前確率を作成します
+ * @param[out] NODES* 作成したノード(ノード名の昇順)
+ * @return 0=正常終了
+ */
+int CompositeBif::load(NODES *nodes) {
+#ifdef TIME
+	double begin = nowtime();
+#endif
+	fp = fopen(path.c_str(), "r");
+	if (fp == NULL) {
+		printf("[CompositeBif::load]could not open %s(%s)\n", path.c_str(), strerror(errno));
+		return 1;
+	}
+	setvbuf(fp, NULL, _IOFBF, BIF_BUFFER);
+	int ret = (xml ? readXml() : readBif());
+	fclose(fp);
+	fp = NULL;
+	if (ret != 0) return 2;
+	if (build(nodes) != 0) return 3;
+#ifdef TIME
+	printf("%f=CompositeBif::load\n", (nowtime() - begin) / 1000.0);
+#endif
+	TRACE(TRACE_INFO, "[CompositeBif::load]Created " << nodes->size() << " nodes <- " << path);
+	return 0;
+}
+
+/*!
+ * @brief 1文字を読み込みます(行番号を数えます)
+ */
+inline int CompositeBif::read() {
+	int c = getc(fp);
+	if (c == '\n') line++;
+	return c;
+}
+
+/*!
+ * @brief 1文字を読み戻します
+ */
+inline void CompositeBif::unread(int c) {
+	if (c == EOF) return;
+	if (c == '\n') line--;
+	ungetc(c, fp);
+}
+
+/*!
+ * @brief BIFの字句(記号1文字、引用符の文字列、それ以外の連続した文字)を1つ返します
+ * @param[out] string* 字句(ファイルの終わりでは空)
+ * @return true=字句あり
+ */
+bool CompositeBif::token(string *result) {
+	result->clear();
+	int c;
+	// 空白と注釈(//...、/*...*/)を読み飛ばします
+	while (true) {
+		c = read();
+		if (c == EOF) return false;
+		if (isspace(c)) continue;
+		if (c != '/') break;
+		int next = read();
+		if (next == '/') {
+			while ((c = read()) != EOF && c != '\n');
+		} else if (next == '*') {
+			int last = 0;
+			while ((c = read()) != EOF && !(last == '*' && c == '/')) last = c;
+		} else {
+			unread(next);
+			break;
+		}
+	}
+	if (strchr("{}()[],;|", c) != NULL) {
+		*result += (char)c;
+		return true;
+	}
+	if (c == '"') {
+		while ((c = read()) != EOF && c != '"') *result += (char)c;
+		return true;
+	}
+	while (c != EOF && !isspace(c) && strchr("{}()[],;|\"", c) == NULL) {
+		*result += (char)c;
+		c = read();
+	}
+	unread(c);
+	return true;
+}
+
+/*!
+ * @brief BIFの字句を1つ読み、指定の字句であることを確認します
+ */
+int CompositeBif::expect(const char *word) {
+	string result;
+	if (!token(&result) || result != word) {
+		printf("[CompositeBif::expect]expected '%s' but found '%s' at line %ld in %s\n", word, result.c_str(), line, path.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief BIFの字句を;まで読み捨てます
+ */
+int CompositeBif::skip() {
+	string word;
+	while (token(&word)) {
+		if (word == ";") return 0;
+	}
+	printf("[CompositeBif::skip]unexpected end of file in %s\n", path.c_str());
+	return 1;
+}
+
+/*!
+ * @brief BIFを読み込みます
+ * network、variable、probabilityの各ブロックを受け付け、network内の属性は読み捨てます
+ */
+int CompositeBif::readBif() {
+	string word;
+	while (token(&word)) {
+		if (word == "network") {
+			while (token(&word) && word != "{");
+			int depth = 1;
+			while (depth > 0 && token(&word)) {
+				if (word == "{") depth++;
+				else if (word == "}") depth--;
+			}
+			if (depth > 0) {
+				printf("[CompositeBif::readBif]unexpected end of file in %s\n", path.c_str());
+				return 1;
+			}
+		} else if (word == "variable") {
+			if (readVariable() != 0) return 2;
+		} else if (word == "probability") {
+			if (readProbability() != 0) return 3;
+		} else {
+			printf("[CompositeBif::readBif]unexpected token '%s' at line %ld in %s\n", word.c_str(), line, path.c_str());
+			return 4;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief BIFのvariableブロックを読み込みます
+ * variable X { type discrete [ 2 ] { x1, x2 }; property ...; }
+ */
+int CompositeBif::readVariable() {
+	string name, word, count;
+	if (!token(&name) || expect("{") != 0) return 1;
+	int index = variable(name);
+	while (token(&word) && word != "}") {
+		if (word != "type") {
+			if (skip() != 0) return 2;
+			continue;
+		}
+		if (!token(&word) || word != "discrete") {
+			printf("[CompositeBif::readVariable]unsupported type '%s' of %s at line %ld in %s\n", word.c_str(), name.c_str(), line, path.c_str());
+			return 3;
+		}
+		if (expect("[") != 0 || !token(&count) || expect("]") != 0 || expect("{") != 0) return 4;
+		CHARS &states = variables[index].states;
+		states.clear();
+		while (token(&word) && word != "}") {
+			if (word != ",") states.push_back(word);
+		}
+		if (expect(";") != 0) return 5;
+		if (atoi(count.c_str()) != (int)states.size()) {
+			printf("[CompositeBif::readVariable]%s declares %s states but lists %d at line %ld in %s\n", name.c_str(), count.c_str(), (int)states.size(), line, path.c_str());
+			return 6;
+		}
+	}
+	if (word != "}") {
+		printf("[CompositeBif::readVariable]unexpected end of file in %s\n", path.c_str());
+		return 7;
+	}
+	return 0;
+}
+
+/*!
+ * @brief BIFのprobabilityブロックを読み込みます
+ * probability ( X | U1, U2 ) { (u1, u2) x1, x2; default x1, x2; table ...; }
+ */
+int CompositeBif::readProbability() {
+	string name, word;
+	if (expect("(") != 0 || !token(&name)) return 1;
+	int index = variable(name);
+	BifVariable &target = variables[index];
+	if (target.defined) {
+		printf("[CompositeBif::readProbability]duplicate probability of %s at line %ld in %s\n", name.c_str(), line, path.c_str());
+		return 2;
+	}
+	target.defined = true;
+	if (!token(&word)) return 3;
+	if (word == "|") {
+		while (token(&word) && word != ")") {
+			if (word != ",") target.parents.push_back(word);
+		}
+	}
+	if (word != ")" || expect("{") != 0) {
+		printf("[CompositeBif::readProbability]broken header of %s at line %ld in %s\n", name.c_str(), line, path.c_str());
+		return 4;
+	}
+	while (token(&word) && word != "}") {
+		if (word == "table") {
+			if (readValues(&target.table) != 0) return 5;
+		} else if (word == "default") {
+			if (readValues(&target.defaults) != 0) return 6;
+		} else if (word == "(") {
+			target.rows.push_back(pair<CHARS, vector<UD> >());
+			CHARS &states = target.rows.back().first;
+			while (token(&word) && word != ")") {
+				if (word != ",") states.push_back(word);
+			}
+			if (readValues(&target.rows.back().second) != 0) return 7;
+		} else if (skip() != 0) {
+			return 8;
+		}
+	}
+	if (word != "}") {
+		printf("[CompositeBif::readProbability]unexpected end of file in %s\n", path.c_str());
+		return 9;
+	}
+	return 0;
+}
+
+/*!
+ * @brief BIFの確率の並び(, 区切り、;まで)を読み込みます
+ */
+int CompositeBif::readValues(vector<UD> *values) {
+	string word;
+	while (token(&word)) {
+		if (word == ";") return 0;
+		if (word == ",") continue;
+		char *end = NULL;
+		UD value = strtod(word.c_str(), &end);
+		if (end == word.c_str() || *end != '\0') {
+			printf("[CompositeBif::readValues]invalid probability '%s' at line %ld in %s\n", word.c_str(), line, path.c_str());
+			return 1;
+		}
+		values->push_back(value);
+	}
+	printf("[CompositeBif::readValues]unexpected end of file in %s\n", path.c_str());
+	return 2;
+}
+
+/*!
+ * @brief XMLBIFの要素又は文字列を1つ返します
+ * 宣言(<?...?>)、注釈(<!--...-->)、属性は読み飛ばし、空要素(<X/>)は開始要素のみ返します
+ * @param[out] string* 要素名(大文字、終了要素は先頭に/を付けます)又は文字列
+ * @return 0=ファイルの終わり、1=要素、2=文字列
+ */
+int CompositeBif::element(string *result) {
+	result->clear();
+	int c;
+	while (true) {
+		while ((c = read()) != EOF && isspace(c));
+		if (c == EOF) return 0;
+		if (c != '<') {
+			// 次の要素までを文字列とし、末尾の空白を除きます
+			string text;
+			while (c != EOF && c != '<') {
+				text += (char)c;
+				c = read();
+			}
+			unread(c);
+			string::size_type last = text.find_last_not_of(" \t\r\n");
+			*result = unescapeXml(text.substr(0, last + 1));
+			return 2;
+		}
+		c = read();
+		if (c == '?' || c == '!') {
+			// 宣言、注釈、文書型は読み飛ばします
+			bool comment = false;
+			if (c == '!') {
+				int next = read();
+				if (next == '-') comment = true;
+				else unread(next);
+			}
+			int last1 = 0, last2 = 0;
+			while ((c = read()) != EOF) {
+				if (c == '>' && (!comment || (last1 == '-' && last2 == '-'))) break;
+				last2 = last1;
+				last1 = c;
+			}
+			continue;
+		}
+		if (c == '/') *result += '/';
+		else unread(c);
+		while ((c = read()) != EOF && !isspace(c) && c != '>' && c != '/') *result += (char)toupper(c);
+		// 属性を読み飛ばします
+		char quote = 0;
+		while (c != EOF && (quote != 0 || c != '>')) {
+			if (quote != 0 && c == quote) quote = 0;
+			else if (quote == 0 && (c == '"' || c == '\'')) quote = c;
+			c = read();
+		}
+		return 1;
+	}
+}
+
+/*!
+ * @brief XMLBIFを読み込みます
+ * VARIABLEのNAME、OUTCOMEと、DEFINITION(PROBABILITY)のFOR、GIVEN、TABLEを受け付けます
+ */
+int CompositeBif::readXml() {
+	string word;
+	CHARS elements;
+	int index = -1, kind;
+	while ((kind = element(&word)) != 0) {
+		if (kind == 1) {
+			if (word[0] != '/') {
+				elements.push_back(word);
+				continue;
+			}
+			if (elements.empty() || elements.back() != word.substr(1)) {
+				printf("[CompositeBif::readXml]unbalanced element %s at line %ld in %s\n", word.c_str(), line, path.c_str());
+				return 1;
+			}
+			elements.pop_back();
+			if (word == "/VARIABLE" || word == "/DEFINITION" || word == "/PROBABILITY") index = -1;
+			continue;
+		}
+		if (elements.size() < 2) continue;
+		const string &tag = elements.back(), &block = elements[elements.size() - 2];
+		if (block == "VARIABLE") {
+			if (tag == "NAME") {
+				index = variable(word);
+			} else if (tag == "OUTCOME" || tag == "VALUE") {
+				if (index < 0) {
+					printf("[CompositeBif::readXml]OUTCOME before NAME at line %ld in %s\n", line, path.c_str());
+					return 2;
+				}
+				variables[index].states.push_back(word);
+			}
+		} else if (block == "DEFINITION" || block == "PROBABILITY") {
+			if (tag == "FOR") {
+				index = variable(word);
+				if (variables[index].defined) {
+					printf("[CompositeBif::readXml]duplicate definition of %s at line %ld in %s\n", word.c_str(), line, path.c_str());
+					return 3;
+				}
+				variables[index].defined = true;
+			} else if (tag == "GIVEN" || tag == "TABLE") {
+				if (index < 0) {
+					printf("[CompositeBif::readXml]%s before FOR at line %ld in %s\n", tag.c_str(), line, path.c_str());
+					return 4;
+				}
+				if (tag == "GIVEN") {
+					variables[index].parents.push_back(word);
+					continue;
+				}
+				const char *source = word.c_str();
+				char *end = NULL;
+				for (UD value = strtod(source, &end); end != source; value = strtod(source, &end)) {
+					variables[index].table.push_back(value);
+					source = end;
+				}
+				while (isspace((unsigned char)*source)) source++;
+				if (*source != '\0') {
+					printf("[CompositeBif::readXml]invalid probability '%s' at line %ld in %s\n", source, line, path.c_str());
+					return 5;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief 変数を登録して番号を返します(同名の変数がある場合はその番号を返します)
+ */
+int CompositeBif::variable(const string &name) {
+	map<string, int>::iterator found = names.find(name);
+	if (found != names.end()) return found->second;
+	BifVariable target;
+	target.name    = name;
+	target.defined = false;
+	variables.push_back(target);
+	names.insert(pair<string, int>(name, variables.size() - 1));
+	return variables.size() - 1;
+}
+
+/*!
+ * @brief 読み込んだ変数からノード、CPT、事前確率を作成します
+ * CPTは親をparentsの順(最初の親が最上位桁)、自身の状態を最下位桁とし、状態は名前の昇順に並べ替えます
+ */
+int CompositeBif::build(NODES *nodes) {
+	unsigned int n = variables.size();
+	vector<CompositeNode*> targets(n);
+	// ノードと要素名(昇順)を作成します
+	for (unsigned int i = 0; i < n; i++) {
+		BifVariable &source = variables[i];
+		if (source.states.empty() || !source.defined) {
+			printf("[CompositeBif::build]%s has no %s in %s\n", source.name.c_str(), (source.states.empty() ? "states" : "probability"), path.c_str());
+			return 1;
+		}
+		CompositeNode *target = new CompositeNode(source.name, NULL);
+		nodes->insert(pair<string, CompositeNode*>(target->name, target));
+		targets[i] = target;
+		target->elements = source.states;
+		sort(target->elements.begin(), target->elements.end());
+		if (adjacent_find(target->elements.begin(), target->elements.end()) != target->elements.end()) {
+			printf("[CompositeBif::build]duplicate state of %s in %s\n", source.name.c_str(), path.c_str());
+			return 2;
+		}
+	}
+	// 親子関係を作成します
+	for (unsigned int i = 0; i < n; i++) {
+		BifVariable &source = variables[i];
+		for (unsigned int j = 0; j < source.parents.size(); j++) {
+			map<string, int>::iterator found = names.find(source.parents[j]);
+			if (found == names.end() || targets[i]->parents.count(source.parents[j]) != 0) {
+				printf("[CompositeBif::build]unknown or duplicate parent %s of %s in %s\n", source.parents[j].c_str(), source.name.c_str(), path.c_str());
+				return 3;
+			}
+			targets[i]->addParent(targets[found->second]);
+			targets[found->second]->addChild(targets[i]);
+		}
+	}
+	// CPTを展開します
+	for (unsigned int i = 0; i < n; i++) {
+		BifVariable &source = variables[i];
+		CompositeNode *target = targets[i];
+		unsigned long size = target->elements.size(), rows = 1;
+		// 桁の重み(parentsの順)を求めます
+		map<string, unsigned long> weights;
+		target->strides.assign(target->parents.size(), 1);
+		int k = (int)target->parents.size() - 1;
+		for (NODES::reverse_iterator iter = target->parents.rbegin(); iter != target->parents.rend(); iter++, k--) {
+			target->strides[k] = rows;
+			weights[iter->first] = rows;
+			rows *= iter->second->elements.size();
+		}
+		// 記述順の親の重みと、記述順の状態番号から昇順の状態番号への対応を求めます
+		unsigned int count = source.parents.size();
+		vector<unsigned long> dweights(count);
+		vector<CompositeNode*> dparents(count);
+		for (unsigned int j = 0; j < count; j++) {
+			dweights[j] = weights[source.parents[j]];
+			dparents[j] = target->parents[source.parents[j]];
+		}
+		vector<int> ranks(size);
+		for (unsigned int s = 0; s < size; s++) ranks[s] = target->index(source.states[s]);
+		target->table.assign(rows * size, 0.0);
+		vector<char> filled(rows, 0);
+		// table形式(BIFは自身の状態が最上位桁、XMLBIFは最下位桁)を展開します
+		if (!source.table.empty()) {
+			if (source.table.size() != rows * size) {
+				printf("[CompositeBif::build]table size mismatch of %s(%lu/%lu) in %s\n", source.name.c_str(), (unsigned long)source.table.size(), rows * size, path.c_str());
+				return 4;
+			}
+			for (unsigned long t = 0; t < source.table.size(); t++) {
+				unsigned long rest = (xml ? t / size : t % rows), row = 0;
+				unsigned int state = (xml ? t % size : t / rows);
+				for (int j = (int)count - 1; j >= 0; j--) {
+					unsigned int states = dparents[j]->elements.size();
+					row += dweights[j] * dparents[j]->index(variables[names[source.parents[j]]].states[rest % states]);
+					rest /= states;
+				}
+				target->table[row * size + ranks[state]] = source.table[t];
+				filled[row] = 1;
+			}
+		}
+		// 行形式を展開します
+		for (unsigned int r = 0; r < source.rows.size(); r++) {
+			CHARS &states = source.rows[r].first;
+			vector<UD> &probs = source.rows[r].second;
+			bool valid = (states.size() == count && probs.size() == size);
+			unsigned long row = 0;
+			for (unsigned int j = 0; valid && j < count; j++) {
+				int index = dparents[j]->index(states[j]);
+				if (index < 0) valid = false;
+				else row += dweights[j] * index;
+			}
+			if (!valid) {
+				printf("[CompositeBif::build]broken row %u of %s in %s\n", r + 1, source.name.c_str(), path.c_str());
+				return 5;
+			}
+			for (unsigned int s = 0; s < size; s++) target->table[row * size + ranks[s]] = probs[s];
+			filled[row] = 1;
+		}
+		// 記述のない行は既定値を用います
+		for (unsigned long row = 0; row < rows; row++) {
+			if (filled[row]) continue;
+			if (source.defaults.size() != size) {
+				printf("[CompositeBif::build]missing probability row of %s in %s\n", source.name.c_str(), path.c_str());
+				return 6;
+			}
+			for (unsigned int s = 0; s < size; s++) target->table[row * size + ranks[s]] = source.defaults[s];
+		}
+		target->values   = &target->table[0];
+		target->cells    = target->table.size();
+		target->compiled = true;
+		target->materialized = true;
+	}
+	// トポロジカル順に、親の事前確率で周辺化して事前確率を求めます
+	map<CompositeNode*, unsigned int> position;
+	vector<unsigned int> order, degrees(n);
+	for (unsigned int i = 0; i < n; i++) {
+		position[targets[i]] = i;
+		degrees[i] = targets[i]->parents.size();
+		if (degrees[i] == 0) order.push_back(i);
+	}
+	for (unsigned int i = 0; i < order.size(); i++) {
+		NODES &children = targets[order[i]]->children;
+		for (NODES::iterator iter = children.begin(); iter != children.end(); iter++) {
+			unsigned int child = position[iter->second];
+			if (--degrees[child] == 0) order.push_back(child);
+		}
+	}
+	if (order.size() != n) {
+		printf("[CompositeBif::build]network has a cycle(%d/%d) in %s\n", (int)order.size(), (int)n, path.c_str());
+		return 7;
+	}
+	vector<vector<UD> > priors(n);
+	for (unsigned int i = 0; i < n; i++) {
+		CompositeNode *target = targets[order[i]];
+		unsigned int size = target->elements.size();
+		vector<UD> &prior = priors[order[i]];
+		prior.assign(size, 0.0);
+		vector<vector<UD>*> pparents;
+		for (NODES::iterator iter = target->parents.begin(); iter != target->parents.end(); iter++) {
+			pparents.push_back(&priors[position[iter->second]]);
+		}
+		unsigned long rows = target->cells / size;
+		for (unsigned long row = 0; row < rows; row++) {
+			UD weight = 1.0;
+			for (unsigned int j = 0; j < pparents.size(); j++) {
+				weight *= (*pparents[j])[(row / target->strides[j]) % pparents[j]->size()];
+			}
+			for (unsigned int s = 0; s < size; s++) prior[s] += weight * target->values[row * size + s];
+		}
+		for (unsigned int s = 0; s < size; s++) target->prior.insert(PROBS_PAIR(target->elements[s], prior[s]));
+	}
+	return 0;
+}
+
+/*!
+ * @brief 展開済みのノードをBIF又はXMLBIFで出力します(拡張子で選択します)
+ * 状態と親は名前の昇順に並べ、親の状態の組毎に1行として出力します
+ * @param[in] string 出力するファイル名
+ * @param[in] NODES* 出力するノード(事前確率とCPTを作成済みであること)
+ * @return 0=正常終了
+ */
+int CompositeBif::save(string path, NODES *nodes) {
+	string temporary = path + ".tmp";
+	FILE *out = fopen(temporary.c_str(), "w");
+	if (out == NULL) {
+		printf("[CompositeBif::save]could not create %s(%s)\n", temporary.c_str(), strerror(errno));
+		return 1;
+	}
+	bool xml = isXml(path);
+	if (xml) {
+		fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<BIF VERSION=\"0.3\">\n<NETWORK>\n<NAME>unknown</NAME>\n");
+		for (NODES::iterator iter = nodes->begin(); iter != nodes->end(); iter++) {
+			CompositeNode *target = iter->second;
+			fprintf(out, "<VARIABLE TYPE=\"nature\">\n\t<NAME>%s</NAME>\n", escapeXml(target->name).c_str());
+			for (unsigned int s = 0; s < target->elements.size(); s++) {
+				fprintf(out, "\t<OUTCOME>%s</OUTCOME>\n", escapeXml(target->elements[s]).c_str());
+			}
+			fprintf(out, "</VARIABLE>\n");
+		}
+		// TABLEは自身の状態を最下位桁、最後のGIVENを次の桁とします(CPTの並びと同じです)
+		for (NODES::iterator iter = nodes->begin(); iter != nodes->end(); iter++) {
+			CompositeNode *target = iter->second;
+			fprintf(out, "<DEFINITION>\n\t<FOR>%s</FOR>\n", escapeXml(target->name).c_str());
+			for (NODES::iterator iterp = target->parents.begin(); iterp != target->parents.end(); iterp++) {
+				fprintf(out, "\t<GIVEN>%s</GIVEN>\n", escapeXml(iterp->first).c_str());
+			}
+			vector<UD> values;
+			target->expand(&values);
+			fprintf(out, "\t<TABLE>");
+			for (unsigned long c = 0; c < values.size(); c++) fprintf(out, (c == 0 ? "%.17g" : " %.17g"), values[c]);
+			fprintf(out, "</TABLE>\n</DEFINITION>\n");
+		}
+		fprintf(out, "</NETWORK>\n</BIF>\n");
+	} else {
+		fprintf(out, "network unknown {\n}\n");
+		for (NODES::iterator iter = nodes->begin(); iter != nodes->end(); iter++) {
+			CompositeNode *target = iter->second;
+			fprintf(out, "variable %s {\n  type discrete [ %d ] { ", quoteBif(target->name).c_str(), (int)target->elements.size());
+			for (unsigned int s = 0; s < target->elements.size(); s++) {
+				fprintf(out, "%s%s", (s == 0 ? "" : ", "), quoteBif(target->elements[s]).c_str());
+			}
+			fprintf(out, " };\n}\n");
+		}
+		for (NODES::iterator iter = nodes->begin(); iter != nodes->end(); iter++) {
+			CompositeNode *target = iter->second;
+			unsigned int size = target->elements.size();
+			fprintf(out, "probability ( %s", quoteBif(target->name).c_str());
+			vector<CompositeNode*> parents;
+			for (NODES::iterator iterp = target->parents.begin(); iterp != target->parents.end(); iterp++) {
+				fprintf(out, "%s%s", (parents.empty() ? " | " : ", "), quoteBif(iterp->first).c_str());
+				parents.push_back(iterp->second);
+			}
+			fprintf(out, " ) {\n");
+			vector<UD> values;
+			target->expand(&values);
+			unsigned long rows = values.size() / size;
+			for (unsigned long row = 0; row < rows; row++) {
+				if (parents.empty()) {
+					fprintf(out, "  table ");
+				} else {
+					fprintf(out, "  (");
+					for (unsigned int j = 0; j < parents.size(); j++) {
+						unsigned int state = (row / target->strides[j]) % parents[j]->elements.size();
+						fprintf(out, "%s%s", (j == 0 ? "" : ", "), quoteBif(parents[j]->elements[state]).c_str());
+					}
+					fprintf(out, ") ");
+				}
+				for (unsigned int s = 0; s < size; s++) fprintf(out, (s == 0 ? "%.17g" : ", %.17g"), values[row * size + s]);
+				fprintf(out, ";\n");
+			}
+			fprintf(out, "}\n");
+		}
+	}
+	if (fclose(out) != 0 || rename(temporary.c_str(), path.c_str()) != 0) {
+		printf("[CompositeBif::save]could not write %s(%s)\n", path.c_str(), strerror(errno));
+		unlink(temporary.c_str());
+		return 2;
+	}
+	TRACE(TRACE_INFO, "[CompositeBif::save]Saved " << nodes->size() << " nodes -> " << path);
+	return 0;
+}
@@ -0,0 +1,176 @@
+//============================================================================
+// Name        : CompositeBif.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITEBIF_H_
+#define COMPOSITEBIF_H_
+
+#include "CompositeNode.h"
+
+/*!
+ * @brief BIF/XMLBIFの1変数(状態と条件付き確率)を保持します
+ * 状態と親はファイルに記述された順に保持します
+ */
+struct BifVariable {
+	string name;                            // 変数名
+	CHARS states;                           // 状態名(記述順)
+	CHARS parents;                          // 親の変数名(記述順)
+	vector<UD> table;                       // table形式の確率(BIFは自身の状態を最上位桁、XMLBIFは最下位桁とし、親は最後の親を下位桁とします)
+	vector<pair<CHARS, vector<UD> > > rows; // 行形式の確率(親の状態名の組、自身の状態毎の確率)
+	vector<UD> defaults;                    // 行の記述がない親の状態の組に用いる確率
+	bool defined;                           // 確率の記述有無
+};
+
+/*!
+ * @brief BIF(Interchange Format)とXMLBIFを実データなしでノードとCPTに変換します
+ * 読み込みは1文字ずつ字句を切り出しながら行い、ファイル全体は保持しません
+ * 拡張子が.xml又は.xmlbifの場合はXMLBIF、それ以外はBIFとして扱います
+ */
+class CompositeBif {
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeBif();
+
+public:
+	/*!
+	 * @brief 対象ファイル名を必須引数とします
+	 * @param[in] string BIF又はXMLBIFのファイル名
+	 */
+	CompositeBif(string path);
+
+	/*!
+	 * @brief ファイルを閉じます
+	 */
+	virtual ~CompositeBif();
+
+public:
+	/*!
+	 * @brief ファイル名がBIF又はXMLBIFの拡張子か否かを返します
+	 * @param[in] string ファイル名
+	 */
+	static bool isBif(string path);
+
+	/*!
+	 * @brief ファイルを読み込んでノード、親子関係、CPT、事前確率を作成します
+	 * 事前確率は親の事前確率を独立とみなした前向きの周辺化で求めます(多重結合がない場合は厳密です)
+	 * @param[out] NODES* 作成したノード(ノード名の昇順)
+	 * @return 0=正常終了
+	 */
+	int load(NODES *nodes);
+
+	/*!
+	 * @brief 展開済みのノードをBIF又はXMLBIFで出力します(拡張子で選択します)
+	 * @param[in] string 出力するファイル名
+	 * @param[in] NODES* 出力するノード(事前確率とCPTを作成済みであること)
+	 * @return 0=正常終了
+	 */
+	static int save(string path, NODES *nodes);
+
+protected:
+	/*!
+	 * @brief ファイル名を保持します
+	 */
+	string path;
+
+	/*!
+	 * @brief 読み込み中のファイルを保持します
+	 */
+	FILE *fp;
+
+	/*!
+	 * @brief 読み込み中の行番号を保持します(エラー表示用)
+	 */
+	long line;
+
+	/*!
+	 * @brief XMLBIFか否かを保持します
+	 */
+	bool xml;
+
+	/*!
+	 * @brief 読み込んだ変数を記述順に保持します
+	 */
+	vector<BifVariable> variables;
+
+	/*!
+	 * @brief 変数名から変数の番号を引き当てます
+	 */
+	map<string, int> names;
+
+protected:
+	/*!
+	 * @brief 1文字を読み込みます(行番号を数えます)
+	 */
+	inline int read();
+
+	/*!
+	 * @brief 1文字を読み戻します
+	 */
+	inline void unread(int c);
+
+	/*!
+	 * @brief BIFの字句(記号1文字、引用符の文字列、それ以外の連続した文字)を1つ返します
+	 * @param[out] string* 字句(ファイルの終わりでは空)
+	 * @return true=字句あり
+	 */
+	bool token(string *result);
+
+	/*!
+	 * @brief BIFの字句を1つ読み、指定の字句であることを確認します
+	 */
+	int expect(const char *word);
+
+	/*!
+	 * @brief BIFの字句を;まで読み捨てます
+	 */
+	int skip();
+
+	/*!
+	 * @brief BIFを読み込みます
+	 */
+	int readBif();
+
+	/*!
+	 * @brief BIFのvariableブロックを読み込みます
+	 */
+	int readVariable();
+
+	/*!
+	 * @brief BIFのprobabilityブロックを読み込みます
+	 */
+	int readProbability();
+
+	/*!
+	 * @brief BIFの確率の並び(, 区切り、;まで)を読み込みます
+	 */
+	int readValues(vector<UD> *values);
+
+	/*!
+	 * @brief XMLBIFの要素又は文字列を1つ返します
+	 * @param[out] string* 要素名(大文字、終了要素は先頭に/を付けます)又は文字列
+	 * @return 0=ファイルの終わり、1=要素、2=文字列
+	 */
+	int element(string *result);
+
+	/*!
+	 * @brief XMLBIFを読み込みます
+	 */
+	int readXml();
+
+	/*!
+	 * @brief 変数を登録して番号を返します(同名の変数がある場合はその番号を返します)
+	 */
+	int variable(const string &name);
+
+	/*!
+	 * @brief 読み込んだ変数からノード、CPT、事前確率を作成します
+	 */
+	int build(NODES *nodes);
+
+};
+
+#endif /* COMPOSITEBIF_H_ */
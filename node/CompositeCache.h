@@ -0,0 +1,216 @@
+//============================================================================
+// Name        : CompositeCache.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITECACHE_H_
+#define COMPOSITECACHE_H_
+
+#include "BayesianDefine.h"
+#include <list>
+#include <pthread.h>
+
+/*!
+ * @brief 正規化したキー文字列で値を保持するLRUキャッシュを定義します
+ * 保持容量(バイト)を超えた場合は最も参照の古い値から破棄します
+ * 複数スレッドから同時に利用できます
+ */
+template<class V> class CompositeCache {
+
+private:
+	/*!
+	 * @brief 複製は許可しません
+	 */
+	CompositeCache(const CompositeCache&);
+	CompositeCache& operator =(const CompositeCache&);
+
+public:
+	/*!
+	 * @brief 保持容量(バイト)を必須引数とします
+	 * @param[in] unsigned long 保持容量(バイト)
+	 */
+	CompositeCache(unsigned long capacity) {
+		this->capacity  = capacity;
+		this->used      = 0;
+		this->hits      = 0;
+		this->misses    = 0;
+		this->evictions = 0;
+		pthread_mutex_init(&mutex, NULL);
+	}
+
+	/*!
+	 * @brief 終了処理を行います
+	 */
+	~CompositeCache() { pthread_mutex_destroy(&mutex); }
+
+private:
+	/*!
+	 * @brief キャッシュの1要素を定義します
+	 */
+	struct Entry {
+		string key;               // 正規化したキー文字列
+		unsigned long long hash;  // キー文字列のハッシュ値
+		V value;                  // 保持する値
+		unsigned long bytes;      // 保持に要するバイト数(概算)
+	};
+
+	/*!
+	 * @brief 参照順(先頭が最新)の要素を保持します
+	 */
+	list<Entry> entries;
+
+	/*!
+	 * @brief ハッシュ値から要素への索引を保持します
+	 */
+	map<unsigned long long, typename list<Entry>::iterator> index;
+
+	/*!
+	 * @brief 排他制御を保持します
+	 */
+	pthread_mutex_t mutex;
+
+public:
+	/*!
+	 * @brief 保持容量(バイト)を保持します
+	 */
+	unsigned long capacity;
+
+	/*!
+	 * @brief 使用中のバイト数(概算)を保持します
+	 */
+	unsigned long used;
+
+	/*!
+	 * @brief ヒット数を保持します
+	 */
+	long hits;
+
+	/*!
+	 * @brief ミス数を保持します
+	 */
+	long misses;
+
+	/*!
+	 * @brief 容量超過による破棄数を保持します
+	 */
+	long evictions;
+
+public:
+	/*!
+	 * @brief キー文字列のハッシュ値(FNV-1a)を返します
+	 * @param[in] string キー文字列
+	 */
+	static unsigned long long hashOf(const string &key) {
+		unsigned long long hash = 14695981039346656037ULL;
+		for (string::const_iterator iter = key.begin(); iter != key.end(); iter++) {
+			hash ^= (unsigned char)*iter;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	/*!
+	 * @brief 指定キーの値を取得します
+	 * @param[in]  string キー文字列
+	 * @param[out] V*     取得した値
+	 * @return true=ヒット
+	 */
+	bool find(const string &key, V *value) {
+		pthread_mutex_lock(&mutex);
+		typename map<unsigned long long, typename list<Entry>::iterator>::iterator iter = index.find(hashOf(key));
+		if (iter == index.end() || iter->second->key != key) {
+			misses++;
+			pthread_mutex_unlock(&mutex);
+			return false;
+		}
+		// 参照された要素を先頭に移動します
+		entries.splice(entries.begin(), entries, iter->second);
+		*value = iter->second->value;
+		hits++;
+		pthread_mutex_unlock(&mutex);
+		return true;
+	}
+
+	/*!
+	 * @brief 指定キーで値を保持します
+	 * @param[in] string        キー文字列
+	 * @param[in] V             保持する値
+	 * @param[in] unsigned long 保持に要するバイト数(概算)
+	 */
+	void insert(const string &key, const V &value, unsigned long bytes) {
+		bytes += key.size() + sizeof(Entry);
+		pthread_mutex_lock(&mutex);
+		// 容量を超える値は保持しません
+		if (bytes > capacity) {
+			pthread_mutex_unlock(&mutex);
+			return;
+		}
+		// 同じハッシュ値の要素は置き換えます
+		unsigned long long hash = hashOf(key);
+		typename map<unsigned long long, typename list<Entry>::iterator>::iterator iter = index.find(hash);
+		if (iter != index.end()) {
+			used -= iter->second->bytes;
+			entries.erase(iter->second);
+			index.erase(iter);
+		}
+		Entry entry;
+		entry.key   = key;
+		entry.hash  = hash;
+		entry.value = value;
+		entry.bytes = bytes;
+		entries.push_front(entry);
+		index[hash] = entries.begin();
+		used += bytes;
+		shrink();
+		pthread_mutex_unlock(&mutex);
+	}
+
+	/*!
+	 * @brief 保持容量を変更します
+	 * @param[in] unsigned long 保持容量(バイト)
+	 */
+	void resize(unsigned long capacity) {
+		pthread_mutex_lock(&mutex);
+		this->capacity = capacity;
+		shrink();
+		pthread_mutex_unlock(&mutex);
+	}
+
+	/*!
+	 * @brief 全ての値を破棄します(統計は保持します)
+	 */
+	void clear() {
+		pthread_mutex_lock(&mutex);
+		entries.clear();
+		index.clear();
+		used = 0;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	/*!
+	 * @brief 保持している値の件数を返します
+	 */
+	long size() { return index.size(); }
+
+	/*!
+	 * @brief ヒット率を返します
+	 */
+	double rate() { return (hits + misses) == 0 ? 0.0 : (double)hits / (hits + misses); }
+
+private:
+	/*!
+	 * @brief 保持容量に収まるまで参照の古い値を破棄します
+	 */
+	void shrink() {
+		while (used > capacity && !entries.empty()) {
+			Entry &last = entries.back();
+			used -= last.bytes;
+			index.erase(last.hash);
+			entries.pop_back();
+			evictions++;
+		}
+	}
+
+};
+
+#endif /* COMPOSITECACHE_H_ */
@@ -0,0 +1,270 @@
+//============================================================================
+// Name        : CompositeClimb.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeClimb.h"
+#include "BayesianTrace.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief 家族毎のスコアと差分スコアを並列に求める処理を定義します
+ */
+struct CompositeClimbRescore {
+	CompositeClimb *climb; // 探索
+	volatile long errors;  // 失敗した家族数
+	void operator()(long index, int thread) {
+		if (climb->rescore((int)index) != 0) __sync_fetch_and_add(&errors, 1);
+	}
+};
+
+/*!
+ * @brief 移動を一意な番号にします(タブーリスト用)
+ */
+static inline long moveKey(int type, int u, int v, int size) {
+	return ((long)type * size + u) * size + v;
+}
+
+/*!
+ * @brief 前回の親(初回は辺のない構造)から山登り法で親を学習します
+ */
+int CompositeClimb::searchStructure(CHARS *names, vector<CHARS> *found) {
+	titles = *names;
+	size = titles.size();
+	map<string, int> positions;
+	for (int v = 0; v < size; v++) positions[titles[v]] = v;
+	// 前回の親から開始します(初回は辺のない構造です)
+	vector<vector<int> > initial(size);
+	for (int v = 0; v < size; v++) {
+		for (CHARS::iterator iter = (*found)[v].begin(); iter != (*found)[v].end(); iter++) initial[v].push_back(positions[*iter]);
+		sort(initial[v].begin(), initial[v].end());
+	}
+	families.assign(size, 0.0);
+	adds.assign((long)size * size, -HUGE_VAL);
+	removes.assign((long)size * size, -HUGE_VAL);
+	reach.assign(size, vector<char>(size, 0));
+	if (restore(&initial) != 0) return 2;
+	double current = total(), bestScore = current;
+	vector<vector<int> > bestParents(parents);
+	TRACE(TRACE_INFO, "[CompositeClimb::searchStructure]Initial Score <- " << current);
+
+	unsigned long long counter = 0;
+	for (int round = 0; round <= restarts; round++) {
+		if (round > 0) {
+			// 最良の構造にランダムな移動を加えてやり直します
+			if (restore(&bestParents) != 0) return 3;
+			for (int i = 0; i < perturb; i++) {
+				if (randomMove(0, &counter) != 0) return 4;
+			}
+			current = total();
+		}
+		tabus.clear();
+		int stale = 0;
+		long step = 0;
+		for (; step < steps; step++) {
+			int type, u, v; double gain;
+			if (!best(&type, &u, &v, &gain)) break;
+			if (apply(type, u, v) != 0) return 5;
+			// 直前の移動を打ち消す移動を禁止します
+			tabus.push_back(type == CLIMB_ADD ? moveKey(CLIMB_REMOVE, u, v, size) :
+					type == CLIMB_REMOVE ? moveKey(CLIMB_ADD, u, v, size) : moveKey(CLIMB_REVERSE, v, u, size));
+			if ((int)tabus.size() > tabu) tabus.pop_front();
+			current = total();
+			TRACE(TRACE_DETAIL, "[CompositeClimb::searchStructure]Move(" << type << ") " << titles[u] << "->" << titles[v] << " <- " << current);
+			// 最良の構造を更新しない移動(タブー探索)は指定回数まで続けます
+			if (current > bestScore + CLIMB_EPSILON) {
+				bestScore = current;
+				bestParents = parents;
+				stale = 0;
+			} else if (++stale > patience) {
+				break;
+			}
+		}
+		TRACE(TRACE_INFO, "[CompositeClimb::searchStructure]Round " << round << " Steps=" << step << " Best Score <- " << bestScore);
+	}
+	// 最良の構造の親を返します
+	found->assign(size, CHARS());
+	for (int v = 0; v < size; v++) {
+		for (vector<int>::iterator iter = bestParents[v].begin(); iter != bestParents[v].end(); iter++) {
+			(*found)[v].push_back(titles[*iter]);
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief 家族vのスコアと、vを子とする移動の差分スコアを求めます
+ */
+int CompositeClimb::rescore(int v) {
+	CHARS names;
+	for (vector<int>::iterator iter = parents[v].begin(); iter != parents[v].end(); iter++) names.push_back(titles[*iter]);
+	if (getScore(titles[v], &names, &families[v]) != 0) {
+		cout << "[CompositeClimb::rescore]Function of getScore Failure" << endl;
+		return 1;
+	}
+	for (int x = 0; x < size; x++) {
+		adds[x * size + v] = removes[x * size + v] = -HUGE_VAL;
+		if (x == v) continue;
+		// xが親の場合は削除、それ以外は追加した家族のスコアを求めます(親候補にない場合、親の数が最大数の場合は追加できません)
+		bool member = binary_search(parents[v].begin(), parents[v].end(), x);
+		if (!member && !allowed(titles[v], titles[x], parents[v].size())) continue;
+		CHARS family;
+		for (vector<int>::iterator iter = parents[v].begin(); iter != parents[v].end(); iter++) {
+			if (*iter != x) family.push_back(titles[*iter]);
+		}
+		if (!member) family.push_back(titles[x]);
+		double p;
+		if (getScore(titles[v], &family, &p) != 0) {
+			cout << "[CompositeClimb::rescore]Function of getScore Failure" << endl;
+			return 2;
+		}
+		(member ? removes : adds)[x * size + v] = p - families[v];
+	}
+	return 0;
+}
+
+/*!
+ * @brief 全ての家族のスコアと差分スコアを求めます(家族毎に並列に求めます)
+ */
+int CompositeClimb::rescoreAll() {
+	CompositeClimbRescore work;
+	work.climb  = this;
+	work.errors = 0;
+	parallel(threads, size, &work);
+	if (work.errors != 0) {
+		cout << "[CompositeClimb::rescoreAll]could not score " << work.errors << " families" << endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*!
+ * @brief 辺u->vを反転してもDAGのままか否かを返します(u->v以外にuからvへの有向路がないこと)
+ */
+bool CompositeClimb::canReverse(int u, int v) {
+	for (vector<int>::iterator iter = children[u].begin(); iter != children[u].end(); iter++) {
+		if (*iter != v && reach[*iter][v]) return false;
+	}
+	return true;
+}
+
+/*!
+ * @brief 移動を行い、到達可能性と影響を受けた家族の差分スコアを更新します
+ */
+int CompositeClimb::apply(int type, int u, int v) {
+	if (type != CLIMB_ADD) {
+		// 辺u->vを削除し、uとその祖先の到達可能性を作り直します(祖先の集合は削除で変わりません)
+		parents[v].erase(find(parents[v].begin(), parents[v].end(), u));
+		children[u].erase(find(children[u].begin(), children[u].end(), v));
+		vector<int> ancestors;
+		for (int a = 0; a < size; a++) {
+			if (a == u || reach[a][u]) ancestors.push_back(a);
+		}
+		for (vector<int>::iterator iter = ancestors.begin(); iter != ancestors.end(); iter++) rebuildReach(*iter);
+	}
+	if (type != CLIMB_REMOVE) {
+		// 辺を追加し、始点とその祖先に終点から到達できるノードを加えます
+		int from = (type == CLIMB_ADD ? u : v), to = (type == CLIMB_ADD ? v : u);
+		parents[to].insert(lower_bound(parents[to].begin(), parents[to].end(), from), from);
+		children[from].push_back(to);
+		for (int a = 0; a < size; a++) {
+			if (a != from && !reach[a][from]) continue;
+			reach[a][to] = 1;
+			for (int b = 0; b < size; b++) {
+				if (reach[to][b]) reach[a][b] = 1;
+			}
+		}
+	}
+	// 親が変化した家族のみ差分スコアを求め直します
+	if (rescore(v) != 0) return 1;
+	if (type == CLIMB_REVERSE && rescore(u) != 0) return 2;
+	return 0;
+}
+
+/*!
+ * @brief タブーリストに含まれない最良の移動を探します
+ */
+bool CompositeClimb::best(int *type, int *u, int *v, double *gain) {
+	*gain = -HUGE_VAL;
+	bool found = false;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			// 追加できる辺と既存の辺(削除、反転)を調べます
+			bool member = binary_search(parents[y].begin(), parents[y].end(), x);
+			for (int t = (member ? CLIMB_REMOVE : CLIMB_ADD); t <= (member ? CLIMB_REVERSE : CLIMB_ADD); t++) {
+				double d = delta(t, x, y);
+				if (d <= *gain) continue;
+				if (t == CLIMB_ADD && !canAdd(x, y)) continue;
+				if (t == CLIMB_REVERSE && !canReverse(x, y)) continue;
+				if (find(tabus.begin(), tabus.end(), moveKey(t, x, y, size)) != tabus.end()) continue;
+				*type = t, *u = x, *v = y, *gain = d;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+/*!
+ * @brief ランダムに可能な移動を1つ行います
+ */
+int CompositeClimb::randomMove(unsigned long long stream, unsigned long long *counter) {
+	if (size < 2) return 0;
+	// 可能な移動が見つかるまで辺をランダムに選びます(見つからない場合は何もしません)
+	for (int attempt = 0; attempt < size * size; attempt++) {
+		int u = (int)(random(stream, (*counter)++) * size), v = (int)(random(stream, (*counter)++) * size);
+		if (u == v) continue;
+		if (binary_search(parents[v].begin(), parents[v].end(), u)) {
+			if (random(stream, (*counter)++) < 0.5) return apply(CLIMB_REMOVE, u, v);
+			if (canReverse(u, v) && adds[v * size + u] > -HUGE_VAL) return apply(CLIMB_REVERSE, u, v);
+		} else if (canAdd(u, v) && adds[u * size + v] > -HUGE_VAL) {
+			return apply(CLIMB_ADD, u, v);
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief 到達可能性の表を全て作り直します
+ */
+void CompositeClimb::rebuildReach() {
+	for (int a = 0; a < size; a++) rebuildReach(a);
+}
+
+/*!
+ * @brief 指定ノードからの到達可能性の行を作り直します
+ */
+void CompositeClimb::rebuildReach(int a) {
+	vector<char> &row = reach[a];
+	row.assign(size, 0);
+	vector<int> stack(children[a]);
+	while (!stack.empty()) {
+		int b = stack.back();
+		stack.pop_back();
+		if (row[b]) continue;
+		row[b] = 1;
+		stack.insert(stack.end(), children[b].begin(), children[b].end());
+	}
+}
+
+/*!
+ * @brief 指定の親の構造に置き換えます
+ */
+int CompositeClimb::restore(vector<vector<int> > *source) {
+	parents = *source;
+	children.assign(size, vector<int>());
+	for (int v = 0; v < size; v++) {
+		for (vector<int>::iterator iter = parents[v].begin(); iter != parents[v].end(); iter++) children[*iter].push_back(v);
+	}
+	rebuildReach();
+	return rescoreAll();
+}
+
+/*!
+ * @brief 構造全体のスコア(家族スコアの和)を返します
+ */
+double CompositeClimb::total() {
+	double result = 0.0;
+	for (int v = 0; v < size; v++) result += families[v];
+	return result;
+}
@@ -0,0 +1,210 @@
+//============================================================================
+// Name        : CompositeClimb.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITECLIMB_H_
+#define COMPOSITECLIMB_H_
+
+#include "CompositeStructure.h"
+#include <deque>
+
+/*!
+ * @brief 辺の操作(移動)の種類を定義します
+ */
+#define CLIMB_ADD     0 // 辺の追加
+#define CLIMB_REMOVE  1 // 辺の削除
+#define CLIMB_REVERSE 2 // 辺の反転
+
+/*!
+ * @brief 探索の既定値を定義します
+ */
+#define CLIMB_TABU     16   // タブーリストの長さ
+#define CLIMB_PATIENCE 16   // 最良の構造を更新しない移動を続ける最大回数
+#define CLIMB_RESTARTS 4    // ランダムリスタート回数
+#define CLIMB_PERTURB  8    // リスタート時に行うランダムな移動数
+#define CLIMB_STEPS    4096 // 1回の探索の最大移動数
+
+/*!
+ * @brief スコアの改善とみなす最小の差を定義します
+ */
+#define CLIMB_EPSILON 1e-9
+
+/*!
+ * @brief 辺の追加、削除、反転による山登り法(タブー探索、ランダムリスタート付き)で構造を学習します
+ * 変数の順序には依存しません、移動による差分スコアは子毎の表に保持し、移動で親が変化した家族の分のみ再計算します
+ * 閉路の判定には到達可能性の表を用い、辺の追加時は差分で、削除時は影響を受ける祖先の行のみ作り直します
+ */
+class CompositeClimb : public CompositeStructure {
+	friend struct CompositeClimbRescore;
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeClimb();
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositeClimb(ProbabilityBase *target) : CompositeStructure(target) {
+		tabu     = CLIMB_TABU;
+		patience = CLIMB_PATIENCE;
+		restarts = CLIMB_RESTARTS;
+		perturb  = CLIMB_PERTURB;
+		steps    = CLIMB_STEPS;
+		size     = 0;
+	}
+
+public:
+	/*!
+	 * @brief タブーリストの長さを保持します(直前の移動を打ち消す移動を禁止します)
+	 */
+	int tabu;
+
+	/*!
+	 * @brief 最良の構造を更新しない移動を続ける最大回数を保持します
+	 */
+	int patience;
+
+	/*!
+	 * @brief ランダムリスタート回数を保持します(最良の構造にランダムな移動を加えて探索をやり直します)
+	 */
+	int restarts;
+
+	/*!
+	 * @brief リスタート時に行うランダムな移動数を保持します
+	 */
+	int perturb;
+
+	/*!
+	 * @brief 1回の探索の最大移動数を保持します
+	 */
+	long steps;
+
+protected:
+	/*!
+	 * @brief ノード名集合を保持します
+	 */
+	CHARS titles;
+
+	/*!
+	 * @brief ノード数を保持します
+	 */
+	int size;
+
+	/*!
+	 * @brief ノード毎の親(ノード番号の昇順)を保持します
+	 */
+	vector<vector<int> > parents;
+
+	/*!
+	 * @brief ノード毎の子(ノード番号)を保持します
+	 */
+	vector<vector<int> > children;
+
+	/*!
+	 * @brief ノード毎の家族スコアを保持します
+	 */
+	vector<double> families;
+
+	/*!
+	 * @brief 辺x->vを追加した場合の家族vのスコアの差分を保持します(x * size + v、親候補にない場合等の追加できない場合は負の無限大)
+	 */
+	vector<double> adds;
+
+	/*!
+	 * @brief 辺x->vを削除した場合の家族vのスコアの差分を保持します(x * size + v)
+	 */
+	vector<double> removes;
+
+	/*!
+	 * @brief 到達可能性(reach[a][b]=1の場合、aからbへの有向路があります)を保持します
+	 */
+	vector<vector<char> > reach;
+
+	/*!
+	 * @brief 直前の移動を打ち消す移動(種類 * size * size + u * size + v)を保持します
+	 */
+	deque<long> tabus;
+
+protected:
+	/*!
+	 * @brief 前回の親(初回は辺のない構造)から山登り法で親を学習します
+	 */
+	int searchStructure(CHARS *names, vector<CHARS> *found);
+
+	/*!
+	 * @brief 家族vのスコアと、vを子とする移動の差分スコアを求めます
+	 */
+	int rescore(int v);
+
+	/*!
+	 * @brief 全ての家族のスコアと差分スコアを求めます(家族毎に並列に求めます)
+	 */
+	int rescoreAll();
+
+	/*!
+	 * @brief 辺u->vを追加してもDAGのままか否かを返します(v->uがある場合も閉路となります)
+	 */
+	inline bool canAdd(int u, int v) { return u != v && !reach[v][u]; }
+
+	/*!
+	 * @brief 辺u->vを反転してもDAGのままか否かを返します(u->v以外にuからvへの有向路がないこと)
+	 */
+	bool canReverse(int u, int v);
+
+	/*!
+	 * @brief 移動を行い、到達可能性と影響を受けた家族の差分スコアを更新します
+	 * @param[in] int 移動の種類(CLIMB_ADD等)
+	 * @param[in] int 辺の始点
+	 * @param[in] int 辺の終点
+	 */
+	int apply(int type, int u, int v);
+
+	/*!
+	 * @brief 移動の差分スコアを返します
+	 */
+	inline double delta(int type, int u, int v) {
+		if (type == CLIMB_ADD) return adds[u * size + v];
+		if (type == CLIMB_REMOVE) return removes[u * size + v];
+		return removes[u * size + v] + adds[v * size + u];
+	}
+
+	/*!
+	 * @brief タブーリストに含まれない最良の移動を探します
+	 * @return true=移動あり
+	 */
+	bool best(int *type, int *u, int *v, double *gain);
+
+	/*!
+	 * @brief ランダムに可能な移動を1つ行います
+	 * @param[in] unsigned long long 乱数列番号
+	 * @param[in] unsigned long long* カウンタ
+	 */
+	int randomMove(unsigned long long stream, unsigned long long *counter);
+
+	/*!
+	 * @brief 到達可能性の表を全て作り直します
+	 */
+	void rebuildReach();
+
+	/*!
+	 * @brief 指定ノードからの到達可能性の行を作り直します
+	 */
+	void rebuildReach(int a);
+
+	/*!
+	 * @brief 指定の親の構造に置き換えます
+	 */
+	int restore(vector<vector<int> > *source);
+
+	/*!
+	 * @brief 構造全体のスコア(家族スコアの和)を返します
+	 */
+	double total();
+
+};
+
+#endif /* COMPOSITECLIMB_H_ */
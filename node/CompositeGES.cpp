@@ -0,0 +1,292 @@
+//============================================================================
+// Name        : CompositeGES.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeGES.h"
+#include "BayesianTrace.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief 子毎の最良の操作を並列に求める処理を定義します
+ */
+struct CompositeGESEvaluate {
+	CompositeGES *ges;     // 探索
+	bool forward;          // true=挿入、false=削除
+	vector<char> *dirty;   // 子毎の評価し直す必要の有無
+	vector<int> *chosen;   // 子毎の行える最良の操作の位置(結果)
+	volatile long errors;  // 失敗した子の数
+	void operator()(long index, int thread) {
+		if ((*dirty)[index] && ges->evaluate(forward, (int)index) != 0) {
+			__sync_fetch_and_add(&errors, 1);
+			return;
+		}
+		(*chosen)[index] = ges->choose(forward, (int)index);
+	}
+};
+
+/*!
+ * @brief 0からcount-1までの大きさkの組み合わせを辞書順で次に進めます
+ * @return false=最後の組み合わせ
+ */
+static bool nextCombination(vector<int> *pick, int count) {
+	int k = pick->size(), i = k - 1;
+	while (i >= 0 && (*pick)[i] == count - k + i) i--;
+	if (i < 0) return false;
+	(*pick)[i]++;
+	for (int m = i + 1; m < k; m++) (*pick)[m] = (*pick)[m - 1] + 1;
+	return true;
+}
+
+/*!
+ * @brief 前回の親(初回は辺のない構造)から前進段階と後退段階を行い、ノード毎の親を返します
+ */
+int CompositeGES::searchStructure(CHARS *names, vector<CHARS> *found) {
+	// K2スコアは等価なDAGで値が異なり、等価クラスのスコアが定まらない為、利用できません
+	if (score.type == SCORE_K2) {
+		cout << "[CompositeGES::searchStructure]Not Score Equivalent <- " << score.name() << "(use bdeu, bic or aic)" << endl;
+		return 1;
+	}
+	titles = *names;
+	size = titles.size();
+	positions.clear();
+	for (int v = 0; v < size; v++) positions[titles[v]] = v;
+	// 前回の親からCPDAGを作成し、構造全体のスコアを求めます
+	vector<vector<int> > initial(size);
+	double total = 0.0;
+	for (int v = 0; v < size; v++) {
+		for (CHARS::iterator iter = (*found)[v].begin(); iter != (*found)[v].end(); iter++) initial[v].push_back(positions[*iter]);
+		double p;
+		if (familyScore(v, &initial[v], &p) != 0) return 1;
+		total += p;
+	}
+	complete(&initial);
+	TRACE(TRACE_INFO, "[CompositeGES::searchStructure]Initial Score <- " << total);
+	// 前進段階(挿入)、後退段階(削除)の順に、最良の操作を改善しなくなるまで行います
+	for (int phase = 0; phase < 2; phase++) {
+		bool forward = (phase == 0);
+		moves.assign(size, vector<CompositeGESMove>());
+		vector<char> dirty(size, 1);
+		long step = 0, evaluated = 0;
+		for (; step < steps; step++) {
+			vector<int> chosen(size, -1);
+			CompositeGESEvaluate work;
+			work.ges     = this;
+			work.forward = forward;
+			work.dirty   = &dirty;
+			work.chosen  = &chosen;
+			work.errors  = 0;
+			parallel(threads, size, &work);
+			if (work.errors != 0) {
+				cout << "[CompositeGES::searchStructure]could not evaluate " << work.errors << " nodes" << endl;
+				return 2;
+			}
+			for (int v = 0; v < size; v++) evaluated += dirty[v];
+			// 差分スコアが最も大きい操作を選びます(同じ場合は番号の小さい子とします)
+			int y = -1;
+			for (int v = 0; v < size; v++) {
+				if (chosen[v] >= 0 && (y < 0 || moves[v][chosen[v]].gain > moves[y][chosen[y]].gain)) y = v;
+			}
+			if (y < 0) break;
+			CompositeGESMove move = moves[y][chosen[y]];
+			vector<vector<char> > previous(graph);
+			if (apply(forward, move.x, y, &move.subset) != 0) return 3;
+			total += move.gain;
+			TRACE(TRACE_DETAIL, "[CompositeGES::searchStructure]" << (forward ? "Insert " : "Delete ") << titles[move.x] << "->" << titles[y] << " <- " << total);
+			// 親、隣接ノードの印が変化した子と、辺を変えた2ノードを隣接ノードに持つ子のみ評価し直します
+			for (int v = 0; v < size; v++) {
+				dirty[v] = (v == move.x || v == y);
+				for (int a = 0; a < size && !dirty[v]; a++) {
+					if (graph[a][v] != previous[a][v] || graph[v][a] != previous[v][a]) dirty[v] = 1;
+					else if ((a == move.x || a == y) && (graph[a][v] || graph[v][a])) dirty[v] = 1;
+				}
+			}
+		}
+		TRACE(TRACE_INFO, "[CompositeGES::searchStructure]" << (forward ? "Forward" : "Backward") << " Steps=" << step << " Evaluated=" << evaluated << " Score <- " << total);
+	}
+	// CPDAGと整合するDAGを返します
+	if (extend(&titles, &graph, found) != 0) {
+		TRACE(TRACE_INFO, "[CompositeGES::searchStructure]Inconsistent CPDAG, Completed by Node Order");
+	}
+	return 0;
+}
+
+/*!
+ * @brief 操作の差分スコアの降順の比較を定義します(同じ場合は求めた順とします)
+ */
+static bool greaterGain(const CompositeGESMove &a, const CompositeGESMove &b) {
+	return a.gain > b.gain;
+}
+
+/*!
+ * @brief 子yを対象とする操作のうち、スコアが改善するものを差分スコアの降順に求めます(半有向路の条件は判定しません)
+ */
+int CompositeGES::evaluate(bool forward, int y) {
+	// yの親(有向辺)と隣接ノード(無向辺)を求めます
+	vector<int> parents, neighbors;
+	for (int p = 0; p < size; p++) {
+		if (p == y || !graph[p][y]) continue;
+		if (graph[y][p]) neighbors.push_back(p);
+		else parents.push_back(p);
+	}
+	vector<CompositeGESMove> &result = moves[y];
+	result.clear();
+	for (int u = 0; u < size; u++) {
+		if (u == y) continue;
+		if (forward ? adjacent(u, y) || !allowed(titles[y], titles[u], 0) : !graph[u][y]) continue;
+		// NA(yの隣接ノードでuと隣接するもの)と、向きを変える候補(挿入はuと隣接しないもの、削除はNA)に分けます
+		vector<int> common, others;
+		for (vector<int>::iterator iter = neighbors.begin(); iter != neighbors.end(); iter++) {
+			if (*iter == u) continue;
+			if (adjacent(*iter, u)) common.push_back(*iter);
+			else others.push_back(*iter);
+		}
+		if (forward && !clique(&common)) continue;
+		vector<int> &pool = (forward ? others : common);
+		int limit = (subsets < 0 || subsets > (int)pool.size() ? pool.size() : subsets);
+		for (int k = 0; k <= limit; k++) {
+			vector<int> pick(k);
+			for (int m = 0; m < k; m++) pick[m] = m;
+			do {
+				// 挿入はNA∪T、削除はNA\Hをyの親に加えた家族を比較します
+				CompositeGESMove move;
+				move.x = u;
+				for (int m = 0; m < k; m++) move.subset.push_back(pool[pick[m]]);
+				if (forward) {
+					move.kept = common;
+					move.kept.insert(move.kept.end(), move.subset.begin(), move.subset.end());
+				} else {
+					for (vector<int>::iterator iter = common.begin(); iter != common.end(); iter++) {
+						if (find(move.subset.begin(), move.subset.end(), *iter) == move.subset.end()) move.kept.push_back(*iter);
+					}
+				}
+				if (!clique(&move.kept)) continue;
+				vector<int> family(parents);
+				family.insert(family.end(), move.kept.begin(), move.kept.end());
+				if (!forward) family.erase(remove(family.begin(), family.end(), u), family.end());
+				if (forward && maxParents > 0 && (int)family.size() + 1 > maxParents) continue;
+				double without, with;
+				if (familyScore(y, &family, &without) != 0) return 1;
+				family.push_back(u);
+				if (familyScore(y, &family, &with) != 0) return 2;
+				move.gain = (forward ? with - without : without - with);
+				if (move.gain > GES_EPSILON) result.push_back(move);
+			} while (nextCombination(&pick, pool.size()));
+		}
+	}
+	stable_sort(result.begin(), result.end(), greaterGain);
+	return 0;
+}
+
+/*!
+ * @brief 子yの操作のうち、現在のCPDAGで行える最良の操作の位置を返します(ない場合は-1)
+ */
+int CompositeGES::choose(bool forward, int y) {
+	vector<CompositeGESMove> &list = moves[y];
+	if (!forward) return (list.empty() ? -1 : 0);
+	// 挿入はyからxへの半有向路が全てNA∪Tを通る場合のみ行えます
+	vector<char> blocked(size, 0);
+	for (unsigned int i = 0; i < list.size(); i++) {
+		for (vector<int>::iterator iter = list[i].kept.begin(); iter != list[i].kept.end(); iter++) blocked[*iter] = 1;
+		bool cycle = reachable(y, list[i].x, &blocked);
+		for (vector<int>::iterator iter = list[i].kept.begin(); iter != list[i].kept.end(); iter++) blocked[*iter] = 0;
+		if (!cycle) return i;
+	}
+	return -1;
+}
+
+/*!
+ * @brief 操作を行い、CPDAGに戻します
+ */
+int CompositeGES::apply(bool forward, int x, int y, vector<int> *subset) {
+	if (forward) {
+		// x->yを加え、T-yをT->yとします
+		graph[x][y] = 1, graph[y][x] = 0;
+		for (vector<int>::iterator iter = subset->begin(); iter != subset->end(); iter++) graph[*iter][y] = 1, graph[y][*iter] = 0;
+	} else {
+		// x-y(x->y)を削除し、y-H、x-Hをそれぞれy->H、x->Hとします
+		graph[x][y] = graph[y][x] = 0;
+		for (vector<int>::iterator iter = subset->begin(); iter != subset->end(); iter++) {
+			if (undirected(y, *iter)) graph[*iter][y] = 0;
+			if (undirected(x, *iter)) graph[*iter][x] = 0;
+		}
+	}
+	// DAGに拡張してからCPDAGに戻します(有効な操作の後は常に拡張できます)
+	vector<CHARS> names;
+	if (extend(&titles, &graph, &names) != 0) {
+		TRACE(TRACE_INFO, "[CompositeGES::apply]Inconsistent PDAG <- " << titles[x] << "->" << titles[y]);
+	}
+	vector<vector<int> > parents(size);
+	for (int v = 0; v < size; v++) {
+		for (CHARS::iterator iter = names[v].begin(); iter != names[v].end(); iter++) parents[v].push_back(positions[*iter]);
+	}
+	complete(&parents);
+	return 0;
+}
+
+/*!
+ * @brief ノード毎の親(DAG)からCPDAGを作成します(v構造の辺を残し、Meekの規則で向きを伝播します)
+ */
+void CompositeGES::complete(vector<vector<int> > *parents) {
+	graph.assign(size, vector<char>(size, 0));
+	for (int v = 0; v < size; v++) {
+		for (vector<int>::iterator iter = (*parents)[v].begin(); iter != (*parents)[v].end(); iter++) graph[*iter][v] = graph[v][*iter] = 1;
+	}
+	// 互いに隣接しない2つの親を持つ子への辺(v構造)のみ向きを決めます
+	for (int v = 0; v < size; v++) {
+		vector<int> &line = (*parents)[v];
+		for (unsigned int i = 0; i < line.size(); i++) {
+			for (unsigned int j = i + 1; j < line.size(); j++) {
+				if (adjacent(line[i], line[j])) continue;
+				graph[v][line[i]] = graph[v][line[j]] = 0;
+			}
+		}
+	}
+	propagate(&graph);
+}
+
+/*!
+ * @brief 指定の集合がクリークか否かを返します
+ */
+bool CompositeGES::clique(vector<int> *nodes) {
+	for (unsigned int i = 0; i < nodes->size(); i++) {
+		for (unsigned int j = i + 1; j < nodes->size(); j++) {
+			if (!adjacent((*nodes)[i], (*nodes)[j])) return false;
+		}
+	}
+	return true;
+}
+
+/*!
+ * @brief 遮断集合を通らずにyからxへの半有向路があるか否かを返します
+ */
+bool CompositeGES::reachable(int y, int x, vector<char> *blocked) {
+	vector<char> seen(size, 0);
+	vector<int> stack(1, y);
+	seen[y] = 1;
+	while (!stack.empty()) {
+		int a = stack.back();
+		stack.pop_back();
+		for (int b = 0; b < size; b++) {
+			// 有向辺a->b、無向辺a-bのみを辿ります
+			if (!graph[a][b] || seen[b] || (*blocked)[b]) continue;
+			if (b == x) return true;
+			seen[b] = 1;
+			stack.push_back(b);
+		}
+	}
+	return false;
+}
+
+/*!
+ * @brief 親集合の家族スコアを返します
+ */
+int CompositeGES::familyScore(int y, vector<int> *parents, double *result) {
+	CHARS names;
+	for (vector<int>::iterator iter = parents->begin(); iter != parents->end(); iter++) names.push_back(titles[*iter]);
+	if (getScore(titles[y], &names, result) != 0) {
+		cout << "[CompositeGES::familyScore]Function of getScore Failure" << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+//============================================================================
+// Name        : CompositeGES.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITEGES_H_
+#define COMPOSITEGES_H_
+
+#include "CompositeStructure.h"
+
+/*!
+ * @brief 探索の既定値を定義します
+ */
+#define GES_SUBSETS -1     // 操作で向きを変える隣接ノードの集合(T、H)の最大の大きさ(負の場合は無制限)
+#define GES_STEPS   100000 // 段階毎の最大操作数
+
+/*!
+ * @brief スコアの改善とみなす最小の差を定義します
+ */
+#define GES_EPSILON 1e-9
+
+/*!
+ * @brief 操作(子を除く辺の始点、向きを変える隣接ノードの集合、差分スコア)を定義します
+ */
+struct CompositeGESMove {
+	int x;              // 辺の始点
+	vector<int> subset; // 向きを変える隣接ノードの集合(挿入はT、削除はH)
+	vector<int> kept;   // 挿入の場合に半有向路を遮断する集合(NA∪T)
+	double gain;        // 差分スコア
+};
+
+/*!
+ * @brief 等価クラス(CPDAG)上の貪欲探索(GES)で構造を学習します
+ * 前進段階では辺の挿入(Insert)、後退段階では辺の削除(Delete)のうちスコアが最も改善する操作を、改善しなくなるまで繰り返します
+ * 操作毎の差分スコアは子の家族スコアの差のみで求まる為、共有の家族スコアキャッシュを参照し、子を単位として並列に評価します
+ * 子毎に改善する操作を差分スコアの順に保持し、操作で親、隣接ノードが変化した子のみ評価し直します
+ * 挿入の可否(半有向路の条件)は構造全体に依存する為、選択時にその時点のCPDAGで判定します
+ * 操作の後はDAGに拡張してCPDAGに戻し、最後にCPDAGと整合するDAGを構造定義ファイルに書き出します
+ * ノード順序に依存せず、データ数が十分な場合は真の構造の等価クラスに収束します
+ * 等価なDAGが同じスコアとなる(スコア等価な)BDeu、BIC、AICを前提とする為、既定のスコアはBDeuとし、K2スコアはエラーとします
+ */
+class CompositeGES : public CompositeStructure {
+	friend struct CompositeGESEvaluate;
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeGES();
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositeGES(ProbabilityBase *target) : CompositeStructure(target) {
+		subsets = GES_SUBSETS;
+		steps   = GES_STEPS;
+		size    = 0;
+		score.type = SCORE_BDEU;
+	}
+
+public:
+	/*!
+	 * @brief 操作で向きを変える隣接ノードの集合の最大の大きさを保持します(負の場合は無制限)
+	 * 上限を設けると一部の操作を評価しない為、探索は厳密なGESではなくなります(隣接ノードの多いデータで探索時間を抑える場合に指定します)
+	 */
+	int subsets;
+
+	/*!
+	 * @brief 段階毎の最大操作数を保持します
+	 */
+	long steps;
+
+protected:
+	/*!
+	 * @brief ノード名集合を保持します
+	 */
+	CHARS titles;
+
+	/*!
+	 * @brief ノード数を保持します
+	 */
+	int size;
+
+	/*!
+	 * @brief ノード名毎のノード番号を保持します
+	 */
+	map<string, int> positions;
+
+	/*!
+	 * @brief CPDAG(graph[i][j]=1でiからjへの印、両方向の場合は無向辺)を保持します
+	 */
+	vector<vector<char> > graph;
+
+	/*!
+	 * @brief 子毎の改善する操作(差分スコアの降順)を保持します
+	 */
+	vector<vector<CompositeGESMove> > moves;
+
+protected:
+	/*!
+	 * @brief 前回の親(初回は辺のない構造)から前進段階と後退段階を行い、ノード毎の親を返します
+	 */
+	int searchStructure(CHARS *names, vector<CHARS> *found);
+
+	/*!
+	 * @brief 子yを対象とする操作のうち、スコアが改善するものを差分スコアの降順に求めます(半有向路の条件は判定しません)
+	 * @param[in] bool true=挿入、false=削除
+	 * @param[in] int  子のノード番号
+	 * @return 0=正常終了
+	 */
+	int evaluate(bool forward, int y);
+
+	/*!
+	 * @brief 子yの操作のうち、現在のCPDAGで行える最良の操作の位置を返します(ない場合は-1)
+	 */
+	int choose(bool forward, int y);
+
+	/*!
+	 * @brief 操作を行い、CPDAGに戻します
+	 */
+	int apply(bool forward, int x, int y, vector<int> *subset);
+
+	/*!
+	 * @brief ノード毎の親(DAG)からCPDAGを作成します(v構造の辺を残し、Meekの規則で向きを伝播します)
+	 */
+	void complete(vector<vector<int> > *parents);
+
+	/*!
+	 * @brief 指定の集合がクリークか否かを返します
+	 */
+	bool clique(vector<int> *nodes);
+
+	/*!
+	 * @brief 遮断集合を通らずにyからxへの半有向路があるか否かを返します
+	 */
+	bool reachable(int y, int x, vector<char> *blocked);
+
+	/*!
+	 * @brief 親集合の家族スコアを返します
+	 */
+	int familyScore(int y, vector<int> *parents, double *result);
+
+	/*!
+	 * @brief aとbが隣接するか否かを返します
+	 */
+	inline bool adjacent(int a, int b) { return graph[a][b] || graph[b][a]; }
+
+	/*!
+	 * @brief aとbが無向辺で結ばれているか否かを返します
+	 */
+	inline bool undirected(int a, int b) { return graph[a][b] && graph[b][a]; }
+
+};
+
+#endif /* COMPOSITEGES_H_ */
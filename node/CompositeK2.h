@@ -6,8 +6,7 @@
 #ifndef COMPOSITEK2_H_
 #define COMPOSITEK2_H_
 
-#include "BayesianDefine.h"
-#include "ProbabilityBase.h"
+#include "CompositeStructure.h"
 
 /*!
  * @brief 基本精度浮動小数点を定めます
@@ -16,73 +15,66 @@
 #define CEPS __DBL_EPSILON__
 
 /*!
- * @brief K2アルゴリズムを用いて実データからBDMが最も高いネットワーク構造定義ファイルを作成します
+ * @brief K2アルゴリズムを用いて実データからスコア(既定はBDM)が最も高いネットワーク構造定義ファイルを作成します
+ * スコアはscore.parseで選択します(k2、bdeu、bic、aic)
  */
-class CompositeK2 {
+class CompositeK2 : public CompositeStructure {
     //friend class CompositeBase;
-
-private:
-	/*!
-	 * @brief 読み込み実データ
-	 */
-	ProbabilityBase *base;
+	friend struct CompositeK2Search;
 
 private:
 	/*!
 	 * @brief 初期処理
 	 */
-	CompositeK2() {}
+	CompositeK2();
 
 public:
 	/*!
 	 * @brief 処理対象実データを必須とします
 	 */
-	CompositeK2(ProbabilityBase *target) {
-		base = target;
-	}
-
-public:
-	/*!
-	 * @brief 指定実データからネットワーク構造を作成し、その定義をファイル出力します
-	 */
-	int createNodeRelation();
+	CompositeK2(ProbabilityBase *target) : CompositeStructure(target) {}
 
 protected:
 	/*!
-	 * @brief 階乗計算処理
+	 * @brief 列の順序をノード順序として、子毎の親をK2で確定します(前回の親は用いません)
 	 */
-	inline void reduce(double s, double *r);
+	int searchStructure(CHARS *titles, vector<CHARS> *parents);
 
 	/*!
-	 * @brief 既に親子関係が決定されている組(自ノードのみ含む)と親との成績を計算して返します
+	 * @brief 元集合から対象となる親集合を取得します(親候補を事前選択した場合はその候補のみとします)
 	 */
-	inline double calcBDM(double q, double r, vector<double> *nj, PROBS *nk, COND *calc, double *result);
+	int getParents(string current, CHARS *titles, CHARS *parents);
 
 	/*!
-	 * @brief 親子関係をその定義ファイルに書き出します
+	 * @brief 1つの子について、K2アルゴリズム(forward型)で親を貪欲に確定します
+	 * 子毎の探索は独立している為、子を単位として並列に呼び出します(親の数はmaxParentsまでとします)
+	 * @param[in]  string 子のノード名
+	 * @param[in]  CHARS* ノード名集合(子より前のノードが親候補です)
+	 * @param[in]  double 子の状態数
+	 * @param[in]  double 親なしのスコア(対数)
+	 * @param[out] CHARS* 確定した親
 	 */
-	int createNodeDefine(string file, RELATES *relations, vector<string> *titles);
+	int searchParents(string child, CHARS *titles, double r, double p, CHARS *result);
 
 	/*!
-	 * @brief 元集合から対象となる親集合を取得します
+	 * @brief 指定の順序でi番目のノードの親を確定し、その家族スコアを返します(順序探索から呼び出します)
+	 * @param[in]  CHARS*  ノード順序
+	 * @param[in]  int     対象ノードの位置
+	 * @param[out] CHARS*  確定した親
+	 * @param[out] double* 家族スコア(対数)
 	 */
-	int getParents(string current, CHARS *titles, CHARS *parents);
+	int learnNode(CHARS *order, int i, CHARS *parents, double *score);
 
 	/*!
-	 * @brief 親集合に関して全てのBDMを算出します
+	 * @brief 親集合に関して全てのスコア(対数)を算出します(算出済みの家族はキャッシュから返します)
 	 */
 	int calParentBDM(CHARS *current, string target, double r, CHARS::iterator b, CHARS::iterator e, PROBS *result);
 
 	/*!
-	 * @brief 自身のBDMを算出します
+	 * @brief 自身の状態数と親なしのスコア(対数)を算出します
 	 */
 	int calSelfBDM(string current, double *r, double *result);
 
-	/*!
-	 * @brief 親決定済みと親候補から親対象を自身の親としてよいかその条件の組を作成します
-	 */
-	int calPPattern(string current, COND *cond, PROBS *probs, CHARS::iterator bn, CHARS::iterator on, bool f);
-
 };
 
 #endif /* COMPOSITEK2_H_ */
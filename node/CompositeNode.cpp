@@ -4,6 +4,9 @@
 // Description : Bayesian Network Processing in C++, Ansi-style
 //============================================================================
 #include "CompositeNode.h"
+#include "CompositeWork.h"
+#include "BayesianProfile.h"
+#include "BayesianTrace.h"
 
 /*!
  * @brief ノードの名前と全データ処理への参照を必須引数とします
@@ -15,18 +18,39 @@ CompositeNode::CompositeNode(string name, ProbabilityBase *cpt) {
 	// 基本情報を保持します
 	this->name   = name;  // 自身の名前
 	this->cpt    = cpt;   // 確率への参照
+	this->id     = 0;     // ノード番号(構築時に設定します)
     this->depth  = 0;     // ネットワーク上所属する階層レベル
-	// メッセージ受信を可能とします
-	this->recv   = true;  // true=受信可能状態
-	// 初期化処理を行います
+	// 条件付き確率表は必要になった時点で展開します
+	this->compiled = false;
+	this->model    = NODE_TABLE;
+	this->values   = NULL;
+	this->cells    = 0;
+	// 事前確率は全列走査となる為、materializeで求めます
+	this->materialized = false;
+	this->component    = 0;
+}
+
+/*!
+ * @brief 事前確率と要素名を求めます(未作成の場合のみ)
+ * 複数ノードを並列に処理する場合は、事前に対象列の一意値キャッシュを作成して下さい
+ */
+int CompositeNode::materialize() {
+	if (materialized) return 0;
 	// 事前確率を求めます
 	long total;
-	cpt->prob(name, &prior, &total);
+	prior.clear();
+	elements.clear();
+	if (cpt->prob(name, &prior, &total) != 0) {
+		TRACE(TRACE_ERROR, "\t" << name << " could not materialize prior(materialize:1)");
+		return 1;
+	}
 	// 要素名を作成します
 	for (PROBS::iterator iter = prior.begin(); iter != prior.end(); iter++) {
 		this->elements.push_back(iter->first);
 		iter->second /= total; // 件数から確率への変換
 	}
+	materialized = true;
+	return 0;
 }
 
 /*!
@@ -48,554 +72,753 @@ int CompositeNode::addChild(CompositeNode *node) {
 }
 
 /*!
- * @brief 該当する事前確率を返します
- * @param[in]  string  対象要素名
- * @param[out] double* 該当事前確率
+ * @brief 全ての親の状態の組について条件付き確率表を展開します
  */
-int CompositeNode::calPrior(string target, UD *result) {
-	// 指定要素の事前確率を求めます
-	PROBS::iterator iter = prior.find(target);
-	if (iter == prior.end()) return 1;
-	*result = iter->second;
-	return 0;
+int CompositeNode::compile() {
+	if (compiled) return 0;
+	unsigned int size = elements.size();
+	table.clear();
+	// 親がない場合は事前確率を展開します
+	if (parentNodes.empty()) {
+		for (CHARS::iterator iter = elements.begin(); iter != elements.end(); iter++) {
+			table.push_back(prior[*iter]);
+		}
+		values = &table[0];
+		cells  = table.size();
+		compiled = true;
+		return 0;
+	}
+	// 雑音付きOR/MAXは親の状態の組を展開せずに母数のみ求めます
+	if (model != NODE_TABLE) return compileNoisy();
+	// 行番号の桁の重みを求めます(先頭の親を上位桁とします)
+	vector<CompositeNode*> &pnodes = parentNodes;
+	strides.assign(pnodes.size(), 1);
+	for (int i = (int)pnodes.size() - 2; i >= 0; i--) {
+		strides[i] = strides[i + 1] * pnodes[i + 1]->elements.size();
+	}
+	// 親の状態の組を桁上げにより列挙します
+	vector<unsigned int> states(pnodes.size(), 0);
+	vector<long> totals;
+	while (true) {
+		COND cond;
+		for (unsigned int i = 0; i < pnodes.size(); i++) {
+			cond.push_back(COND_PAIR(pnodes[i]->name, pnodes[i]->elements[states[i]]));
+		}
+		// 条件付き確率を求めます(該当件数0の場合は一様分布となります)
+		PROBS result; long total;
+		if (cpt->prob(name, &cond, &result, &total) != 0) {
+			TRACE(TRACE_ERROR, "\t" << name << " could not compile cpt(compile:1)");
+			table.clear();
+			return 1;
+		}
+		for (unsigned int k = 0; k < size; k++) {
+			PROBS::iterator iter = result.find(elements[k]);
+			table.push_back((iter == result.end() || total == 0) ? 0.0 : iter->second / total);
+		}
+		totals.push_back(total);
+		// 次の状態の組に進めます
+		int digit = pnodes.size() - 1;
+		while (digit >= 0 && ++states[digit] >= pnodes[digit]->elements.size()) {
+			states[digit] = 0;
+			digit--;
+		}
+		if (digit < 0) break;
+	}
+	values = &table[0];
+	cells  = table.size();
+	compiled = true;
+	// 同一の行が多い場合は決定木にまとめます
+	return compileTree(totals);
 }
 
 /*!
- * @brief 条件付き確率を求めます
+ * @brief 展開済みの条件付き確率表の同一(TREE_TOLERANCE以内)の行をまとめて決定木とします
+ * 決定木が十分に小さい場合(TREE_RATIO)のみ表を置き換えます
+ * @param[in] vector<long>& 行毎の実データの件数(まとめた葉の確率の重み)
  */
-int CompositeNode::calCpt(string parent, string statep, string statec, UD *result) {
-	// 検索条件を親ノード名=親ノード状態名とします
-	COND cond;
-	cond.push_back(COND_PAIR(parent, statep));
-	// 確率を取得します
-	PROBS probs; long total;
-	cpt->prob(name, &cond, &probs, &total);
-	// 該当する自分の状態の確率を返します
-	PROBS::iterator iter = probs.find(statec);
-	if (iter == probs.end()) *result = 0.0; // 該当なし時は確率0です
-	else *result = iter->second / total;
-#ifdef VERBOSE
-	cout << "[CompositeNode::calCpt][TargetNode=" << name << "]" << "P(" << name << "=" << statec
-		 << "|" << parent << "=" << statep << ")=" << *result << endl;
-#endif
+int CompositeNode::compileTree(vector<long> &totals) {
+	if (parentNodes.empty()) return 0;
+	unsigned int size = elements.size();
+	map<vector<UD>, int> leaves;
+	tree.clear();
+	compileTree(totals, &leaves, 0, 0, cells / size);
+	// 決定木と葉の大きさが表の一定割合未満の場合のみ置き換えます
+	double bytes = tree.size() * sizeof(int) + leaves.size() * size * sizeof(UD);
+	if (bytes >= cells * sizeof(UD) * TREE_RATIO) {
+		tree.clear();
+		return 0;
+	}
+	vector<UD> shared(leaves.size() * size);
+	for (map<vector<UD>, int>::iterator iter = leaves.begin(); iter != leaves.end(); iter++) {
+		copy(iter->first.begin(), iter->first.end(), shared.begin() + iter->second * size);
+	}
+	TRACE(TRACE_DEBUG, "[CompositeNode::compileTree]" << name << " " << cells / size << " rows -> " << leaves.size() << " leaves");
+	table.swap(shared);
+	values = &table[0];
+	cells  = table.size();
+	model  = NODE_TREE;
 	return 0;
 }
 
 /*!
- * @brief πエビデンスを計算します
+ * @brief 決定木の1区間(先頭からdepth個の親の状態が等しい行)を葉又は分岐として追加し、その位置を返します
+ * 区間の全ての行の差が許容差以内の場合は、件数で重み付けした平均を葉とし、同じ確率の葉は共有します
+ */
+int CompositeNode::compileTree(vector<long> &totals, map<vector<UD>, int> *leaves, unsigned int depth, unsigned long first, unsigned long count) {
+	unsigned int size = elements.size();
+	int position = tree.size();
+	const UD *head = &values[first * size];
+	bool same = true, leaf = true;
+	vector<UD> mean(size, 0.0);
+	UD weight = 0.0;
+	for (unsigned long row = first; row < first + count && leaf; row++) {
+		const UD *probs = &values[row * size];
+		for (unsigned int k = 0; k < size; k++) {
+			UD difference = fabs(probs[k] - head[k]);
+			if (difference > 0.0) same = false;
+			if (difference > TREE_TOLERANCE) leaf = false;
+			mean[k] += totals[row] * probs[k];
+		}
+		weight += totals[row];
+	}
+	if (leaf) {
+		if (same || weight <= 0.0) mean.assign(head, head + size);
+		else for (unsigned int k = 0; k < size; k++) mean[k] /= weight;
+		int index = leaves->insert(pair<vector<UD>, int>(mean, leaves->size())).first->second;
+		tree.push_back(-(index + 1));
+		return position;
+	}
+	// 次の親の状態で分岐します
+	unsigned int psize = parentNodes[depth]->elements.size();
+	unsigned long block = count / psize;
+	tree.push_back(depth);
+	tree.resize(tree.size() + psize, 0);
+	for (unsigned int u = 0; u < psize; u++) {
+		int child = compileTree(totals, leaves, depth + 1, first + u * block, block);
+		tree[position + 1 + u] = child;
+	}
+	return position;
+}
+
+/*!
+ * @brief 実データの親毎の条件付き件数から雑音付きOR/MAXの母数を求めます
+ * 親が互いに独立であるとみなし、Qi(y|u)=F(y|Ui=u)/F(y|Ui=正常状態)、QL(y)=F(y)/ΠE[Qi(y|Ui)]とします
+ * yは自身の状態の程度の順(degreeOrder)の位置とし、親の正常状態は自身が最も低い程度となる割合が最大の親の状態とします
  */
-int CompositeNode::calEviPai() {
-	// 全ての親からのπメッセージを積算します、つまりΠπX(Ui)を求めます
-	if (parents.empty()) {
-		// 親が存在しない為、事前確率の積算を解とします
-		for (CHARS::iterator iter2 = elements.begin(); iter2 != elements.end(); iter2++) {
-			PROBS::iterator iter3 = prior.find(*iter2);
-			if (iter3 == prior.end()) {
-				printf("\t%s has not prior prob for %s(calEviPai:3)\n", name.c_str(), iter2->c_str());
-				return 3;
+int CompositeNode::compileNoisy() {
+	unsigned int size = elements.size();
+	model = (size == 2 ? NODE_NOISY_OR : NODE_NOISY_MAX);
+	table.clear();
+	// 程度の順を状態番号に変換します(指定がない場合は2状態のノードのみ要素名の順とします)
+	degrees.clear();
+	if (degreeOrder.empty() && size != 2) {
+		TRACE(TRACE_ERROR, "\t" << name << " needs the order of states for noisy-MAX(compileNoisy:2)");
+		return 2;
+	}
+	if (!degreeOrder.empty() && degreeOrder.size() != size) {
+		TRACE(TRACE_ERROR, "\t" << name << " has " << size << " states but the order has " << degreeOrder.size() << "(compileNoisy:3)");
+		return 3;
+	}
+	for (unsigned int y = 0; y < size; y++) {
+		int state = (degreeOrder.empty() ? (int)y : index(degreeOrder[y]));
+		if (state < 0 || find(degrees.begin(), degrees.end(), (unsigned int)state) != degrees.end()) {
+			TRACE(TRACE_ERROR, "\t" << name << " has an unknown or duplicated state in the order <- " << degreeOrder[y] << "(compileNoisy:4)");
+			degrees.clear();
+			return 4;
+		}
+		degrees.push_back(state);
+	}
+	// 自身の周辺累積分布を求めます
+	vector<UD> marginal(size), expect(size, 1.0), rows, weights;
+	UD cumulative = 0.0;
+	for (unsigned int y = 0; y < size; y++) {
+		cumulative += prior[elements[degrees[y]]];
+		marginal[y] = cumulative;
+	}
+	for (unsigned int j = 0; j < parentNodes.size(); j++) {
+		CompositeNode *parent = parentNodes[j];
+		unsigned int psize = parent->elements.size(), normal = 0;
+		rows.assign(psize * size, 0.0);
+		weights.assign(psize, 0.0);
+		// 親の状態毎の累積分布F(y|Ui=u)を求めます(該当件数0の場合は周辺分布とします)
+		for (unsigned int u = 0; u < psize; u++) {
+			COND cond(1, COND_PAIR(parent->name, parent->elements[u]));
+			PROBS result; long total;
+			if (cpt->prob(name, &cond, &result, &total) != 0) {
+				TRACE(TRACE_ERROR, "\t" << name << " could not compile noisy parameters(compileNoisy:1)");
+				table.clear();
+				return 1;
+			}
+			weights[u] = total;
+			UD *row = &rows[u * size];
+			cumulative = 0.0;
+			for (unsigned int y = 0; y < size; y++) {
+				PROBS::iterator iter = result.find(elements[degrees[y]]);
+				if (iter != result.end() && total != 0) cumulative += iter->second / total;
+				row[y] = (total == 0 ? marginal[y] : cumulative);
 			}
-			// 算出した状態毎のπエビデンスを保持します
-			PROBS::iterator statec = eviPai.find(*iter2);
-			if (statec == eviPai.end()) {
-				printf("\t%s not found evi pai %s(calEviPai:4)\n", name.c_str(), iter2->c_str());
-				return 4;
-			} else {
-				statec->second = iter3->second;
-#ifdef VERBOSE
-				cout << "[CompositeNode::calEviPai][TargetNode=" << name << "]P(" << name << "=" << iter3->first << ")="
-					 << iter3->second << "(NoParents→Prior)" << endl;
-#endif
+			if (row[0] > rows[normal * size]) normal = u;
+		}
+		// 正常状態との比を累積確率(単調増加、最大の程度で1)とし、親の分布による期待値を求めます
+		vector<UD> base(rows.begin() + normal * size, rows.begin() + (normal + 1) * size), mean(size, 0.0);
+		UD wsum = 0.0;
+		for (unsigned int u = 0; u < psize; u++) wsum += weights[u];
+		for (unsigned int u = 0; u < psize; u++) {
+			UD *row = &rows[u * size];
+			for (unsigned int y = 0; y < size; y++) {
+				UD q = (base[y] > 0.0 ? row[y] / base[y] : 1.0);
+				if (q > 1.0 || y == size - 1) q = 1.0;
+				if (y > 0 && q < row[y - 1]) q = row[y - 1];
+				row[y] = q;
+				mean[y] += (wsum > 0.0 ? weights[u] / wsum : 1.0 / psize) * q;
 			}
 		}
-		// 正常終了します
+		table.insert(table.end(), rows.begin(), rows.end());
+		for (unsigned int y = 0; y < size; y++) expect[y] *= mean[y];
+	}
+	// 漏れの累積確率を求めます
+	for (unsigned int y = 0; y < size; y++) {
+		UD q = (expect[y] > 0.0 ? marginal[y] / expect[y] : 1.0);
+		if (q > 1.0 || y == size - 1) q = 1.0;
+		if (y > 0 && q < table.back()) q = table.back();
+		table.push_back(q);
+	}
+	values = &table[0];
+	cells  = table.size();
+	compiled = true;
+	return 0;
+}
+
+/*!
+ * @brief 親の状態の組に対する自身の状態毎の条件付き確率を返します
+ * 雑音付きOR/MAXはF(y|u)=QL(y)ΠQi(y|ui)の差分P(y|u)=F(y|u)-F(y-1|u)を求めます
+ * @param[in]  unsigned int* 親毎の状態番号(parentNodesの順)
+ * @param[out] UD*           雑音付きOR/MAXの場合に計算結果を格納する領域(自身の状態数分)
+ * @return 状態毎の条件付き確率の先頭(条件付き確率表の場合は表の行を直接返します)
+ */
+const UD *CompositeNode::conditional(const unsigned int *digits, UD *scratch) {
+	unsigned int size = elements.size();
+	if (model == NODE_TABLE) {
+		unsigned long row = 0;
+		for (unsigned int j = 0; j < parentNodes.size(); j++) row += digits[j] * strides[j];
+		return &values[row * size];
+	}
+	if (model == NODE_TREE) {
+		int position = 0;
+		while (tree[position] >= 0) position = tree[position + 1 + digits[tree[position]]];
+		return &values[(-tree[position] - 1) * size];
+	}
+	// 程度の順の累積確率を状態番号の位置に求め、程度の高い順に差分に置き換えます
+	const UD *q = values;
+	for (unsigned int y = 0; y < size; y++) scratch[degrees[y]] = 1.0;
+	for (unsigned int j = 0; j < parentNodes.size(); j++) {
+		const UD *row = q + digits[j] * size;
+		for (unsigned int y = 0; y < size; y++) scratch[degrees[y]] *= row[y];
+		q += parentNodes[j]->elements.size() * size;
+	}
+	for (int y = size - 1; y >= 0; y--) {
+		UD below = (y > 0 ? scratch[degrees[y - 1]] * q[y - 1] : 0.0);
+		scratch[degrees[y]] = scratch[degrees[y]] * q[y] - below;
+	}
+	return scratch;
+}
+
+/*!
+ * @brief 要素名の配列番号を返します
+ * @param[in] string 要素名
+ * @return 配列番号(存在しない場合は-1)
+ */
+int CompositeNode::index(string element) {
+	// 要素名は事前確率の順(昇順)に並んでいる為、二分探索を行います
+	CHARS::iterator iter = lower_bound(elements.begin(), elements.end(), element);
+	if (iter == elements.end() || *iter != element) return -1;
+	return iter - elements.begin();
+}
+
+/*!
+ * @brief 親の状態の組(先頭の親を上位桁とします)を1つ進めます
+ * @param[in,out] unsigned int*          親毎の状態番号
+ * @param[in]     vector<CompositeNode*> 親ノード
+ */
+static inline void advance(unsigned int *digits, vector<CompositeNode*> &pnodes) {
+	for (int j = (int)pnodes.size() - 1; j >= 0; j--) {
+		if (++digits[j] < pnodes[j]->elements.size()) return;
+		digits[j] = 0;
+	}
+}
+
+/*!
+ * @brief 親の状態の組毎の条件付き確率表を展開して末尾に追加します
+ * @param[out] vector<UD>* 展開した条件付き確率表(compileの表と同順)
+ * @return 0=正常終了(雑音付きOR/MAXは展開しません)
+ */
+int CompositeNode::expand(vector<UD> *result) {
+	if (model == NODE_TABLE) {
+		result->insert(result->end(), values, values + cells);
 		return 0;
 	}
+	if (model != NODE_TREE) return 1;
+	unsigned int size = elements.size();
+	unsigned long rows = 1;
+	for (unsigned int j = 0; j < parentNodes.size(); j++) rows *= parentNodes[j]->elements.size();
+	vector<unsigned int> digits(parentNodes.size(), 0);
+	for (unsigned long row = 0; row < rows; row++) {
+		const UD *probs = conditional(&digits[0], NULL);
+		result->insert(result->end(), probs, probs + size);
+		advance(&digits[0], parentNodes);
+	}
+	return 0;
+}
 
-	// ∑ P(X|U1,...,Un)Ππx(Ui)を求めます(計を求めないのは各状態の確率を保持する為)
-	PROBS probs; COND cond;
-	calCptPai(&cond, &probs, parents.begin(), parents.end(), true);
-	for (PROBS::iterator iter1 = probs.begin(); iter1 != probs.end(); iter1++) {
-		PROBS::iterator statec = eviPai.find(iter1->first);
-		if (statec == eviPai.end()) {
-			printf("\t%s not found evi pai %s(calEviPai:2)\n", name.c_str(), iter1->first.c_str());
-			return 2;
-		} else {
-			statec->second = iter1->second;
-		}
-#ifdef VERBOSE
-		cout << "[CompositeNode::calEviPai][TargetNode=" << name << "]P(" << name << "=" << iter1->first << ")=" << statec->second << endl;
-#endif
+/*!
+ * @brief 決定木の走査に用いる値を定義します
+ */
+struct CompositeWalk {
+	const vector<int> *tree;           // 決定木
+	const UD *values;                  // 葉毎の条件付き確率
+	unsigned int size;                 // 自身の状態数
+	vector<vector<UD> > *messages;     // 親毎のπメッセージ
+	const UD *tails;                   // 深さ毎の未分岐の親のπメッセージの和(最大積の場合は最大値)の積
+	const UD *leaves;                  // 葉毎の∑λ(x)P(x|葉)(λメッセージのみ)
+	UD *result;                        // 計算結果
+	int slot;                          // 受信する親の番号(λメッセージのみ)
+	bool maximum;                      // true=最大積
+};
+
+/*!
+ * @brief 和(最大積の場合は最大値)を集計します
+ */
+static inline void accumulate(UD *target, UD value, bool maximum) {
+	if (maximum) *target = (value > *target ? value : *target);
+	else *target += value;
+}
+
+/*!
+ * @brief 決定木を走査してπエビデンスを集計します
+ * @param[in] CompositeWalk& 走査に用いる値
+ * @param[in] int            決定木の位置
+ * @param[in] unsigned int   深さ(分岐済みの親の数)
+ * @param[in] UD             根からの経路上のπメッセージの積
+ */
+static void walkPai(CompositeWalk &walk, int position, unsigned int depth, UD weight) {
+	const vector<int> &tree = *walk.tree;
+	if (tree[position] < 0) {
+		const UD *probs = &walk.values[(-tree[position] - 1) * walk.size];
+		UD scale = weight * walk.tails[depth];
+		for (unsigned int k = 0; k < walk.size; k++) accumulate(&walk.result[k], probs[k] * scale, walk.maximum);
+		return;
+	}
+	int parent = tree[position];
+	vector<UD> &pai = (*walk.messages)[parent];
+	for (unsigned int u = 0; u < pai.size(); u++) {
+		if (pai[u] != 0.0) walkPai(walk, tree[position + 1 + u], parent + 1, weight * pai[u]);
+	}
+}
+
+/*!
+ * @brief 決定木を走査してλメッセージを集計します
+ * @param[in] CompositeWalk& 走査に用いる値
+ * @param[in] int            決定木の位置
+ * @param[in] unsigned int   深さ(分岐済みの親の数)
+ * @param[in] UD             根からの経路上の受信する親以外のπメッセージの積
+ * @param[in] int            経路上の受信する親の状態(未分岐の場合は-1で全状態に集計します)
+ */
+static void walkLambda(CompositeWalk &walk, int position, unsigned int depth, UD weight, int state) {
+	const vector<int> &tree = *walk.tree;
+	if (tree[position] < 0) {
+		UD value = weight * walk.leaves[-tree[position] - 1] * walk.tails[depth];
+		unsigned int psize = (*walk.messages)[walk.slot].size();
+		if (state >= 0) accumulate(&walk.result[state], value, walk.maximum);
+		else for (unsigned int u = 0; u < psize; u++) accumulate(&walk.result[u], value, walk.maximum);
+		return;
 	}
+	int parent = tree[position];
+	vector<UD> &pai = (*walk.messages)[parent];
+	for (unsigned int u = 0; u < pai.size(); u++) {
+		if (parent == walk.slot) walkLambda(walk, tree[position + 1 + u], parent + 1, weight, u);
+		else if (pai[u] != 0.0) walkLambda(walk, tree[position + 1 + u], parent + 1, weight * pai[u], state);
+	}
+}
+
+/*!
+ * @brief 決定木のπエビデンスを葉毎に計算します(未分岐の親はπメッセージの和で周辺化します)
+ * @param[in] CompositeWork* ワークスペース
+ */
+int CompositeNode::calEviPaiTree(CompositeWork *work) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size(), count = parentNodes.size();
+	ArenaMark mark = work->arena.mark();
+	UD *tails = work->arena.allocate<UD>(count + 1);
+	tails[count] = 1.0;
+	for (int j = (int)count - 1; j >= 0; j--) {
+		UD total = 0.0;
+		for (unsigned int u = 0; u < state.msgPai[j].size(); u++) accumulate(&total, state.msgPai[j][u], work->maximum);
+		tails[j] = tails[j + 1] * total;
+	}
+	for (unsigned int k = 0; k < size; k++) state.eviPai[k] = 0.0;
+	CompositeWalk walk = { &tree, values, size, &state.msgPai, tails, NULL, &state.eviPai[0], -1, work->maximum };
+	walkPai(walk, 0, 0, 1.0);
+	work->arena.release(mark);
 	return 0;
 }
 
 /*!
- * @brief 条件付き確率P(X|Y1,...,Yn)を求めます（実処理）
- * @param[in]  string* 対象ノード名
- * @param[in]  string* 対象ノードの要素名
- * @param[in]  NODE*   対象親ノード
- * @param[in]  CHARS*  対象親ノードの要素
- * @param[out] PROBS*  算出条件付き確率∑n{P(CN=CE|PN1=PE1,...,PNn=PEn)}を保持します
- * @param[in]  bool    初回処理時のみポインタ移動を行いません
+ * @brief 決定木の親へのλメッセージを葉毎に計算します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] int            受信する親の番号(parentNodesの添字)
  */
-int CompositeNode::calCptPai(COND *cond, PROBS *probs, NODES::iterator targetpn, NODES::iterator targetpe, bool first) {
-	// 自身のノードの処理を行います
-	if (!first) targetpn++;
-	if (targetpn == targetpe) {
-		// 条件付き確率を求め、状態毎に合計します
-		PROBS result; long total;
-		cpt->prob(name, cond, &result, &total);
-		// ログ表示用処理
-#ifdef VERBOSE
-		string valuep;
-		for (COND::iterator iter = cond->begin(); iter != cond->end(); iter++) {
-			valuep += iter->first + "=" + iter->second + ",";
-		}
-		valuep.erase(valuep.end() - 1);
-#endif
-		// 指定条件でのπメッセージ積算を求めます
-		UD parentp = 0.0;
-		this->calPaiTotal(cond, &parentp);
-		// 値を代入して返します
-		for (PROBS::iterator iter = result.begin(); iter != result.end(); iter++) {
-			PROBS::iterator targetp = probs->find(iter->first);
-#ifdef VERBOSE
-			cout << "[CompositeNode::calCptPai][TargetNode=" << name << "]P(" << name << "=" << iter->first << "|" << valuep << ")=" << (iter->second / total) << endl;
-#endif
-			double paim = (iter->second / total) * parentp;
-			if (targetp == probs->end()) probs->insert(PROBS_PAIR(iter->first, paim));
-			else targetp->second += (paim);
-		}
-		cond->clear();
-		return 0;
+int CompositeNode::calMsgLambdaTree(CompositeWork *work, int slot) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size(), count = parentNodes.size(), leafs = cells / size;
+	ArenaMark mark = work->arena.mark();
+	UD *tails = work->arena.allocate<UD>(count + 1);
+	UD *leaves = work->arena.allocate<UD>(leafs);
+	tails[count] = 1.0;
+	for (int j = (int)count - 1; j >= 0; j--) {
+		UD total = 0.0;
+		for (unsigned int u = 0; u < state.msgPai[j].size(); u++) accumulate(&total, state.msgPai[j][u], work->maximum);
+		tails[j] = tails[j + 1] * (j == slot ? 1.0 : total);
 	}
-	// 全要素に対して処理を行います
-	CompositeNode *next = targetpn->second;
-	for (CHARS::iterator iter = next->elements.begin(); iter != next->elements.end(); iter++) {
-		COND condc(*cond);
-		condc.push_back(COND_PAIR(next->name, *iter));
-		calCptPai(&condc, probs, targetpn, targetpe, false);
+	// 葉毎にλエビデンスとの積を状態について集計します
+	for (unsigned int l = 0; l < leafs; l++) {
+		leaves[l] = 0.0;
+		for (unsigned int k = 0; k < size; k++) accumulate(&leaves[l], values[l * size + k] * state.eviLambda[k], work->maximum);
 	}
+	vector<UD> &result = state.msgLambda[slot];
+	for (unsigned int u = 0; u < result.size(); u++) result[u] = 0.0;
+	CompositeWalk walk = { &tree, values, size, &state.msgPai, tails, leaves, &result[0], slot, work->maximum };
+	walkLambda(walk, 0, 0, 1.0, -1);
+	work->arena.release(mark);
 	return 0;
 }
 
-/*
- * 親ノードの状態毎のΠメッセージ（ない場合は事前確率）の積算を返します
+/*!
+ * @brief πエビデンス(π(X)=∑P(x|u1,...,un)ΠπX(Ui))を計算します
+ * @param[in] CompositeWork* ワークスペース
  */
-int CompositeNode::calPaiTotal(COND *cond, double *result) {
-	// 自身の親ノードに格納されている全てのπメッセージの積算を求めます
-	UD sumPai = -1.0;
-	for (COND::iterator iter1 = cond->begin(); iter1 != cond->end(); iter1++) {
-		// 対象親ノードを取得します
-		// 対象親ノードの状態名を持つπメッセージを取得します
-		PROBS::iterator iter3 = msgPai.find(iter1->second);
-		if (iter3 == msgPai.end()) {
-			printf("\t%s(%s) not found msg pai for %s->%s(calParent:2)\n",
-					name.c_str(), iter1->first.c_str(), iter1->first.c_str(), iter1->second.c_str());
-			return 2;
+int CompositeNode::calEviPai(CompositeWork *work) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size();
+	if (parentNodes.empty()) {
+		// 親が存在しない為、事前確率を解とします
+		for (unsigned int k = 0; k < size; k++) state.eviPai[k] = values[k];
+		return 0;
+	}
+	if (model == NODE_TREE) return calEviPaiTree(work);
+	if (model != NODE_TABLE && !work->maximum) return calEviPaiNoisy(work);
+	// 親の状態の組毎に、条件付き確率とπメッセージの積を状態毎に合計(最大積の場合は最大値)します
+	unsigned int count = parentNodes.size();
+	unsigned long rows = cells / size;
+	ArenaMark mark = work->arena.mark();
+	unsigned int *digits = work->arena.allocate<unsigned int>(count);
+	UD *scratch = NULL;
+	if (model != NODE_TABLE) {
+		// 最大積は累積確率の積に分解できない為、雑音付きOR/MAXも親の状態の組を列挙します
+		rows = 1;
+		for (unsigned int j = 0; j < count; j++) rows *= parentNodes[j]->elements.size();
+		scratch = work->arena.allocate<UD>(size);
+	}
+	for (unsigned int j = 0; j < count; j++) digits[j] = 0;
+	for (unsigned long row = 0; row < rows; row++) {
+		UD parentp = state.msgPai[0][digits[0]];
+		for (unsigned int j = 1; j < count; j++) parentp *= state.msgPai[j][digits[j]];
+		const UD *probs = (scratch == NULL ? &values[row * size] : conditional(digits, scratch));
+		for (unsigned int k = 0; k < size; k++) {
+			UD paim = probs[k] * parentp;
+			if (row == 0) state.eviPai[k] = paim;
+			else if (work->maximum) state.eviPai[k] = (paim > state.eviPai[k] ? paim : state.eviPai[k]); // 最大積
+			else state.eviPai[k] += paim;
 		}
-		// 積算を求めます
-#ifdef VERBOSE
-		cout << "[CompositeNode::calParent][TargetNode=" << name << "]P(" << iter1->first << "=" << iter1->second << ")=" << iter3->second << endl;
-#endif
-		if (sumPai == -1.0) sumPai = iter3->second;
-		else sumPai *= iter3->second;
-	}
-#ifdef VERBOSE
-	cout << "[CompositeNode::calParent][TargetNode=" << name << "]*P(" << name << ")=" << sumPai << endl;
-#endif
-	*result = sumPai;
+		advance(digits, parentNodes);
+	}
+	work->arena.release(mark);
 	return 0;
 }
 
 /*!
- * @brief λエビデンスを計算します
+ * @brief λエビデンス(λ(X)=ΠλV(X)×尤度)を計算します
+ * @param[in] CompositeWork* ワークスペース
  */
-int CompositeNode::calEviLambda() {
-	// 自身をX、子ノードをVとした場合、ΠλV(X)でλエビデンスを求めます
-	for (CHARS::iterator iter1 = elements.begin(); iter1 != elements.end(); iter1++) {
-		UD sumLambda = -1.0;
-		for (NODES::iterator iter2 = children.begin(); iter2 != children.end(); iter2++) {
-			// 自身の子ノードを探します
-			CompositeNode *target = iter2->second;
-			// λメッセージは子ノードが保持している自分の名前が付けられたλメッセージを取得します
-			PROBS::iterator result = target->msgLambda.find(*iter1);
-			if (result == target->msgLambda.end()) {
-				printf("\t%s not found msg lambda of %s(calEviLambda:1)\n", name.c_str(), iter1->c_str());
-				return 1;
-			}
-			// λメッセージの積算を求めます
-#ifdef VERBOSE
-			cout << "[CompositeNode::calEviLambda][TargetNode=" << name << "]L_" << target->name
-					<< "(" << name << "=" << *iter1 << ")=" << result->second << endl;
-#endif
-			if (sumLambda == -1.0) sumLambda = result->second;
-			else sumLambda *= result->second;
-		}
-		// 値がない場合は子がない為、一様分布1.0を与えます
-		if (sumLambda == -1.0) sumLambda = 1.0;
-		// 自身の状態毎にλエビデンスを保持します
-		PROBS::iterator statec = eviLambda.find(*iter1);
-		if (statec == eviLambda.end()) {
-			printf("\t%s not found evi lambda of %s(calEviLambda:2)\n", name.c_str(), iter1->c_str());
-			return 2;
+int CompositeNode::calEviLambda(CompositeWork *work) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size();
+	for (unsigned int k = 0; k < size; k++) {
+		// 子ノードに保持されている自身へのλメッセージの積を求めます(子がない場合は1.0とします)
+		UD sumLambda = 1.0;
+		for (unsigned int i = 0; i < childNodes.size(); i++) {
+			UD value = work->states[childNodes[i]->id].msgLambda[slots[i]][k];
+			sumLambda = (i == 0 ? value : sumLambda * value);
 		}
-		// 葉ノードの場合、0に初期化してしまう為、計算を行いません
-		statec->second = sumLambda;
-		// ログ出力
-#ifdef VERBOSE
-		cout << "[CompositeNode::calEviLambda][TargetNode=" << name << "]*L(" << name << "=" << *iter1 << ")=" << sumLambda << endl;
-#endif
+		// エビデンスが与えられている場合は、その尤度を積算します
+		if (!state.likelihood.empty()) sumLambda *= state.likelihood[k];
+		state.eviLambda[k] = sumLambda;
 	}
 	return 0;
 }
 
 /*!
  * @brief 事後確率を求めます
+ * @param[in] CompositeWork* ワークスペース
  */
-int CompositeNode::calProb() {
+int CompositeNode::calProb(CompositeWork *work) {
+	CompositeState &state = work->states[id];
 	// 正規化定数を求めます
 	UD normal = 0;
-	calNormal(&normal);
-	// 各状態の事後確率を求めます
-	for (CHARS::iterator iter = elements.begin(); iter != elements.end(); iter++) {
-		// 本ノードの状態のπ(Xi)を取得します
-		PROBS::iterator ep = eviPai.find(*iter);
-		if (ep == eviPai.end()) {
-			printf("\t%s has not pai msg for %s(calProb:1)\n", name.c_str(), (*iter).c_str());
-			return 1;
-		}
-		// 本ノードの状態のλ(Xi)を取得します
-		PROBS::iterator el = eviLambda.find(*iter);
-		if (el == eviLambda.end()) {
-			printf("\t%s has not lambda msg for %s(calProb:2)\n", name.c_str(), (*iter).c_str());
-			return 2;
-		}
-		// αλ(X)π(X)を保持します
-		PROBS::iterator target = posterior.find(*iter);
-		if (target == posterior.end()) {
-			printf("\t%s has not prob(pr) for %s(calProb:3)\n", name.c_str(), (*iter).c_str());
-			return 3;
-		}
-		// 事後確率を更新します
-		target->second = normal * el->second * ep->second;
-#ifdef VERBOSE
-		cout << "[CompositeNode::calProb][TargetNode=" << name << "]Pr(" << name << "=" << *iter << ")="
-				<< normal << "*" << el->second << "*" << ep->second << "=" << target->second << endl;
-#endif
+	calNormal(work, &normal);
+	// αλ(X)π(X)を保持します
+	unsigned int size = elements.size();
+	for (unsigned int k = 0; k < size; k++) {
+		state.posterior[k] = normal * state.eviLambda[k] * state.eviPai[k];
 	}
 	return 0;
 }
 
 /*!
  * @brief 正規化定数を求めます
- * @param[out] double* 本ノードで求められた正規化定数です
+ * @param[in]  CompositeWork* ワークスペース
+ * @param[out] double*        本ノードで求められた正規化定数です
  */
-int CompositeNode::calNormal(UD *result) {
+int CompositeNode::calNormal(CompositeWork *work, UD *result) {
+	CompositeState &state = work->states[id];
 	*result = 0.0;
 	// 全λ(X)とπ(X)の積算を合計します
-	for (CHARS::iterator iter = elements.begin(); iter != elements.end(); iter++) {
-		// 本ノードの状態のπ(Xi)を取得します
-		PROBS::iterator ep = eviPai.find(*iter);
-		if (ep == eviPai.end()) {
-			printf("\t%s has not pai msg for %s(calNormal:1)\n", name.c_str(), (*iter).c_str());
-			return 1;
-		}
-		// 本ノードの状態のλ(Xi)を取得します
-		PROBS::iterator el = eviLambda.find(*iter);
-		if (el == eviLambda.end()) {
-			printf("\t%s has not lambda msg for %s(calNormal:2)\n", name.c_str(), (*iter).c_str());
-			return 2;
-		}
-		*result += (ep->second * el->second);
-#ifdef VERBOSE
-		cout << "[CompositeNode::calNormal][TargetNode=" << name << "]*e=" << ep->second << ",Le=" << el->second << endl;
-#endif
-	}
-#ifdef VERBOSE
-	cout << "[CompositeNode::calNormal][TargetNode=" << name << "]normal=" << *result << endl;
-#endif
+	unsigned int size = elements.size();
+	for (unsigned int k = 0; k < size; k++) {
+		*result += (state.eviPai[k] * state.eviLambda[k]);
+	}
 	// 1.0/Pにより正規化します
 	*result = *result == 0 ? 0 : (1.0 / *result);
 	return 0;
 }
 
 /*!
- * @brief πメッセージを計算します/πメッセージ及びλメッセージは直接対象ノードに代入します
- * @param[in] string 送信ノード名
+ * @brief 子へのπメッセージ(πX(U)=事後確率/λX(U))を計算し、子のワークスペースに格納します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] CompositeNode* 受信する子ノード
+ * @param[in] int            子ノードの親における自身の番号
  */
-int CompositeNode::calMsgPai(string sender) {
-	// ルートノード時は処理しません
-	if (sender == ROOT_NODE) return 0;
-
-	// πメッセージを作成します
-	// πメッセージは子が保持している自分へのλメッセージを取得して、子供に自分の名前でπメッセージを書き込みます
-	// メッセージ格納対象ノードを取得します
-	NODES::iterator result1 = children.find(sender);
-	if (result1 == children.end()) {
-		printf("\t%s not found child node of %s(calMsgPai:4)\n", name.c_str(), sender.c_str());
-		return 4;
-	}
-	CompositeNode *child = result1->second;
+int CompositeNode::calMsgPai(CompositeWork *work, CompositeNode *child, int slot) {
+	CompositeState &state = work->states[id];
+	vector<UD> &lambda = work->states[child->id].msgLambda[slot];
+	vector<UD> &pai = work->states[child->id].msgPai[slot];
+	unsigned int size = elements.size();
+	for (unsigned int k = 0; k < size; k++) {
+		pai[k] = (lambda[k] == 0 ? 0 : (state.posterior[k] / lambda[k]));
+	}
+	return 0;
+}
 
-	// 子ノード内の自分を探し出す
-	for (CHARS::iterator iter2 = elements.begin(); iter2 != elements.end(); iter2++) {
-		// 自身の事後確率を取得します
-		PROBS::iterator ret1 = posterior.find(*iter2);
-		if (ret1 == posterior.end()) {
-			printf("\t%s not found prob of %s(calMsgPai:1)\n", name.c_str(), (*iter2).c_str());
-			return 1;
+/*!
+ * @brief 親へのλメッセージ(λX(Ui)=∑P(x|u1,...,un)λ(x)Ππ(Uk), k≠i)を計算します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] int            受信する親の番号(parentNodesの添字)
+ */
+int CompositeNode::calMsgLambda(CompositeWork *work, int slot) {
+	if (parentNodes.empty()) return 0;
+	if (model == NODE_TREE) return calMsgLambdaTree(work, slot);
+	if (model != NODE_TABLE && !work->maximum) return calMsgLambdaNoisy(work, slot);
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size(), count = parentNodes.size();
+	unsigned int psize = parentNodes[slot]->elements.size();
+	unsigned long rows = cells / size;
+	// 親の状態毎、自身の状態毎に合計(最大積の場合は最大値)します
+	ArenaMark mark = work->arena.mark();
+	UD *sums = work->arena.allocate<UD>(psize * size);
+	unsigned int *digits = work->arena.allocate<unsigned int>(count);
+	UD *scratch = NULL;
+	if (model != NODE_TABLE) {
+		// 最大積は親の状態の組を列挙します(calEviPaiと同様)
+		rows = 1;
+		for (unsigned int j = 0; j < count; j++) rows *= parentNodes[j]->elements.size();
+		scratch = work->arena.allocate<UD>(size);
+	}
+	for (unsigned int i = 0; i < psize * size; i++) sums[i] = 0.0;
+	for (unsigned int j = 0; j < count; j++) digits[j] = 0;
+	for (unsigned long row = 0; row < rows; row++) {
+		// 対象の親以外のπメッセージの積を求めます
+		UD othert = 1.0; bool first = true;
+		for (unsigned int j = 0; j < count; j++) {
+			if ((int)j == slot) continue;
+			othert = (first ? state.msgPai[j][digits[j]] : othert * state.msgPai[j][digits[j]]);
+			first = false;
 		}
-		// 子ノードに格納されている自身のλメッセージを取得します
-		PROBS::iterator ret2 = child->msgLambda.find(*iter2);
-		if (ret2 == child->msgLambda.end()) {
-			printf("\t%s not found msg lambda of %s on %s(calMsgPai:2)\n", name.c_str(), iter2->c_str(), child->name.c_str());
-			return 2;
+		const UD *probs = (scratch == NULL ? &values[row * size] : conditional(digits, scratch));
+		UD *sum = &sums[digits[slot] * size];
+		for (unsigned int k = 0; k < size; k++) {
+			UD paim = probs[k] * state.eviLambda[k] * othert;
+			if (work->maximum) sum[k] = (paim > sum[k] ? paim : sum[k]); // 最大積
+			else sum[k] += paim;
 		}
-		// πメッセージを算出し、子ノードに自身の名前で格納します
-		UD answer = ret2->second == 0 ? 0 : (ret1->second / ret2->second);
-		// 対象以外のノードには算出確率を書き込みません
-		PROBS::iterator temp = child->msgPai.find(*iter2);
-		if (temp == child->msgPai.end()) {
-			printf("\t%s not found msg pai of %s on %s(calMsgPai:3)\n", name.c_str(), iter2->c_str(), child->name.c_str());
-			return 3;
+		advance(digits, parentNodes);
+	}
+	vector<UD> &result = state.msgLambda[slot];
+	for (unsigned int u = 0; u < psize; u++) {
+		UD subtotal = 0.0;
+		for (unsigned int k = 0; k < size; k++) {
+			UD value = sums[u * size + k];
+			if (work->maximum) subtotal = (value > subtotal ? value : subtotal); // 最大積
+			else subtotal += value;
 		}
-		temp->second = answer;
+		result[u] = subtotal;
 	}
-
+	work->arena.release(mark);
 	return 0;
 }
 
 /*!
- * @brief λメッセージを計算します
- * @param[in] string 送信ノード名
+ * @brief 雑音付きOR/MAXのπエビデンスを累積確率の積(F(y)=QL(y)Π∑πX(u)Qi(y|u))から線形時間で計算します
+ * 親は互いにd分離されている為、親の状態の組に関する和は親毎の和の積となり、π(y)=F(y)-F(y-1)となります
+ * @param[in] CompositeWork* ワークスペース
  */
-int CompositeNode::calMsgLambda(string sender) {
-	// ルートノード時は処理しません
-	if (sender == ROOT_NODE) return 0;
-	if (parents.size() <= 0) return 0;
-
-	// 対象ノード用のλメッセージを作成します
-	// λメッセージは親に書き込まれたπメッセージを元に親へのλメッセージを自分に親の名前で書き込みます
-#ifdef VERBOSE
-	cout << "[CompositeNode::calMsgLambda][TargetNode=" << name << "]begin calc for " << name << " by " << sender << endl;
-#endif
-	NODES::iterator partemp1 = parents.find(sender);
-	if (partemp1 == parents.end()) {
-		printf("%s not found parent node of %s(calMsgLambda:5)\n", name.c_str(), sender.c_str());
-		return 5;
-	}
-	// 処理対象ノードを決定します
-	NODES targets;
-	if (parents.size() > 1) {
-		// 複数の場合はその親「以外」を対象に条件付き確率を求めます
-		// 1の場合は以下の処理で親を対象としなくて良い為、対象ノードを設定しません
-		for (NODES::iterator iter = parents.begin(); iter != parents.end(); iter++) {
-			if (iter->second->name != sender) {
-				targets.insert(pair<string, CompositeNode*>(iter->second->name, iter->second));
-			}
+int CompositeNode::calEviPaiNoisy(CompositeWork *work) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size();
+	ArenaMark mark = work->arena.mark();
+	UD *cumulative = work->arena.allocate<UD>(size);
+	for (unsigned int y = 0; y < size; y++) cumulative[y] = 1.0;
+	const UD *q = values;
+	for (unsigned int j = 0; j < parentNodes.size(); j++) {
+		vector<UD> &pai = state.msgPai[j];
+		unsigned int psize = parentNodes[j]->elements.size();
+		for (unsigned int y = 0; y < size; y++) {
+			UD sum = 0.0;
+			for (unsigned int u = 0; u < psize; u++) sum += pai[u] * q[u * size + y];
+			cumulative[y] *= sum;
 		}
+		q += psize * size;
 	}
-
-	// ∑ P(x|u1,...,un)λ(x)部分を求めます
-	CompositeNode *parentn = partemp1->second;
-	for (CHARS::iterator iter1 = parentn->elements.begin(); iter1 != parentn->elements.end(); iter1++) {
-		UD subtotal = 0.0;
-#ifdef VERBOSE
-		cout << "[CompositeNode::calMsgLambda][TargetNode=" << name << "]target-condition->" << partemp1->second->name << "=" << *iter1 << endl;
-#endif
-		PROBS probs; COND cond;
-		cond.push_back(COND_PAIR(parentn->name, *iter1));
-		calCptLambda(*iter1, (targets.size() > 0), &cond, &probs, targets.begin(), targets.end(), true);
-		for (PROBS::iterator iter2 = probs.begin(); iter2 != probs.end(); iter2++) {
-#ifdef VERBOSE
-			cout << "[CompositeNode::calMsgLambda][TargetNode=" << name << "]" << iter2->first << "=" << iter2->second << endl;
-#endif
-			subtotal += iter2->second;
-		}
-#ifdef VERBOSE
-		cout << "[CompositeNode::calMsgLambda][TargetNode=" << name << "]" << partemp1->second->name << "=" << *iter1 << "->" << subtotal << endl;
-#endif
-		PROBS::iterator targetr = msgLambda.find(*iter1);
-		if (targetr == msgLambda.end()) msgLambda.insert(pair<string, UD>(*iter1, subtotal));
-		else targetr->second = subtotal;
+	UD last = 0.0;
+	for (unsigned int y = 0; y < size; y++) {
+		UD f = cumulative[y] * q[y];
+		state.eviPai[degrees[y]] = f - last;
+		last = f;
 	}
+	work->arena.release(mark);
 	return 0;
 }
 
 /*!
- * @brief 条件付き確率P(X|Y1,...,Yn)を求めます（実処理）
- * @param[in]  COND*   			条件付き確率の条件
- * @param[out] PROBS*  			算出条件付き確率∑n{P(CN=CE|PN1=PE1,...,PNn=PEn)}を保持します
- * @param[in]  NODES::iterator  処理開始ポインタ・その１
- * @param[in]  NODES::iterator  処理開始ポインタ・その２
- * @param[in]  bool    初回処理時のみポインタ移動を行いません
+ * @brief 雑音付きOR/MAXの親へのλメッセージを累積確率の積から線形時間で計算します
+ * R(y)=QL(y)Π∑πX(u)Qk(y|u)(k≠i)とし、λX(u)=∑λ(y)(Qi(y|u)R(y)-Qi(y-1|u)R(y-1))とします
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] int            受信する親の番号(parentNodesの添字)
  */
-int CompositeNode::calCptLambda(string parents, bool pai, COND *cond, PROBS *probs, NODES::iterator targetpn, NODES::iterator targetpe, bool first) {
-	// 自身のノードの処理を行います
-	if (!first) targetpn++;
-	if (targetpn == targetpe) {
-		// 条件付き確率を求め、状態毎に合計します
-		PROBS result; long total;
-		cpt->prob(name, cond, &result, &total);
-		// ログ表示用処理
-#ifdef VERBOSE
-		string valuep;
-		for (COND::iterator iter = cond->begin(); iter != cond->end(); iter++) {
-			valuep += iter->first + "=" + iter->second + ",";
-		}
-		valuep.erase(valuep.end() - 1);
-#endif
-		// 自身のノード以外のπメッセージの積算を求めます
-		double othert = -1.0;
-		if (pai) {
-			for (COND::iterator iter = cond->begin(); iter != cond->end(); iter++) {
-				if (iter->second != parents) {
-					// 該当するπメッセージを取得して積を求めます
-					PROBS::iterator ipai = msgPai.find(iter->second);
-					if (ipai == msgPai.end()) {
-						printf("not found pai message(%s=%s) on %s node", iter->first.c_str(), iter->second.c_str(), name.c_str());
-						return 1;
-					}
-#ifdef VERBOSE
-					cout << "[CompositeNode::calCptLambda][TargetNode=" << name << "]Pm(" << iter->first << "=" << iter->second << ")=" << ipai->second << endl;
-#endif
-					if (othert == -1.0) othert = ipai->second;
-					else othert *= ipai->second;
-				}
-			}
-#ifdef VERBOSE
-			cout << "[CompositeNode::calCptLambda][TargetNode=" << name << "]*Pm=" << othert << endl;
-#endif
-		}
-		// 値を代入して返します
-		for (PROBS::iterator iter = result.begin(); iter != result.end(); iter++) {
-			PROBS::iterator targetp = probs->find(iter->first);
-			// 対象ラムダエビデンスを取得します
-			PROBS::iterator parentp = eviLambda.find(iter->first);
-			if (parentp == eviLambda.end()) {
-				printf("not found this lambda evidense(%s)\n", iter->first.c_str());
-				return 1;
+int CompositeNode::calMsgLambdaNoisy(CompositeWork *work, int slot) {
+	CompositeState &state = work->states[id];
+	unsigned int size = elements.size();
+	ArenaMark mark = work->arena.mark();
+	UD *others = work->arena.allocate<UD>(size);
+	for (unsigned int y = 0; y < size; y++) others[y] = 1.0;
+	const UD *q = values, *target = NULL;
+	for (unsigned int j = 0; j < parentNodes.size(); j++) {
+		unsigned int psize = parentNodes[j]->elements.size();
+		if ((int)j == slot) {
+			target = q;
+		} else {
+			vector<UD> &pai = state.msgPai[j];
+			for (unsigned int y = 0; y < size; y++) {
+				UD sum = 0.0;
+				for (unsigned int u = 0; u < psize; u++) sum += pai[u] * q[u * size + y];
+				others[y] *= sum;
 			}
-			//　合計を求めます
-			double paim = iter->second / total * parentp->second * (pai ? othert : 1.0);
-			if (targetp == probs->end()) probs->insert(PROBS_PAIR(iter->first, paim));
-			else targetp->second += (paim);
-#ifdef VERBOSE
-			cout << "[CompositeNode::calCptLambda][TargetNode=" << name << "]Le(" << name << "=" << iter->first << ")=" << parentp->second << endl;
-			cout << "[CompositeNode::calCptLambda][TargetNode=" << name << "]P(" << name << "=" << iter->first << "|" << valuep << ")=" << (iter->second / total) << endl;
-#endif
 		}
-		cond->clear();
-		return 0;
+		q += psize * size;
 	}
-	// 全要素に対して処理を行います
-	CompositeNode *next = targetpn->second;
-	for (CHARS::iterator iter = next->elements.begin(); iter != next->elements.end(); iter++) {
-		COND condc(*cond);
-		condc.push_back(COND_PAIR(next->name, *iter));
-		calCptLambda(parents, pai, &condc, probs, targetpn, targetpe, false);
+	for (unsigned int y = 0; y < size; y++) others[y] *= q[y];
+	vector<UD> &result = state.msgLambda[slot];
+	for (unsigned int u = 0; u < result.size(); u++) {
+		UD sum = 0.0, last = 0.0;
+		for (unsigned int y = 0; y < size; y++) {
+			UD f = target[u * size + y] * others[y];
+			sum += state.eviLambda[degrees[y]] * (f - last);
+			last = f;
+		}
+		result[u] = sum;
 	}
+	work->arena.release(mark);
 	return 0;
 }
 
 /*!
- * @brief 関連するノードに階層構造を利用してメッセージ転送します
- * @param[in] CompositeNode* 送信ノードへの参照
+ * @brief 指定ノードにメッセージを1件転送し、受信ノードのエビデンスと事後確率を更新します
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] CompositeNode* 受信ノードへの参照
+ * @param[in] int            メッセージの種類(MESSAGE_LAMBDA=子→親, MESSAGE_PAI=親→子)
+ * @param[in] int            子ノードの親における親の番号
  */
-int CompositeNode::transMessage(CompositeNode *sender) {
-	// 転送ログを出力します
-	// すでに処理済みの場合は処理を正常終了します
-	if (recv == false) return 0;
-	recv = false;
-
-	// 親を優先して検索します
-	for (NODES::iterator iter1 = parents.begin(); iter1 != parents.end(); iter1++) {
-		CompositeNode *target1 = iter1->second;
-		if (target1->recv) {
-			// 計算時間の計測を開始します
-			double begin = nowtime();
-			// 移動前にメッセージ計算を行います
-			if (!parents.empty()) calMsgLambda(target1->name);
-			target1->calEviLambda();
-			target1->calProb();
-			now(string("Sending Lambda Message ") + name + string("->") + target1->name);
-			target1->now(string("Sending Lambda Message ") + name + string("->") + target1->name);
-			// 計算時間を表示します
-			printf("%s caluculate lambda msg for %s(%fsec)\n", name.c_str(), target1->name.c_str(), (nowtime() - begin));
-			// 処理を転送します
-			target1->transMessage(this);
+int CompositeNode::sendMessage(CompositeWork *work, CompositeNode *target, int kind, int slot) {
+	// 計算時間の計測を開始します
+	double begin = nowtime();
+	PROFILE_COUNT(PROFILE_MESSAGES, 1);
+	if (kind == MESSAGE_LAMBDA) {
+		// 移動前にメッセージ計算を行います
+		calMsgLambda(work, slot);
+		target->calEviLambda(work);
+		target->calProb(work);
+		if (TRACE_ON(TRACE_DETAIL)) {
+			now(work, string("Sending Lambda Message ") + name + string("->") + target->name);
+			target->now(work, string("Sending Lambda Message ") + name + string("->") + target->name);
 		}
-	}
-	// 親がない場合は子を検索します
-	for (NODES::iterator iter2 = children.begin(); iter2 != children.end(); iter2++) {
-		CompositeNode *target2 = iter2->second;
-		if (target2->recv) {
-			// 計算時間の計測を開始します
-			double begin = nowtime();
-			// 移動前にメッセージ計算を行います
-			calMsgPai(target2->name);
-			target2->calEviPai();
-			target2->calProb();
-			now("Sending Pai Message " + name + string("->") + target2->name);
-			target2->now("Sending Pai Message " + name + string("->") + target2->name);
-			// 計算時間を表示します
-			printf("%s caluculate pai msg for %s(%fsec)\n", name.c_str(), target2->name.c_str(), (nowtime() - begin));
-			// 処理を転送します
-			target2->transMessage(this);
+		// 計算時間を表示します
+		TRACE(TRACE_DEBUG, name << " caluculate lambda msg for " << target->name << "(" << (nowtime() - begin) / 1000.0 << "sec)");
+	} else {
+		// 移動前にメッセージ計算を行います
+		calMsgPai(work, target, slot);
+		target->calEviPai(work);
+		target->calProb(work);
+		if (TRACE_ON(TRACE_DETAIL)) {
+			now(work, "Sending Pai Message " + name + string("->") + target->name);
+			target->now(work, "Sending Pai Message " + name + string("->") + target->name);
 		}
+		// 計算時間を表示します
+		TRACE(TRACE_DEBUG, name << " caluculate pai msg for " << target->name << "(" << (nowtime() - begin) / 1000.0 << "sec)");
 	}
-
 	return 0;
 }
 
-int CompositeNode::now(string title) {
+/*!
+ * @brief 現在の情報をトレース出力します(TRACE_DETAIL水準)
+ * @param[in] CompositeWork* ワークスペース
+ * @param[in] string         表題
+ */
+int CompositeNode::now(CompositeWork *work, string title) {
+	if (!TRACE_ON(TRACE_DETAIL)) return 0;
+	CompositeState &state = work->states[id];
 	char text[1024];
+	string line1(70, '='), line2(70, '-');
+	stringstream out;
 	// タイトルの表示
-	LINE("=");
-	cout << title << endl;
-	LINE("=");
+	out << line1 << '\n' << title << '\n' << line1 << '\n';
 	// サブタイトルの表示
-	LINE("-");
-	cout << "Target Node: " << name << endl;
-	LINE("-");
-
+	out << line2 << '\n' << "Target Node: " << name << '\n' << line2 << '\n';
 	// 確率を出力します
 	for (PROBS::iterator iter2 = prior.begin(); iter2 != prior.end(); iter2++) {
-		sprintf(text, "%f=Pb(%s=%s)", iter2->second, name.c_str(), iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	LINE("-");
-	// 事後確率を出力します
-	for (PROBS::iterator iter2 = posterior.begin(); iter2 != posterior.end(); iter2++) {
-		sprintf(text, "%f=Pr(%s=%s)", iter2->second, name.c_str(), iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	// πエビデンスを出力します
-	LINE("-");
-	for (PROBS::iterator iter2 = eviPai.begin(); iter2 != eviPai.end(); iter2++) {
-		sprintf(text, "%f=Pe(%s=%s)", iter2->second, name.c_str(), iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	// λエビデンスを出力します
-	LINE("-");
-	for (PROBS::iterator iter2 = eviLambda.begin(); iter2 != eviLambda.end(); iter2++) {
-		sprintf(text, "%f=Le(%s=%s)", iter2->second, name.c_str(), iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	// πメッセージを出力します
-	LINE("-");
-	for (PROBS::iterator iter2 = msgPai.begin(); iter2 != msgPai.end(); iter2++) {
-		sprintf(text, "%f=Pm(%s)", iter2->second, iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	// λメッセージを出力します
-	LINE("-");
-	for (PROBS::iterator iter2 = msgLambda.begin(); iter2 != msgLambda.end(); iter2++) {
-		sprintf(text, "%f=Lm(%s)", iter2->second, iter2->first.c_str());
-		cout << "[CompositeBase::now]" << text << endl;
-	}
-	LINE("-");
+		snprintf(text, sizeof(text), "%f=Pb(%s=%s)", iter2->second, name.c_str(), iter2->first.c_str());
+		out << "[CompositeBase::now]" << text << '\n';
+	}
+	// 事後確率、π・λエビデンスを出力します
+	const char *labels[3] = { "Pr", "Pe", "Le" };
+	vector<UD> *values[3] = { &state.posterior, &state.eviPai, &state.eviLambda };
+	for (int i = 0; i < 3; i++) {
+		out << line2 << '\n';
+		for (unsigned int k = 0; k < values[i]->size() && k < elements.size(); k++) {
+			snprintf(text, sizeof(text), "%f=%s(%s=%s)", (*values[i])[k], labels[i], name.c_str(), elements[k].c_str());
+			out << "[CompositeBase::now]" << text << '\n';
+		}
+	}
+	// π・λメッセージ(親の状態毎)を出力します
+	for (int i = 0; i < 2; i++) {
+		out << line2 << '\n';
+		vector<vector<UD> > &messages = (i == 0 ? state.msgPai : state.msgLambda);
+		for (unsigned int j = 0; j < messages.size() && j < parentNodes.size(); j++) {
+			for (unsigned int k = 0; k < messages[j].size(); k++) {
+				snprintf(text, sizeof(text), "%f=%s(%s=%s)", messages[j][k], (i == 0 ? "Pm" : "Lm"),
+						parentNodes[j]->name.c_str(), parentNodes[j]->elements[k].c_str());
+				out << "[CompositeBase::now]" << text << '\n';
+			}
+		}
+	}
+	out << line2 << '\n';
+	tracePush(out.str());
 	return 0;
 }
-
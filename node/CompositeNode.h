@@ -3,10 +3,54 @@
 // Version     : 1.0
 // Description : Bayesian Network Processing in C++, Ansi-style
 //============================================================================
+#ifndef COMPOSITENODE_H_
+#define COMPOSITENODE_H_
+
 #include "ProbabilityBase.h"
 
+/*! @brief メッセージの種類(λメッセージ、子→親)を定義します */
+#define MESSAGE_LAMBDA 0
+
+/*! @brief メッセージの種類(πメッセージ、親→子)を定義します */
+#define MESSAGE_PAI 1
+
+/*! @brief ノードの種類(親の状態の組毎の条件付き確率表)を定義します */
+#define NODE_TABLE 0
+
+/*! @brief ノードの種類(雑音付きOR、自身が2状態の雑音付きMAX)を定義します */
+#define NODE_NOISY_OR 1
+
+/*! @brief ノードの種類(雑音付きMAX、自身の状態の程度の順は利用者が指定します)を定義します */
+#define NODE_NOISY_MAX 2
+
+/*! @brief ノードの種類(親の状態で分岐する決定木の葉に条件付き確率を共有する表)を定義します */
+#define NODE_TREE 3
+
+/*! @brief 決定木の1つの葉にまとめる行の確率の差の上限を定義します(0は同一の行のみまとめます) */
+#define TREE_TOLERANCE 0.0
+
+/*! @brief 決定木の大きさが展開した表のこの割合未満となる場合に決定木とします */
+#define TREE_RATIO 0.5
+
+class CompositeWork;
+
+/*!
+ * @brief メッセージ転送の1手順(送信ノード、受信ノード、種類)を定義します
+ */
+struct CompositeStep {
+	CompositeNode *from; // 送信ノード
+	CompositeNode *to;   // 受信ノード
+	int kind;            // メッセージの種類(MESSAGE_LAMBDA, MESSAGE_PAI)
+	int slot;            // 子ノードの親ノード(parentNodes)における親の番号(メッセージの格納位置)
+};
+
+/*! @brief 伝播起点毎のメッセージ転送手順を定義します */
+typedef vector<CompositeStep> SCHEDULE;
+
 /*!
  * @brief Bayesian Network上の確率変数のノードを定義します
+ * ノードはネットワーク構造と条件付き確率表(モデル)のみを保持し、構築後は変更しません
+ * 推論中に変化する値(メッセージ、エビデンス、事後確率)はCompositeWorkに保持します
  */
 class CompositeNode {
     friend class CompositeBase;
@@ -37,6 +81,11 @@ public:
      */
     string name;
 
+    /*!
+     * @brief ノード番号(ワークスペースの添字)を保持します
+     */
+    int id;
+
     /*!
      * @brief 一意な要素名を保持します
      */
@@ -52,46 +101,96 @@ public:
      */
     NODES children;
 
+	/*!
+	 * @brief 親をparentsの順(条件付き確率表の桁の順)に保持します
+	 */
+	vector<CompositeNode*> parentNodes;
+
+	/*!
+	 * @brief 子をchildrenの順に保持します
+	 */
+	vector<CompositeNode*> childNodes;
+
+	/*!
+	 * @brief 子毎に、子の親(parentNodes)における自身の番号を保持します(childNodesと同順)
+	 */
+	vector<int> slots;
+
+	/*!
+	 * @brief 親毎の条件付き確率表の行番号の桁の重みを保持します(parentNodesと同順)
+	 */
+	vector<int> strides;
+
     /*!
      * @brief 事前確率を保持します
      */
 	PROBS prior;
 
 	/*!
-	 * @brief πエビデンス(π(X|e+)...親ノードを元にした証拠)を保持します
+	 * @brief ノードの種類を保持します(NODE_TABLE, NODE_NOISY_OR, NODE_NOISY_MAX, NODE_TREE)
+	 * 雑音付きOR/MAXは親毎の状態数×自身の状態数の母数のみ保持し、親の状態の組は展開しません
+	 */
+	int model;
+
+	/*!
+	 * @brief 雑音付きOR/MAXの自身の状態名を程度の低い順(先頭が正常状態)に保持します
+	 * 空の場合は2状態のノード(雑音付きOR)のみ要素名の順とし、3状態以上のノードでは指定を必須とします
+	 */
+	CHARS degreeOrder;
+
+	/*!
+	 * @brief 雑音付きOR/MAXの程度の順の状態番号(elementsの添字)を保持します(compileNoisyで求めます)
+	 * 母数の配列は程度の順に並べ、確率、メッセージに変換する際に状態番号に戻します
+	 */
+	vector<unsigned int> degrees;
+
+	/*!
+	 * @brief 展開済みの条件付き確率表を保持します
+	 * 親の状態の組(parentsの順で先頭を上位桁とします)×自身の状態(elementsの順)の配列です
+	 * 雑音付きOR/MAXの場合は、親毎(parentsの順)に親の状態×自身の状態の累積確率Q(Y<=y|Ui=u)、
+	 * 末尾に漏れ(全ての親が正常状態)の累積確率QL(Y<=y)を並べた母数の配列です
+	 * 決定木の場合は、葉毎の自身の状態毎の条件付き確率を並べた配列です
 	 */
-	PROBS eviPai;
+	vector<UD> table;
 
 	/*!
-	 * @brief λエビデンス(λ(X|e-)...子ノードを元にした証拠)を保持します
+	 * @brief 決定木を保持します(NODE_TREEの場合のみ、先頭が根)
+	 * 分岐は分岐する親の番号(parentNodesの添字)、続けて親の状態毎の子の位置を並べ、葉は-(葉の番号+1)とします
+	 * 根からの経路は親を先頭から順に分岐する為、深さdの葉は先頭からd個の親の状態のみで決まります
 	 */
-	PROBS eviLambda;
+	vector<int> tree;
 
 	/*!
-	 * @brief πメッセージ(πX(Ui|e+)...U→親ノード)を保持します
+	 * @brief 参照する条件付き確率表の先頭を保持します(tableの先頭、又はモデルファイルの割り当て領域)
+	 * 推論はtableではなく本メンバを参照します(展開前はNULL)
 	 */
-	PROBS msgPai;
+	const UD *values;
 
 	/*!
-	 * @brief λメッセージ(λVi(X|e-)...V→子ノード)を保持します
+	 * @brief 参照する条件付き確率表の要素数を保持します
 	 */
-	PROBS msgLambda;
+	unsigned long cells;
 
 	/*!
-	 * @brief 事後確率（α*π(X)λ(X))を保持します
+	 * @brief 条件付き確率表の展開有無を保持します
 	 */
-	PROBS posterior;
+	bool compiled;
+
+	/*!
+	 * @brief 事前確率と要素名の作成有無を保持します
+	 */
+	bool materialized;
+
+	/*!
+	 * @brief 所属する連結成分の番号を保持します
+	 */
+	int component;
 
     /*!
      * @brief BayesianNetwork上での階層レベルを保持します
      */
     int depth;
 
-	/*!
-	 * @brief メッセージ受信可能状態を保持します
-	 */
-	bool recv;
-
 public:
     /*!
      * @brief 親要素を保持します
@@ -105,96 +204,138 @@ public:
      */
     int addChild(CompositeNode *node);
 
+	/*!
+	 * @brief 事前確率と要素名を求めます(未作成の場合のみ)
+	 */
+	int materialize();
+
+	/*!
+	 * @brief 全ての親の状態の組について条件付き確率表を展開します
+	 */
+	int compile();
+
+	/*!
+	 * @brief 親の状態の組に対する自身の状態毎の条件付き確率を返します
+	 * @param[in]  unsigned int* 親毎の状態番号(parentNodesの順)
+	 * @param[out] UD*           雑音付きOR/MAXの場合に計算結果を格納する領域(自身の状態数分)
+	 * @return 状態毎の条件付き確率の先頭(条件付き確率表の場合は表の行を直接返します)
+	 */
+	const UD *conditional(const unsigned int *digits, UD *scratch);
+
+	/*!
+	 * @brief 親の状態の組毎の条件付き確率表を展開して末尾に追加します
+	 * @param[out] vector<UD>* 展開した条件付き確率表(compileの表と同順)
+	 * @return 0=正常終了(雑音付きOR/MAXは展開しません)
+	 */
+	int expand(vector<UD> *result);
+
+	/*!
+	 * @brief 要素名の配列番号を返します
+	 * @param[in] string 要素名
+	 * @return 配列番号(存在しない場合は-1)
+	 */
+	int index(string element);
+
     /*!
-	 * @brief 関連するノードに階層構造を利用してメッセージ転送します
-	 * @param[in] CompositeNode* 送信ノードへの参照
+	 * @brief 指定ノードにメッセージを1件転送し、受信ノードのエビデンスと事後確率を更新します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] CompositeNode* 受信ノードへの参照
+	 * @param[in] int            メッセージの種類(MESSAGE_LAMBDA=子→親, MESSAGE_PAI=親→子)
+	 * @param[in] int            子ノードの親における親の番号
 	 */
-	int transMessage(CompositeNode *sender);
+	int sendMessage(CompositeWork *work, CompositeNode *target, int kind, int slot);
 
 	/*!
-	 * @brief 現在の情報をログ出力します
+	 * @brief 現在の情報をトレース出力します(TRACE_DETAIL水準)
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] string         表題
 	 */
-	int now(string title);
+	int now(CompositeWork *work, string title);
 
 protected:
-    /*!
-	 * @brief 該当する事前確率を返します
-	 * @param[in]  string  対象要素名
-	 * @param[out] double* 該当事前確率
-     */
-    int calPrior(string target, UD *result);
+	/*!
+	 * @brief 子へのπメッセージ(πX(U)=事後確率/λX(U))を計算し、子のワークスペースに格納します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] CompositeNode* 受信する子ノード
+	 * @param[in] int            子ノードの親における自身の番号
+	 */
+	int calMsgPai(CompositeWork *work, CompositeNode *child, int slot);
 
 	/*!
-	 * @brief πメッセージを計算します/πメッセージ及びλメッセージは直接対象ノードに代入します
-	 * @param[in] string 送信ノード名
+	 * @brief 親へのλメッセージ(λX(Ui)=∑P(x|u1,...,un)λ(x)Ππ(Uk), k≠i)を計算します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] int            受信する親の番号(parentNodesの添字)
 	 */
-	int calMsgPai(string sender);
+	int calMsgLambda(CompositeWork *work, int slot);
 
 	/*!
-	 * @brief λメッセージを計算します
-	 * @param[in] string 送信ノード名
+	 * @brief πエビデンス(π(X)=∑P(x|u1,...,un)ΠπX(Ui))を計算します
+	 * @param[in] CompositeWork* ワークスペース
 	 */
-	int calMsgLambda(string sender);
+	int calEviPai(CompositeWork *work);
 
 	/*!
-	 * @brief πエビデンスを計算します
+	 * @brief λエビデンス(λ(X)=ΠλV(X)×尤度)を計算します
+	 * @param[in] CompositeWork* ワークスペース
 	 */
-	int calEviPai();
+	int calEviLambda(CompositeWork *work);
 
 	/*!
-	 * @brief λエビデンスを計算します
+	 * @brief 実データの親毎の条件付き件数から雑音付きOR/MAXの母数を求めます
 	 */
-	int calEviLambda();
+	int compileNoisy();
 
 	/*!
-	 * @brief 事後確率を更新します
+	 * @brief 展開済みの条件付き確率表の同一(TREE_TOLERANCE以内)の行をまとめて決定木とします
+	 * 決定木が十分に小さい場合(TREE_RATIO)のみ表を置き換えます
+	 * @param[in] vector<long>& 行毎の実データの件数(まとめた葉の確率の重み)
 	 */
-	int calProb();
+	int compileTree(vector<long> &totals);
 
 	/*!
-	 * @brief 条件付き確率を求めます
-	 * @param[in]  string 対象親ノード名
-	 * @param[in]  string 対象ノードの状態(要素)名
-	 * @param[in]  string 対象子ノード名
-	 * @param[out] UD*    P(子ノード=子ノード状態|親ノード=親ノード状態)を返します
+	 * @brief 決定木の1区間(先頭からdepth個の親の状態が等しい行)を葉又は分岐として追加し、その位置を返します
 	 */
-	int calCpt(string parent, string statep, string statec, UD *result);
+	int compileTree(vector<long> &totals, map<vector<UD>, int> *leaves, unsigned int depth, unsigned long first, unsigned long count);
 
 	/*!
-	 * @brief 条件付き確率P(X|Y1,...,Yn)を求めます（実処理）
-	 * @param[in]  COND*   			条件付き確率の条件
-	 * @param[out] PROBS*  			算出条件付き確率∑n{P(CN=CE|PN1=PE1,...,PNn=PEn)}を保持します
-     * @param[in]  NODES::iterator  処理開始ポインタ・その１
-     * @param[in]  NODES::iterator  処理開始ポインタ・その２
-	 * @param[in]  bool    初回処理時のみポインタ移動を行いません
+	 * @brief 決定木のπエビデンスを葉毎に計算します(未分岐の親はπメッセージの和で周辺化します)
+	 * @param[in] CompositeWork* ワークスペース
 	 */
-	int calCptPai(COND *cond, PROBS *result, NODES::iterator targetpn, NODES::iterator targetpe, bool first);
+	int calEviPaiTree(CompositeWork *work);
 
 	/*!
-	 * @brief 条件付き確率P(X|Y1,...,Yn)を求めます（実処理）
-	 * @param[in]  NODES*			処理対象とする親ノード(親が複数なら対象親以外の合計、1なら対象の親のデータを用いる)
-	 * @param[in]  COND*   			条件付き確率の条件
-	 * @param[out] PROBS*  			算出条件付き確率∑n{P(CN=CE|PN1=PE1,...,PNn=PEn)}を保持します
-     * @param[in]  NODES::iterator  処理開始ポインタ・その１
-     * @param[in]  NODES::iterator  処理開始ポインタ・その２
-	 * @param[in]  bool    初回処理時のみポインタ移動を行いません
+	 * @brief 決定木の親へのλメッセージを葉毎に計算します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] int            受信する親の番号(parentNodesの添字)
 	 */
-	int calCptLambda(string parents, bool pai, COND *cond, PROBS *result, NODES::iterator targetpn, NODES::iterator targetpe, bool first);
+	int calMsgLambdaTree(CompositeWork *work, int slot);
 
-	/*
-	 * 親ノードの状態毎の事前確率の積算を返します
-	 * @param[in] COND*   条件付き確率の条件
-	 * @param[in] double* 算出結果格納変数
+	/*!
+	 * @brief 雑音付きOR/MAXのπエビデンスを累積確率の積(F(y)=QL(y)Π∑πX(u)Qi(y|u))から線形時間で計算します
+	 * @param[in] CompositeWork* ワークスペース
 	 */
-	int calPaiTotal(COND *cond, double *result);
+	int calEviPaiNoisy(CompositeWork *work);
 
 	/*!
-	 * @brief 正規化定数を計算します
-	 * @param[out] UD* 正規化係数を返します
+	 * @brief 雑音付きOR/MAXの親へのλメッセージを累積確率の積から線形時間で計算します
+	 * @param[in] CompositeWork* ワークスペース
+	 * @param[in] int            受信する親の番号(parentNodesの添字)
 	 */
-	int calNormal(UD *result);
+	int calMsgLambdaNoisy(CompositeWork *work, int slot);
 
-};
+	/*!
+	 * @brief 事後確率を更新します
+	 * @param[in] CompositeWork* ワークスペース
+	 */
+	int calProb(CompositeWork *work);
 
+	/*!
+	 * @brief 正規化定数を計算します
+	 * @param[in]  CompositeWork* ワークスペース
+	 * @param[out] UD*            正規化係数を返します
+	 */
+	int calNormal(CompositeWork *work, UD *result);
 
+};
 
+#endif /* COMPOSITENODE_H_ */
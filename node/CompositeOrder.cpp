@@ -0,0 +1,114 @@
+//============================================================================
+// Name        : CompositeOrder.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeOrder.h"
+#include "BayesianTrace.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief 順序毎の探索を並列に処理する内容を定義します
+ */
+struct CompositeOrderSearch {
+	CompositeOrder *order;           // 順序探索
+	CHARS *titles;                   // ノード名集合
+	vector<vector<CHARS> > *parents; // 順序毎の結果の親
+	vector<double> *scores;          // 順序毎の結果のスコア
+	vector<char> *done;              // 順序毎の探索有無(時間予算の超過で探索しない場合があります)
+	volatile long errors;            // 失敗した順序数
+	void operator()(long index, int thread) {
+		if (order->expired()) return;
+		if (order->searchOrder(index, titles, &(*parents)[index], &(*scores)[index]) != 0) {
+			__sync_fetch_and_add(&errors, 1);
+			return;
+		}
+		(*done)[index] = 1;
+	}
+};
+
+/*!
+ * @brief 多数の順序でK2を実行し、スコアが最も高い順序の親を返します
+ */
+int CompositeOrder::searchStructure(CHARS *titles, vector<CHARS> *parents) {
+	begin = nowtime();
+	// 順序毎にK2を実行します(順序の中は逐次に処理し、順序を単位として並列に処理します)
+	int count = (candidates < 1 ? 1 : candidates);
+	vector<vector<CHARS> > founds(count);
+	vector<double> scores(count, -HUGE_VAL);
+	vector<char> done(count, 0);
+	CompositeOrderSearch search;
+	search.order   = this;
+	search.titles  = titles;
+	search.parents = &founds;
+	search.scores  = &scores;
+	search.done    = &done;
+	search.errors  = 0;
+	parallel(threads, count, &search);
+	if (search.errors != 0) {
+		cout << "[CompositeOrder::searchStructure]Function of searchOrder Failure(" << search.errors << ")" << endl;
+		return 1;
+	}
+	// スコアが最も高い順序の結果を採用します(同点の場合は番号の小さい順序とします)
+	int best = -1, searched = 0;
+	for (int i = 0; i < count; i++) {
+		if (!done[i]) continue;
+		searched++;
+		if (best < 0 || scores[i] > scores[best]) best = i;
+	}
+	if (best < 0) {
+		cout << "[CompositeOrder::searchStructure]No Order Searched" << endl;
+		return 2;
+	}
+	TRACE(TRACE_INFO, "[CompositeOrder::searchStructure]Orders=" << searched << "/" << count << " Best=" << best << " Score <- " << scores[best]);
+	parents->swap(founds[best]);
+	return 0;
+}
+
+/*!
+ * @brief 1つの順序を作成してK2を実行し、隣接交換で改善します
+ */
+int CompositeOrder::searchOrder(long index, CHARS *titles, vector<CHARS> *parents, double *score) {
+	int size = titles->size();
+	unsigned long long counter = 0;
+	// 0番は列の順序、以降は種と番号から決まるランダムな順序とします
+	CHARS order(*titles);
+	if (index > 0) {
+		for (int i = size - 1; i > 0; i--) {
+			int j = (int)(random(index, counter++) * (i + 1));
+			swap(order[i], order[j]);
+		}
+	}
+	// 順序の位置毎に親と家族スコアを求めます
+	vector<CHARS> found(size);
+	vector<double> families(size, 0.0);
+	for (int i = 0; i < size; i++) {
+		if (learnNode(&order, i, &found[i], &families[i]) != 0) return 1;
+	}
+	double current = 0.0;
+	for (int i = 0; i < size; i++) current += families[i];
+	// 隣接する2ノードを交換し、スコアが上がる場合のみ採用します(親の候補が変わるのはその2ノードのみです)
+	for (int s = 0; s < swaps && size > 1 && !expired(); s++) {
+		int j = (int)(random(index, counter++) * (size - 1));
+		swap(order[j], order[j + 1]);
+		CHARS first, second; double p1, p2;
+		if (learnNode(&order, j, &first, &p1) != 0 || learnNode(&order, j + 1, &second, &p2) != 0) return 2;
+		double next = current - families[j] - families[j + 1] + p1 + p2;
+		if (next > current + CEPS * fabs(current)) {
+			// 位置jとj+1の結果を入れ替えて採用します
+			found[j].swap(first), found[j + 1].swap(second);
+			families[j] = p1, families[j + 1] = p2;
+			current = next;
+		} else {
+			swap(order[j], order[j + 1]);
+		}
+	}
+	TRACE(TRACE_DEBUG, "[CompositeOrder::searchOrder]Order " << index << " Score <- " << current);
+	// ノード名集合の順の親に並べ替えて返します
+	map<string, int> positions;
+	for (int i = 0; i < size; i++) positions[order[i]] = i;
+	parents->assign(size, CHARS());
+	for (int i = 0; i < size; i++) (*parents)[i] = found[positions[(*titles)[i]]];
+	*score = current;
+	return 0;
+}
@@ -0,0 +1,88 @@
+//============================================================================
+// Name        : CompositeOrder.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITEORDER_H_
+#define COMPOSITEORDER_H_
+
+#include "CompositeK2.h"
+
+/*!
+ * @brief 順序探索の既定値を定義します
+ */
+#define ORDER_CANDIDATES 16 // 探索する順序の数(0番は列の順序、以降はランダムな順序)
+#define ORDER_SWAPS      64 // 順序毎の隣接交換による局所探索の回数
+
+/*!
+ * @brief 多数のノード順序でK2を実行し、スコアが最も高いDAGを採用します(列の順序に依存しない構造を作成します)
+ * 各順序はランダムに作成し、隣接する2ノードの交換による局所探索で改善します
+ * 交換で親の候補が変わるのは交換した2ノードのみの為、その2ノードのみ親を確定し直します
+ * 順序は種と順序の番号のみから決まる乱数で作成し、並列に探索する為、時間予算に達しない限り結果はスレッド数によらず同じです
+ */
+class CompositeOrder : public CompositeK2 {
+	friend struct CompositeOrderSearch;
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeOrder();
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositeOrder(ProbabilityBase *target) : CompositeK2(target) {
+		candidates = ORDER_CANDIDATES;
+		swaps      = ORDER_SWAPS;
+		seconds    = 0.0;
+		begin      = 0.0;
+	}
+
+public:
+	/*!
+	 * @brief 探索する順序の数を保持します
+	 */
+	int candidates;
+
+	/*!
+	 * @brief 順序毎の隣接交換による局所探索の回数を保持します
+	 */
+	int swaps;
+
+	/*!
+	 * @brief 時間予算(秒)を保持します(0以下の場合は無制限、超過後は新たな順序を探索しません)
+	 * 親候補を選び直す場合は、学習毎の予算とします
+	 */
+	double seconds;
+
+protected:
+	/*!
+	 * @brief 探索の開始時刻(ミリ秒)を保持します
+	 */
+	double begin;
+
+protected:
+	/*!
+	 * @brief 多数の順序でK2を実行し、スコアが最も高い順序の親を返します(前回の親は用いません)
+	 */
+	int searchStructure(CHARS *titles, vector<CHARS> *parents);
+
+	/*!
+	 * @brief 1つの順序を作成してK2を実行し、隣接交換で改善します
+	 * @param[in]  long           順序の番号(乱数列番号)
+	 * @param[in]  CHARS*         ノード名集合(列の順序)
+	 * @param[out] vector<CHARS>* ノード毎(ノード名集合の順)の親
+	 * @param[out] double*        構造全体のスコア
+	 */
+	int searchOrder(long index, CHARS *titles, vector<CHARS> *parents, double *score);
+
+	/*!
+	 * @brief 時間予算を超過したか否かを返します
+	 */
+	inline bool expired() { return seconds > 0.0 && (nowtime() - begin) / 1000.0 > seconds; }
+
+};
+
+#endif /* COMPOSITEORDER_H_ */
@@ -0,0 +1,245 @@
+//============================================================================
+// Name        : CompositePC.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositePC.h"
+#include "BayesianTrace.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief 条件付き集合の大きさが同じ検定を辺毎に並列に処理する内容を定義します
+ */
+struct CompositePCTest {
+	CompositePC *pc;                 // PCアルゴリズム
+	vector<vector<int> > *adjacents; // ノード毎の隣接ノード(大きさ毎の開始時点)
+	vector<pair<int, int> > *edges;  // 検定する辺
+	int level;                       // 条件付き集合の大きさ
+	vector<char> *removed;           // 辺毎の削除有無(結果)
+	vector<vector<int> > *sepsets;   // 辺毎の分離集合(結果)
+	volatile long errors;            // 失敗した辺の数
+	void operator()(long index, int thread) {
+		int x = (*edges)[index].first, y = (*edges)[index].second;
+		// xの隣接ノード、yの隣接ノードの順に、大きさlevelの部分集合を辞書順に検定します
+		for (int side = 0; side < (level > 0 ? 2 : 1); side++) {
+			int a = (side == 0 ? x : y), b = (side == 0 ? y : x);
+			vector<int> others;
+			for (vector<int>::iterator iter = (*adjacents)[a].begin(); iter != (*adjacents)[a].end(); iter++) {
+				if (*iter != b) others.push_back(*iter);
+			}
+			int count = others.size();
+			if (count < level) continue;
+			vector<int> pick(level), given(level);
+			for (int k = 0; k < level; k++) pick[k] = k;
+			while (true) {
+				for (int k = 0; k < level; k++) given[k] = others[pick[k]];
+				double p;
+				if (pc->independence(x, y, &given, &p) != 0) {
+					__sync_fetch_and_add(&errors, 1);
+					return;
+				}
+				if (p > pc->alpha) {
+					(*removed)[index] = 1;
+					(*sepsets)[index] = given;
+					return;
+				}
+				// 次の組み合わせに進みます
+				int k = level - 1;
+				while (k >= 0 && pick[k] == count - level + k) k--;
+				if (k < 0) break;
+				pick[k]++;
+				for (int m = k + 1; m < level; m++) pick[m] = pick[m - 1] + 1;
+			}
+		}
+	}
+};
+
+/*!
+ * @brief カイ二乗分布の上側確率(正則化された上側不完全ガンマ関数Q(df/2, stat/2))を返します
+ */
+static double chisquare(double stat, double df) {
+	double a = df / 2.0, x = stat / 2.0;
+	if (x <= 0.0) return 1.0;
+	double front = exp(-x + a * log(x) - lgamma(a));
+	if (x < a + 1.0) {
+		// 級数展開で下側確率を求めます
+		double ap = a, sum = 1.0 / a, del = sum;
+		for (int n = 0; n < 1000; n++) {
+			ap += 1.0;
+			del *= x / ap;
+			sum += del;
+			if (fabs(del) < fabs(sum) * 1e-15) break;
+		}
+		double result = 1.0 - sum * front;
+		return (result < 0.0 ? 0.0 : result);
+	}
+	// 連分数展開(Lentz法)で上側確率を求めます
+	double b = x + 1.0 - a, c = 1.0 / 1e-300, d = 1.0 / b, h = d;
+	for (int i = 1; i < 1000; i++) {
+		double an = -i * (i - a);
+		b += 2.0;
+		d = an * d + b;
+		if (fabs(d) < 1e-300) d = 1e-300;
+		c = b + an / c;
+		if (fabs(c) < 1e-300) c = 1e-300;
+		d = 1.0 / d;
+		double del = d * c;
+		h *= del;
+		if (fabs(del - 1.0) < 1e-15) break;
+	}
+	return front * h;
+}
+
+/*!
+ * @brief 全ての検定で共有する件数表のキャッシュを返します
+ */
+CompositeCache<vector<double> > &CompositePC::tables() {
+	static CompositeCache<vector<double> > storage(PC_CACHE_CAPACITY);
+	return storage;
+}
+
+/*!
+ * @brief 骨格を求め、向きを決めてノード毎の親を返します(前回の親は用いません)
+ */
+int CompositePC::searchStructure(CHARS *names, vector<CHARS> *found) {
+	titles = *names;
+	int size = titles.size();
+	tests = 0;
+	// 完全グラフ(親候補を事前選択した場合は、どちらかの候補に含まれる組のみ)から開始します
+	vector<vector<char> > adjacent(size, vector<char>(size, 0));
+	for (int i = 0; i < size; i++) {
+		for (int j = i + 1; j < size; j++) {
+			if (allowed(titles[i], titles[j], 0) || allowed(titles[j], titles[i], 0)) adjacent[i][j] = adjacent[j][i] = 1;
+		}
+	}
+	// 条件付き集合の大きさ毎に、開始時点の隣接関係で全ての辺を並列に検定します
+	map<long, vector<int> > separated; // 分離集合(Map-Key=i * size + j、i < j)
+	for (int level = 0; depth < 0 || level <= depth; level++) {
+		vector<vector<int> > adjacents(size);
+		vector<pair<int, int> > edges;
+		for (int i = 0; i < size; i++) {
+			for (int j = 0; j < size; j++) {
+				if (adjacent[i][j]) adjacents[i].push_back(j);
+			}
+		}
+		for (int i = 0; i < size; i++) {
+			for (int j = i + 1; j < size; j++) {
+				// 隣接ノードが足りず、条件付き集合を作れない辺は検定しません
+				if (adjacent[i][j] && ((int)adjacents[i].size() > level || (int)adjacents[j].size() > level)) {
+					edges.push_back(pair<int, int>(i, j));
+				}
+			}
+		}
+		if (edges.empty()) break;
+		vector<char> removed(edges.size(), 0);
+		vector<vector<int> > sepsets(edges.size());
+		CompositePCTest work;
+		work.pc        = this;
+		work.adjacents = &adjacents;
+		work.edges     = &edges;
+		work.level     = level;
+		work.removed   = &removed;
+		work.sepsets   = &sepsets;
+		work.errors    = 0;
+		parallel(threads, edges.size(), &work);
+		if (work.errors != 0) {
+			cout << "[CompositePC::searchStructure]could not test " << work.errors << " edges" << endl;
+			return 1;
+		}
+		long count = 0;
+		for (unsigned int e = 0; e < edges.size(); e++) {
+			if (!removed[e]) continue;
+			int i = edges[e].first, j = edges[e].second;
+			adjacent[i][j] = adjacent[j][i] = 0;
+			separated[(long)i * size + j] = sepsets[e];
+			count++;
+		}
+		TRACE(TRACE_INFO, "[CompositePC::searchStructure]Level " << level << " Edges=" << edges.size() << " Removed=" << count);
+	}
+	// 分離集合に含まれない共通の隣接ノードでv構造(i->k<-j)を作ります(既に逆向きとした辺は変えません)
+	vector<vector<char> > graph(adjacent);
+	for (map<long, vector<int> >::iterator iter = separated.begin(); iter != separated.end(); iter++) {
+		int i = iter->first / size, j = iter->first % size;
+		for (int k = 0; k < size; k++) {
+			if (!adjacent[i][k] || !adjacent[j][k]) continue;
+			if (find(iter->second.begin(), iter->second.end(), k) != iter->second.end()) continue;
+			if (graph[i][k]) graph[k][i] = 0;
+			if (graph[j][k]) graph[k][j] = 0;
+		}
+	}
+	int oriented = propagate(&graph);
+	if (extend(&titles, &graph, found) != 0) {
+		TRACE(TRACE_INFO, "[CompositePC::searchStructure]Inconsistent Orientation, Completed by Node Order");
+	}
+	CompositeCache<vector<double> > &cache = tables();
+	TRACE(TRACE_INFO, "[CompositePC::searchStructure]Tests=" << tests << " Oriented=" << oriented
+		<< " Table Cache hits=" << cache.hits << " misses=" << cache.misses << " rate=" << cache.rate());
+	return 0;
+}
+
+/*!
+ * @brief 条件付き独立性を検定します
+ */
+int CompositePC::independence(int x, int y, vector<int> *given, double *pvalue) {
+	__sync_fetch_and_add(&tests, 1);
+	// X、Yと条件付き集合を整列し、同じ検定が同じ件数表を参照するようにします
+	int a = (x < y ? x : y), b = (x < y ? y : x);
+	vector<int> sorted(*given);
+	sort(sorted.begin(), sorted.end());
+	vector<double> table;
+	if (getTable(a, b, &sorted, &table) != 0) {
+		cout << "[CompositePC::independence]Function of getTable Failure" << endl;
+		return 1;
+	}
+	int ra = domains.find(titles[a])->second.size(), rb = domains.find(titles[b])->second.size();
+	long q = table.size() / (ra * rb);
+	// 条件の状態の組毎に、G²=2ΣN log(N/E)、またはχ²=Σ(N-E)²/Eを求めます(E=Nx*Ny/Ns)
+	double stat = 0.0, df = 0.0;
+	vector<double> nx(ra), ny(rb);
+	for (long s = 0; s < q; s++) {
+		const double *nxy = &table[s * ra * rb];
+		nx.assign(ra, 0.0), ny.assign(rb, 0.0);
+		double ns = 0.0;
+		for (int j = 0; j < rb; j++) {
+			for (int i = 0; i < ra; i++) nx[i] += nxy[j * ra + i], ny[j] += nxy[j * ra + i];
+		}
+		for (int i = 0; i < ra; i++) ns += nx[i];
+		if (ns <= 0.0) continue;
+		for (int j = 0; j < rb; j++) {
+			for (int i = 0; i < ra; i++) {
+				double n = nxy[j * ra + i], e = nx[i] * ny[j] / ns;
+				if (e <= 0.0) continue;
+				if (test == PC_TEST_CHI2) stat += (n - e) * (n - e) / e;
+				else if (n > 0.0) stat += 2.0 * n * log(n / e);
+			}
+		}
+		// 自由度は件数のある状態のみで数えます
+		int cx = 0, cy = 0;
+		for (int i = 0; i < ra; i++) cx += (nx[i] > 0.0);
+		for (int j = 0; j < rb; j++) cy += (ny[j] > 0.0);
+		if (cx > 1 && cy > 1) df += (cx - 1) * (cy - 1);
+	}
+	*pvalue = (df > 0.0 ? chisquare(stat, df) : 1.0);
+	TRACE(TRACE_DETAIL, "[CompositePC::independence]" << titles[a] << "," << titles[b] << "|" << sorted.size() << " stat=" << stat << " df=" << df << " p=" << *pvalue);
+	return 0;
+}
+
+/*!
+ * @brief 件数表(条件の状態の組、Yの状態、Xの状態の順)を返します(キャッシュにない場合のみ数えます)
+ */
+int CompositePC::getTable(int x, int y, vector<int> *given, vector<double> *table) {
+	stringstream key;
+	key << base->revcnt() << '#' << titles[x] << '|' << titles[y] << '|';
+	CHARS parents;
+	for (vector<int>::iterator iter = given->begin(); iter != given->end(); iter++) {
+		key << (iter != given->begin() ? "\t" : "") << titles[*iter];
+		parents.push_back(titles[*iter]);
+	}
+	if (tables().find(key.str(), table)) return 0;
+	// Yを最後の親とすると、件数表は条件の状態の組毎にYの状態、Xの状態の順となります
+	parents.push_back(titles[y]);
+	double q = 0.0;
+	if (countFamily(titles[x], &parents, &q, table) != 0) return 1;
+	tables().insert(key.str(), *table, table->size() * sizeof(double));
+	return 0;
+}
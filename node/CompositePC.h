@@ -0,0 +1,110 @@
+//============================================================================
+// Name        : CompositePC.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITEPC_H_
+#define COMPOSITEPC_H_
+
+#include "CompositeStructure.h"
+
+/*!
+ * @brief 条件付き独立性の検定の種類を定義します
+ */
+#define PC_TEST_G2   0 // G²(尤度比)検定
+#define PC_TEST_CHI2 1 // カイ二乗(ピアソン)検定
+
+/*!
+ * @brief 探索の既定値を定義します
+ */
+#define PC_ALPHA 0.05 // 有意水準(p値がこれを超える場合は独立とみなします)
+#define PC_DEPTH -1   // 条件付き集合の最大の大きさ(負の場合は無制限)
+
+/*!
+ * @brief 件数表キャッシュの既定の保持容量(バイト)を定義します
+ */
+#define PC_CACHE_CAPACITY (64UL * 1024 * 1024)
+
+/*!
+ * @brief 条件付き独立性の検定によるPCアルゴリズム(PC-stable)で構造を学習します
+ * 条件付き集合の大きさ毎に、その開始時点の隣接関係のみを用いて全ての辺を検定する為、
+ * 辺の検定は互いに独立しており、辺を単位として並列に処理します(結果は辺の処理順によりません)
+ * 検定の件数表は(X、Y、条件付き集合)をキーとして全ての検定で共有するキャッシュに保持します
+ * 骨格からv構造とMeekの規則で向きを決め、残る無向辺は向きを補ってDAGとします
+ */
+class CompositePC : public CompositeStructure {
+	friend struct CompositePCTest;
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositePC();
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositePC(ProbabilityBase *target) : CompositeStructure(target) {
+		test  = PC_TEST_G2;
+		alpha = PC_ALPHA;
+		depth = PC_DEPTH;
+		tests = 0;
+	}
+
+public:
+	/*!
+	 * @brief 検定の種類を保持します(PC_TEST_G2、PC_TEST_CHI2)
+	 */
+	int test;
+
+	/*!
+	 * @brief 有意水準を保持します
+	 */
+	double alpha;
+
+	/*!
+	 * @brief 条件付き集合の最大の大きさを保持します(負の場合は無制限)
+	 */
+	int depth;
+
+	/*!
+	 * @brief 全ての検定で共有する件数表のキャッシュを返します
+	 */
+	static CompositeCache<vector<double> > &tables();
+
+protected:
+	/*!
+	 * @brief ノード名集合を保持します
+	 */
+	CHARS titles;
+
+	/*!
+	 * @brief 行った検定の数を保持します
+	 */
+	volatile long tests;
+
+protected:
+	/*!
+	 * @brief 骨格を求め、向きを決めてノード毎の親を返します(前回の親は用いません)
+	 */
+	int searchStructure(CHARS *names, vector<CHARS> *found);
+
+	/*!
+	 * @brief 条件付き独立性を検定します
+	 * @param[in]  int          ノードXの番号
+	 * @param[in]  int          ノードYの番号
+	 * @param[in]  vector<int>* 条件付き集合(ノード番号)
+	 * @param[out] double*      p値
+	 * @return 0=正常終了
+	 */
+	int independence(int x, int y, vector<int> *given, double *pvalue);
+
+	/*!
+	 * @brief 件数表(条件の状態の組、Yの状態、Xの状態の順)を返します(キャッシュにない場合のみ数えます)
+	 */
+	int getTable(int x, int y, vector<int> *given, vector<double> *table);
+
+};
+
+#endif /* COMPOSITEPC_H_ */
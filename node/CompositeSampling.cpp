@@ -0,0 +1,408 @@
+//============================================================================
+// Name        : CompositeSampling.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeSampling.h"
+#include "BayesianTrace.h"
+
+/*!
+ * @brief ギブスサンプリングで標準誤差を求める際のバッチ数の目安を定義します
+ */
+#define SAMPLING_BATCHES 25
+
+/*!
+ * @brief 時間予算を確認する間隔(サンプル数)を定義します
+ */
+#define SAMPLING_CHECK 64
+
+/*!
+ * @brief 推論対象のノード集合を必須引数とします
+ * @param[in] NODES* 推論対象のノード集合
+ */
+CompositeSampling::CompositeSampling(NODES *nodes) {
+	this->nodes     = nodes;
+	this->samples   = 100000; // 目標サンプル数
+	this->seconds   = 0.0;    // 時間予算なし
+	this->threads   = 0;      // CPU数
+	this->seed      = 20100316ULL;
+	this->burnin    = 1000;
+	this->generated = 0;
+	this->total     = 0;
+	this->method    = 0;
+	this->begin     = 0.0;
+}
+
+/*!
+ * @brief 尤度重み付け法で事後確率を求めます
+ * @param[in] LINE*          エビデンス(ノード名=状態名)
+ * @param[in] CompositeWork* 事後確率と標準誤差を書き込むワークスペース
+ * @return 0=正常終了
+ */
+int CompositeSampling::likelihood(LINE *evidences, CompositeWork *work) {
+	if (prepare(evidences) != 0) return 1;
+	method = INFER_LIKELIHOOD;
+	parallel((int)accumulators.size(), (long)accumulators.size(), this);
+	return reduce(work);
+}
+
+/*!
+ * @brief マルコフブランケット上のギブスサンプリングで事後確率を求めます
+ * @param[in] LINE*          エビデンス(ノード名=状態名)
+ * @param[in] CompositeWork* 事後確率と標準誤差を書き込むワークスペース
+ * @return 0=正常終了
+ */
+int CompositeSampling::gibbs(LINE *evidences, CompositeWork *work) {
+	if (prepare(evidences) != 0) return 1;
+	// 確率0の要素があると連鎖が既約でなくなり、初期状態から抜け出せない為、尤度重み付け法に切り替えます
+	int node = deterministic();
+	if (node >= 0) {
+		TRACE(TRACE_INFO, "[CompositeSampling::gibbs]" << order[node]->name << " has a zero probability, so it falls back to likelihood weighting");
+		method = INFER_LIKELIHOOD;
+		parallel((int)accumulators.size(), (long)accumulators.size(), this);
+		return reduce(work);
+	}
+	method = INFER_GIBBS;
+	parallel((int)accumulators.size(), (long)accumulators.size(), this);
+	return reduce(work);
+}
+
+/*!
+ * @brief スレッド毎の処理本体を呼び出します(並列処理用)
+ */
+void CompositeSampling::operator()(long index, int thread) {
+	// 目標サンプル数をスレッド毎に分割します(余りは先頭のスレッドが担当します)
+	long size  = accumulators.size();
+	long quota = (samples <= 0 ? 0 : samples / size + (index < samples % size ? 1 : 0));
+	if (method == INFER_LIKELIHOOD) runLikelihood((int)index, quota);
+	else runGibbs((int)index, quota);
+}
+
+/*!
+ * @brief トポロジカル順、条件付き確率表、エビデンスを準備します
+ * @param[in] LINE* エビデンス(ノード名=状態名)
+ */
+int CompositeSampling::prepare(LINE *evidences) {
+	// 入次数を元にトポロジカル順を求めます
+	order.clear();
+	map<CompositeNode*, int> degrees, numbers;
+	vector<CompositeNode*> queue;
+	for (NODES::iterator iter = nodes->begin(); iter != nodes->end(); iter++) {
+		degrees[iter->second] = iter->second->parents.size();
+		if (iter->second->parents.empty()) queue.push_back(iter->second);
+	}
+	for (unsigned int i = 0; i < queue.size(); i++) {
+		CompositeNode *target = queue[i];
+		numbers[target] = order.size();
+		order.push_back(target);
+		for (NODES::iterator iter = target->children.begin(); iter != target->children.end(); iter++) {
+			if (--degrees[iter->second] == 0) queue.push_back(iter->second);
+		}
+	}
+	if (order.size() != nodes->size()) {
+		TRACE(TRACE_ERROR, "[CompositeSampling::prepare]network has a cycle(" << order.size() << "/" << nodes->size() << ")");
+		return 1;
+	}
+	// ノード毎の添字情報と条件付き確率表を準備します
+	int size = order.size();
+	sizes.assign(size, 0);
+	offsets.assign(size, 0);
+	evidence.assign(size, -1);
+	parents.assign(size, vector<int>());
+	strides.assign(size, vector<int>());
+	children.assign(size, vector<int>());
+	cstrides.assign(size, vector<int>());
+	total = 0;
+	for (int i = 0; i < size; i++) {
+		CompositeNode *target = order[i];
+		if (target->compile() != 0) return 2;
+		sizes[i] = target->elements.size();
+		offsets[i] = total;
+		total += sizes[i];
+		// 先頭の親を上位桁とします(CompositeNode::compileと同順)
+		int stride = 1;
+		for (NODES::reverse_iterator iter = target->parents.rbegin(); iter != target->parents.rend(); iter++) {
+			int parent = numbers[iter->second];
+			parents[i].insert(parents[i].begin(), parent);
+			strides[i].insert(strides[i].begin(), stride);
+			children[parent].push_back(i);
+			cstrides[parent].push_back(stride);
+			stride *= iter->second->elements.size();
+		}
+	}
+	// エビデンスの状態番号を求めます
+	for (LINE::iterator iter = evidences->begin(); iter != evidences->end(); iter++) {
+		NODES::iterator inode = nodes->find(iter->first);
+		if (inode == nodes->end()) {
+			TRACE(TRACE_ERROR, "[CompositeSampling::prepare]not found node of " << iter->first);
+			return 3;
+		}
+		int state = inode->second->index(iter->second);
+		if (state < 0) {
+			TRACE(TRACE_ERROR, "[CompositeSampling::prepare]not found state of " << iter->first << "=" << iter->second);
+			return 4;
+		}
+		evidence[numbers[inode->second]] = state;
+	}
+	// スレッド毎の集計領域を準備します
+	int count = (threads <= 0 ? parallelCores() : threads);
+	if (samples > 0 && count > samples) count = (int)samples;
+	if (count < 1) count = 1;
+	accumulators.assign(count, Accumulator());
+	for (int i = 0; i < count; i++) {
+		accumulators[i].sum1.assign(total, 0.0);
+		accumulators[i].sum2.assign(total, 0.0);
+		accumulators[i].weight1 = 0.0;
+		accumulators[i].weight2 = 0.0;
+		accumulators[i].count   = 0;
+	}
+	begin = elapsed();
+	return 0;
+}
+
+/*!
+ * @brief ギブスサンプリングで再サンプリングするノード、及びその子の条件付き確率表に確率0の要素があるか確認します
+ * 雑音付きOR/MAXは全ての親の状態の組を展開しない為、1つの親のみ状態を変えた行を確認します
+ * @return 確率0の要素を持つノード番号(トポロジカル順の番号、ない場合は-1)
+ */
+int CompositeSampling::deterministic() {
+	vector<UD> scratch;
+	vector<unsigned int> digits;
+	for (unsigned int i = 0; i < order.size(); i++) {
+		// エビデンスの親のみを持つエビデンスのノードは、再サンプリングに関わりません
+		bool sampled = (evidence[i] < 0);
+		for (unsigned int j = 0; j < parents[i].size() && !sampled; j++) sampled = (evidence[parents[i][j]] < 0);
+		if (!sampled) continue;
+		CompositeNode *target = order[i];
+		if (target->model == NODE_TABLE || target->model == NODE_TREE) {
+			for (unsigned long k = 0; k < target->cells; k++) {
+				if (target->values[k] <= 0.0) return i;
+			}
+			continue;
+		}
+		digits.assign(parents[i].size(), 0);
+		scratch.resize(sizes[i]);
+		for (unsigned int j = 0; j <= parents[i].size(); j++) {
+			int psize = (j < parents[i].size() ? sizes[parents[i][j]] : 1);
+			for (int u = 0; u < psize; u++) {
+				if (j < parents[i].size()) digits[j] = u;
+				const UD *probs = target->conditional(digits.empty() ? NULL : &digits[0], &scratch[0]);
+				for (int k = 0; k < sizes[i]; k++) {
+					if (probs[k] <= 0.0) return i;
+				}
+			}
+			if (j < parents[i].size()) digits[j] = 0;
+		}
+	}
+	return -1;
+}
+
+/*!
+ * @brief 親ノードの状態の組から条件付き確率表の行の先頭を返します
+ */
+inline const UD *CompositeSampling::row(int node, vector<int> &state, vector<UD> &scratch, vector<unsigned int> &digits) {
+	vector<int> &parent = parents[node];
+	if (order[node]->model != NODE_TABLE) {
+		digits.resize(parent.size());
+		scratch.resize(sizes[node]);
+		for (unsigned int i = 0; i < parent.size(); i++) digits[i] = state[parent[i]];
+		return order[node]->conditional(digits.empty() ? NULL : &digits[0], &scratch[0]);
+	}
+	int index = 0;
+	vector<int> &stride = strides[node];
+	for (unsigned int i = 0; i < parent.size(); i++) index += state[parent[i]] * stride[i];
+	return &order[node]->values[index * sizes[node]];
+}
+
+/*!
+ * @brief 累積確率が乱数を超える状態番号を返します
+ * @param[in] UD* 状態毎の確率(正規化不要)
+ * @param[in] int 状態数
+ * @param[in] UD  乱数(0以上、確率の合計未満)
+ */
+inline int CompositeSampling::draw(const UD *probs, int size, UD u) {
+	UD cumulative = 0.0;
+	int k = 0;
+	for (; k < size - 1; k++) {
+		cumulative += probs[k];
+		if (u < cumulative) break;
+	}
+	return k;
+}
+
+/*!
+ * @brief 1スレッド分の尤度重み付け法を実行します
+ */
+int CompositeSampling::runLikelihood(int thread, long quota) {
+	Accumulator &acc = accumulators[thread];
+	int size = order.size();
+	vector<int> state(size, 0);
+	vector<UD> scratch;
+	vector<unsigned int> digits;
+	unsigned long long counter = 0;
+	for (long s = 0; quota <= 0 || s < quota; s++) {
+		// 時間予算を超えた場合は終了します
+		if (seconds > 0 && (s % SAMPLING_CHECK) == 0 && elapsed() - begin > seconds) break;
+		if (quota <= 0 && seconds <= 0) break;
+		// トポロジカル順に前向きサンプリングを行い、エビデンスは尤度で重み付けします
+		UD weight = 1.0;
+		for (int i = 0; i < size; i++) {
+			const UD *probs = row(i, state, scratch, digits);
+			if (evidence[i] >= 0) {
+				state[i] = evidence[i];
+				weight *= probs[state[i]];
+				continue;
+			}
+			state[i] = draw(probs, sizes[i], random(thread, counter++));
+		}
+		// 状態毎に重みを集計します
+		acc.weight1 += weight;
+		acc.weight2 += weight * weight;
+		acc.count++;
+		if (weight == 0.0) continue;
+		for (int i = 0; i < size; i++) {
+			acc.sum1[offsets[i] + state[i]] += weight;
+			acc.sum2[offsets[i] + state[i]] += weight * weight;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief 1スレッド分のギブスサンプリングを実行します
+ */
+int CompositeSampling::runGibbs(int thread, long quota) {
+	Accumulator &acc = accumulators[thread];
+	int size = order.size();
+	vector<int> state(size, 0);
+	vector<UD> scores, batch(total, 0.0), scratch;
+	vector<unsigned int> digits;
+	unsigned long long counter = 0;
+	// 前向きサンプリングで初期状態を作成します(エビデンスは固定します)
+	for (int i = 0; i < size; i++) {
+		if (evidence[i] >= 0) { state[i] = evidence[i]; continue; }
+		state[i] = draw(row(i, state, scratch, digits), sizes[i], random(thread, counter++));
+	}
+	// バッチ平均法で標準誤差を求める為、掃引をバッチ単位で集計します
+	long length = (quota > 0 ? quota / SAMPLING_BATCHES : 10);
+	if (length < 1) length = 1;
+	long filled = 0;
+	for (long s = -burnin; quota <= 0 || s < quota; s++) {
+		if (seconds > 0 && (s % SAMPLING_CHECK) == 0 && elapsed() - begin > seconds) break;
+		if (quota <= 0 && seconds <= 0) break;
+		// 非エビデンスノードをマルコフブランケットの条件付き分布から順に再サンプリングします
+		for (int i = 0; i < size; i++) {
+			if (evidence[i] >= 0) continue;
+			const UD *probs = row(i, state, scratch, digits);
+			scores.assign(probs, probs + sizes[i]);
+			for (unsigned int c = 0; c < children[i].size(); c++) {
+				int child = children[i][c];
+				if (order[child]->model != NODE_TABLE) {
+					// 雑音付きOR/MAXの子は自身の状態毎に行を計算します
+					int current = state[i];
+					for (int v = 0; v < sizes[i]; v++) {
+						state[i] = v;
+						scores[v] *= row(child, state, scratch, digits)[state[child]];
+					}
+					state[i] = current;
+					continue;
+				}
+				const UD *cprobs = row(child, state, scratch, digits);
+				// 自身の状態を変えた場合の子の行は桁の重み分だけずれます
+				for (int v = 0; v < sizes[i]; v++) {
+					scores[v] *= cprobs[(v - state[i]) * cstrides[i][c] * sizes[child] + state[child]];
+				}
+			}
+			UD sum = 0.0;
+			for (int v = 0; v < sizes[i]; v++) sum += scores[v];
+			if (sum <= 0.0) continue; // 遷移先がない場合は現状態を維持します
+			state[i] = draw(&scores[0], sizes[i], random(thread, counter++) * sum);
+		}
+		if (s < 0) continue; // 焼きなまし中は集計しません
+		for (int i = 0; i < size; i++) batch[offsets[i] + state[i]] += 1.0;
+		// バッチが満たされた場合は、バッチ平均を集計します
+		if (++filled == length) {
+			for (int j = 0; j < total; j++) {
+				acc.sum1[j] += batch[j];
+				acc.sum2[j] += (batch[j] / length) * (batch[j] / length);
+				batch[j] = 0.0;
+			}
+			acc.weight1 += length;
+			acc.count++;
+			filled = 0;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief 全スレッドの集計結果を縮約して各ノードの事後確率と標準誤差に書き込みます
+ * @param[in] CompositeWork* 書き込むワークスペース
+ */
+int CompositeSampling::reduce(CompositeWork *work) {
+	// スレッド毎の集計結果を合計します
+	Accumulator all;
+	all.sum1.assign(total, 0.0);
+	all.sum2.assign(total, 0.0);
+	all.weight1 = all.weight2 = 0.0;
+	all.count = 0;
+	for (unsigned int t = 0; t < accumulators.size(); t++) {
+		for (int j = 0; j < total; j++) {
+			all.sum1[j] += accumulators[t].sum1[j];
+			all.sum2[j] += accumulators[t].sum2[j];
+		}
+		all.weight1 += accumulators[t].weight1;
+		all.weight2 += accumulators[t].weight2;
+		all.count   += accumulators[t].count;
+	}
+	generated = (method == INFER_GIBBS ? (long)all.weight1 : all.count);
+	if (all.weight1 <= 0.0) {
+		TRACE(TRACE_ERROR, "[CompositeSampling::reduce]no effective samples(" << all.count << ")");
+		return 1;
+	}
+	// 事後確率と標準誤差を求めます
+	for (unsigned int i = 0; i < order.size(); i++) {
+		CompositeState &state = work->states[order[i]->id];
+		state.posterior.assign(sizes[i], 0.0);
+		state.deviation.assign(sizes[i], 0.0);
+		for (int k = 0; k < sizes[i]; k++) {
+			int j = offsets[i] + k;
+			UD p = all.sum1[j] / all.weight1, variance = 0.0;
+			if (method == INFER_GIBBS) {
+				// バッチ平均の分散から求めます(連鎖が混合していることを前提とします)
+				long n = all.count;
+				if (n > 1) variance = (all.sum2[j] / n - p * p) * n / (n - 1) / n;
+			} else {
+				// 比推定量の分散 ∑w^2(I-p)^2/(∑w)^2 から求めます
+				variance = (all.sum2[j] * (1.0 - 2.0 * p) + p * p * all.weight2) / (all.weight1 * all.weight1);
+			}
+			state.posterior[k] = p;
+			state.deviation[k] = (variance > 0.0 ? sqrt(variance) : 0.0);
+		}
+	}
+	return 0;
+}
+
+/*!
+ * @brief カウンタベースの乱数(0以上1未満)を返します
+ * 種、乱数列番号、カウンタのみから値が決まる為、スレッド間で状態を共有しません
+ * @param[in] unsigned long long 乱数列番号(スレッド毎)
+ * @param[in] unsigned long long カウンタ
+ */
+inline UD CompositeSampling::random(unsigned long long stream, unsigned long long counter) {
+	unsigned long long z = seed ^ ((stream + 1) * 0xD1B54A32D192ED03ULL);
+	z += (counter + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*!
+ * @brief 単調増加時計の現在時刻(秒)を返します
+ */
+double CompositeSampling::elapsed() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -0,0 +1,220 @@
+//============================================================================
+// Name        : CompositeSampling.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITESAMPLING_H_
+#define COMPOSITESAMPLING_H_
+
+#include "CompositeNode.h"
+#include "CompositeWork.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief サンプリングによる近似推論(尤度重み付け法、ギブスサンプリング)を行います
+ * 厳密なBPが困難な密なネットワークに対して、サンプル数又は時間予算の範囲で
+ * 事後確率とその標準誤差を求めます
+ */
+class CompositeSampling {
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeSampling();
+
+public:
+	/*!
+	 * @brief 推論対象のノード集合を必須引数とします
+	 * @param[in] NODES* 推論対象のノード集合
+	 */
+	CompositeSampling(NODES *nodes);
+
+public:
+	/*!
+	 * @brief 全スレッドの目標サンプル数を保持します
+	 */
+	long samples;
+
+	/*!
+	 * @brief 時間予算(秒)を保持します(0以下の場合は無制限)
+	 */
+	double seconds;
+
+	/*!
+	 * @brief スレッド数を保持します(0以下の場合はCPU数)
+	 */
+	int threads;
+
+	/*!
+	 * @brief 乱数の種を保持します
+	 */
+	unsigned long long seed;
+
+	/*!
+	 * @brief ギブスサンプリングの焼きなまし(読み捨て)回数を保持します
+	 */
+	long burnin;
+
+	/*!
+	 * @brief 直近の推論で生成したサンプル数を保持します
+	 */
+	long generated;
+
+public:
+	/*!
+	 * @brief 尤度重み付け法で事後確率を求めます
+	 * @param[in] LINE*          エビデンス(ノード名=状態名)
+	 * @param[in] CompositeWork* 事後確率と標準誤差を書き込むワークスペース
+	 * @return 0=正常終了
+	 */
+	int likelihood(LINE *evidences, CompositeWork *work);
+
+	/*!
+	 * @brief マルコフブランケット上のギブスサンプリングで事後確率を求めます
+	 * 標準誤差はバッチ平均法で求める為、連鎖が混合しない(確率0の要素で状態空間が分断される)場合は
+	 * 誤った事後確率に対しても小さな値となります。条件付き確率表に確率0の要素がある場合は尤度重み付け法で求めます
+	 * @param[in] LINE*          エビデンス(ノード名=状態名)
+	 * @param[in] CompositeWork* 事後確率と標準誤差を書き込むワークスペース
+	 * @return 0=正常終了
+	 */
+	int gibbs(LINE *evidences, CompositeWork *work);
+
+public:
+	/*!
+	 * @brief スレッド毎に集計した結果を保持します
+	 */
+	struct Accumulator {
+		vector<UD> sum1;  // 状態毎の重み(件数)の合計
+		vector<UD> sum2;  // 状態毎の重み二乗(バッチ推定値の二乗)の合計
+		UD weight1;       // 重みの合計
+		UD weight2;       // 重み二乗の合計
+		long count;       // サンプル数(バッチ数)
+	};
+
+	/*!
+	 * @brief スレッド毎の処理本体を呼び出します(並列処理用)
+	 */
+	void operator()(long index, int thread);
+
+protected:
+	/*!
+	 * @brief 推論対象のノード集合を保持します
+	 */
+	NODES *nodes;
+
+	/*!
+	 * @brief トポロジカル順に並べたノードを保持します
+	 */
+	vector<CompositeNode*> order;
+
+	/*!
+	 * @brief ノード毎の状態数を保持します
+	 */
+	vector<int> sizes;
+
+	/*!
+	 * @brief ノード毎の状態の集計開始位置を保持します
+	 */
+	vector<int> offsets;
+
+	/*!
+	 * @brief ノード毎の親ノード番号(トポロジカル順の番号)を保持します
+	 */
+	vector<vector<int> > parents;
+
+	/*!
+	 * @brief ノード毎の親ノードの桁の重みを保持します
+	 */
+	vector<vector<int> > strides;
+
+	/*!
+	 * @brief ノード毎の子ノード番号を保持します(マルコフブランケット用)
+	 */
+	vector<vector<int> > children;
+
+	/*!
+	 * @brief 子ノードの条件付き確率表における自身の桁の重みを保持します(childrenと同順)
+	 */
+	vector<vector<int> > cstrides;
+
+	/*!
+	 * @brief ノード毎のエビデンスの状態番号を保持します(エビデンスなしは-1)
+	 */
+	vector<int> evidence;
+
+	/*!
+	 * @brief 全状態数を保持します
+	 */
+	int total;
+
+	/*!
+	 * @brief 実行中の推論方式を保持します
+	 */
+	int method;
+
+	/*!
+	 * @brief 推論開始時刻を保持します
+	 */
+	double begin;
+
+	/*!
+	 * @brief スレッド毎の集計結果を保持します
+	 */
+	vector<Accumulator> accumulators;
+
+protected:
+	/*!
+	 * @brief トポロジカル順、条件付き確率表、エビデンスを準備します
+	 * @param[in] LINE* エビデンス(ノード名=状態名)
+	 */
+	int prepare(LINE *evidences);
+
+	/*!
+	 * @brief ギブスサンプリングで再サンプリングするノード、及びその子の条件付き確率表に確率0の要素があるか確認します
+	 * @return 確率0の要素を持つノード番号(トポロジカル順の番号、ない場合は-1)
+	 */
+	int deterministic();
+
+	/*!
+	 * @brief 1スレッド分の尤度重み付け法を実行します
+	 */
+	int runLikelihood(int thread, long quota);
+
+	/*!
+	 * @brief 1スレッド分のギブスサンプリングを実行します
+	 */
+	int runGibbs(int thread, long quota);
+
+	/*!
+	 * @brief 親ノードの状態の組から条件付き確率表の行の先頭を返します
+	 * 雑音付きOR/MAXのノードは行を計算してscratchに格納します(スレッド毎の領域を与えて下さい)
+	 */
+	inline const UD *row(int node, vector<int> &state, vector<UD> &scratch, vector<unsigned int> &digits);
+
+	/*!
+	 * @brief 累積確率が乱数を超える状態番号を返します
+	 */
+	inline int draw(const UD *probs, int size, UD u);
+
+	/*!
+	 * @brief 全スレッドの集計結果を縮約して各ノードの事後確率と標準誤差に書き込みます
+	 * @param[in] CompositeWork* 書き込むワークスペース
+	 */
+	int reduce(CompositeWork *work);
+
+	/*!
+	 * @brief カウンタベースの乱数(0以上1未満)を返します
+	 * @param[in] unsigned long long 乱数列番号(スレッド毎)
+	 * @param[in] unsigned long long カウンタ
+	 */
+	inline UD random(unsigned long long stream, unsigned long long counter);
+
+	/*!
+	 * @brief 推論開始からの経過秒を返します
+	 */
+	double elapsed();
+
+};
+
+#endif /* COMPOSITESAMPLING_H_ */
@@ -0,0 +1,101 @@
+//============================================================================
+// Name        : CompositeScore.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeScore.h"
+
+/*!
+ * @brief スコア名(k2、bdeu[:等価標本サイズ]、bic、mdl、aic)からスコアを選択します
+ */
+int CompositeScore::parse(string name) {
+	string lower;
+	for (string::iterator iter = name.begin(); iter != name.end(); iter++) lower += (char)tolower(*iter);
+	// bdeu:10のように等価標本サイズを指定できます
+	string::size_type pos = lower.find(':');
+	string kind = lower.substr(0, pos);
+	if (kind == "k2") type = SCORE_K2;
+	else if (kind == "bdeu") type = SCORE_BDEU;
+	else if (kind == "bic" || kind == "mdl") type = SCORE_BIC;
+	else if (kind == "aic") type = SCORE_AIC;
+	else {
+		cout << "[CompositeScore::parse]Unknown Score <- " << name << endl;
+		return 1;
+	}
+	if (pos != string::npos) {
+		double size = atof(lower.substr(pos + 1).c_str());
+		if (type != SCORE_BDEU || size <= 0.0) {
+			cout << "[CompositeScore::parse]Invalid Equivalent Sample Size <- " << name << endl;
+			return 2;
+		}
+		ess = size;
+	}
+	return 0;
+}
+
+/*!
+ * @brief スコア名を返します(BDeuは等価標本サイズを含みます)
+ */
+string CompositeScore::name() {
+	switch (type) {
+	case SCORE_BDEU: {
+		stringstream result;
+		result << "bdeu:" << ess;
+		return result.str();
+	}
+	case SCORE_BIC: return "bic";
+	case SCORE_AIC: return "aic";
+	default: return "k2";
+	}
+}
+
+/*!
+ * @brief 階乗の対数の表を実データの件数まで作成します
+ */
+void CompositeScore::prepare(long rows) {
+	// 件数(Nij+r-1まで)の階乗の対数を累積和で求めておきます
+	rows = (rows > 0 ? rows : 0) + SCORE_FACTORIAL_MARGIN;
+	factorials.assign(rows + 1, 0.0);
+	for (long n = 2; n <= rows; n++) factorials[n] = factorials[n - 1] + log((double)n);
+}
+
+/*!
+ * @brief 家族のスコア(対数)を求めます
+ */
+double CompositeScore::family(double q, double r, vector<double> *counts) {
+	unsigned int qn = (unsigned int)q, rn = (unsigned int)r;
+	double result = 0.0;
+	if (type == SCORE_K2 || type == SCORE_BDEU) {
+		// K2:   Σj{log(r-1)! - log(Nij+r-1)! + Σk log Nijk!}
+		// BDeu: Σj{logΓ(αj) - logΓ(αj+Nij) + Σk(logΓ(αjk+Nijk) - logΓ(αjk))}、αj=ess/q、αjk=ess/(q*r)
+		double aj = ess / q, ajk = ess / (q * r), lgj = lgamma(aj), lgjk = lgamma(ajk);
+		for (unsigned int j = 0; j < qn; j++) {
+			const double *nk = &(*counts)[j * rn];
+			double nj = 0.0, subtotal = 0.0;
+			for (unsigned int k = 0; k < rn; k++) {
+				nj += nk[k];
+				if (type == SCORE_K2) subtotal += logFactorial(nk[k]);
+				else if (nk[k] > 0.0) subtotal += lgamma(ajk + nk[k]) - lgjk;
+			}
+			if (type == SCORE_K2) subtotal += logFactorial(r - 1) - logFactorial(nj + r - 1);
+			else if (nj > 0.0) subtotal += lgj - lgamma(aj + nj);
+			result += subtotal;
+		}
+		return result;
+	}
+	// BIC/AIC: Σj Σk Nijk log(Nijk/Nij)から、パラメータ数q(r-1)に応じた罰則を引きます
+	double total = 0.0;
+	for (unsigned int j = 0; j < qn; j++) {
+		const double *nk = &(*counts)[j * rn];
+		double nj = 0.0;
+		for (unsigned int k = 0; k < rn; k++) nj += nk[k];
+		if (nj <= 0.0) continue;
+		for (unsigned int k = 0; k < rn; k++) {
+			if (nk[k] > 0.0) result += nk[k] * log(nk[k] / nj);
+		}
+		total += nj;
+	}
+	double penalty = q * (r - 1);
+	if (type == SCORE_BIC) penalty *= (total > 1.0 ? log(total) : 0.0) / 2.0;
+	return result - penalty;
+}
@@ -0,0 +1,103 @@
+//============================================================================
+// Name        : CompositeScore.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITESCORE_H_
+#define COMPOSITESCORE_H_
+
+#include "BayesianDefine.h"
+
+/*!
+ * @brief 構造学習のスコアの種類を定義します
+ */
+#define SCORE_K2   0 // Cooper-HerskovitsのK2(BDMの一様事前分布)
+#define SCORE_BDEU 1 // BDeu(等価標本サイズを事前分布の総量とします)
+#define SCORE_BIC  2 // BIC/MDL(対数尤度 - (log N / 2) * パラメータ数)
+#define SCORE_AIC  3 // AIC(対数尤度 - パラメータ数)
+
+/*!
+ * @brief BDeuの等価標本サイズの既定値を定義します
+ */
+#define SCORE_ESS 1.0
+
+/*!
+ * @brief 階乗の対数の表に実データの件数に加えて持たせる余裕(状態数の上限の目安)を定めます
+ */
+#define SCORE_FACTORIAL_MARGIN 256
+
+/*!
+ * @brief 家族(子と親集合)毎に分解可能なスコアを件数表から対数で求めます
+ * 件数表は親の状態の組毎に子の状態数(r)分の件数を並べたもの(q * r件)とし、
+ * 全てのスコアは同じ件数表から求めます(大きい程よい構造とします)
+ */
+class CompositeScore {
+
+public:
+	/*!
+	 * @brief 既定のスコア(K2)で初期化します
+	 */
+	CompositeScore() {
+		this->type = SCORE_K2;
+		this->ess  = SCORE_ESS;
+	}
+
+public:
+	/*!
+	 * @brief スコアの種類(SCORE_K2等)を保持します
+	 */
+	int type;
+
+	/*!
+	 * @brief BDeuの等価標本サイズを保持します
+	 */
+	double ess;
+
+public:
+	/*!
+	 * @brief スコア名(k2、bdeu[:等価標本サイズ]、bic、mdl、aic)からスコアを選択します
+	 * @param[in] string スコア名(大文字小文字は区別しません)
+	 * @return 0=正常終了
+	 */
+	int parse(string name);
+
+	/*!
+	 * @brief スコア名を返します(BDeuは等価標本サイズを含みます)
+	 */
+	string name();
+
+	/*!
+	 * @brief 階乗の対数の表を実データの件数まで作成します
+	 * @param[in] long 実データの件数
+	 */
+	void prepare(long rows);
+
+	/*!
+	 * @brief 家族のスコア(対数)を求めます
+	 * @param[in] double          親の状態の組数(q)
+	 * @param[in] double          子の状態数(r)
+	 * @param[in] vector<double>* 件数表(q * r件)
+	 * @return スコア
+	 */
+	double family(double q, double r, vector<double> *counts);
+
+protected:
+	/*!
+	 * @brief 階乗の対数(log n!)の表を保持します
+	 */
+	vector<double> factorials;
+
+protected:
+	/*!
+	 * @brief 階乗の対数(log n!)を返します(表の範囲外はlgammaで求めます)
+	 */
+	inline double logFactorial(double n) {
+		if (n < 2.0) return 0.0;
+		unsigned long index = (unsigned long)(n + 0.5);
+		if (index < factorials.size()) return factorials[index];
+		return lgamma(n + 1.0);
+	}
+
+};
+
+#endif /* COMPOSITESCORE_H_ */
@@ -0,0 +1,513 @@
+//============================================================================
+// Name        : CompositeStructure.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeStructure.h"
+#include "BayesianProfile.h"
+#include "BayesianTrace.h"
+#include "BayesianThread.h"
+
+/*!
+ * @brief ノード毎に後続の全てのノードとの(条件付き)相互情報量を並列に求める処理を定義します
+ */
+struct CompositeStructureInfo {
+	vector<vector<int> > *codes;    // ノード毎の行毎の状態の番号
+	vector<int> *states;            // ノード毎の状態数
+	int given;                      // 条件とするノードの番号(負の場合は条件なし)
+	vector<vector<double> > *infos; // ノードの組毎の相互情報量(結果)
+	void operator()(long index, int thread) {
+		int size = codes->size(), ri = (*states)[index], rc = (given < 0 ? 1 : (*states)[given]);
+		if (index == given) return;
+		// 後続のノード毎の件数表の位置を求め、実データを1回走査して全ての組の件数を数えます
+		vector<long> offsets(size, 0);
+		long length = 0;
+		for (int j = index + 1; j < size; j++) offsets[j] = length, length += (long)rc * ri * (*states)[j];
+		vector<long> counts(length, 0);
+		vector<int> &ci = (*codes)[index];
+		for (long row = 0; row < (long)ci.size(); row++) {
+			int cc = (given < 0 ? 0 : (*codes)[given][row]);
+			if (ci[row] < 0 || cc < 0) continue;
+			for (int j = index + 1; j < size; j++) {
+				int cj = (*codes)[j][row];
+				if (cj >= 0 && j != given) counts[offsets[j] + ((long)cc * ri + ci[row]) * (*states)[j] + cj]++;
+			}
+		}
+		// I(X;Y|C) = Σ Ncxy/N log(Ncxy Nc / (Ncx Ncy))、条件なしの場合はC=1状態とします
+		for (int j = index + 1; j < size; j++) {
+			if (j == given) continue;
+			int rj = (*states)[j];
+			double n = 0.0, info = 0.0;
+			vector<double> nx(ri), ny(rj);
+			for (int c = 0; c < rc; c++) {
+				const long *nxy = &counts[offsets[j] + (long)c * ri * rj];
+				nx.assign(ri, 0.0), ny.assign(rj, 0.0);
+				double nc = 0.0;
+				for (int x = 0; x < ri; x++) {
+					for (int y = 0; y < rj; y++) nx[x] += nxy[x * rj + y], ny[y] += nxy[x * rj + y];
+					nc += nx[x];
+				}
+				for (int x = 0; x < ri && nc > 0.0; x++) {
+					for (int y = 0; y < rj; y++) {
+						double v = nxy[x * rj + y];
+						if (v > 0.0) info += v * log(v * nc / (nx[x] * ny[y]));
+					}
+				}
+				n += nc;
+			}
+			// 各スレッドはindexの行とindexの列のみに書き込む為、排他は不要です
+			(*infos)[index][j] = (*infos)[j][index] = (n > 0.0 ? info / n : 0.0);
+		}
+	}
+};
+
+/*!
+ * @brief ノード毎の親候補の選び直しを並列に処理する内容を定義します
+ */
+struct CompositeStructureRefine {
+	CompositeStructure *structure; // 構造学習
+	CHARS *titles;                 // ノード名集合
+	vector<CHARS> *parents;        // ノード毎の親
+	vector<CHARS> *selected;       // ノード毎の親候補(結果)
+	volatile long errors;          // 失敗したノード数
+	void operator()(long index, int thread) {
+		string child = (*titles)[index];
+		CHARS &current = (*parents)[index], &result = (*selected)[index];
+		double origin;
+		if (structure->getScore(child, &current, &origin) != 0) {
+			__sync_fetch_and_add(&errors, 1);
+			return;
+		}
+		// 現在の親は残し、親でないノードを親に加えた場合の改善量を求めます
+		result = current;
+		vector<pair<double, int> > gains;
+		for (unsigned int j = 0; j < titles->size(); j++) {
+			if ((long)j == index || find(current.begin(), current.end(), (*titles)[j]) != current.end()) continue;
+			CHARS family(current);
+			family.push_back((*titles)[j]);
+			double p;
+			if (structure->getScore(child, &family, &p) != 0) {
+				__sync_fetch_and_add(&errors, 1);
+				return;
+			}
+			// 改善量の大きい順、同じ場合はノード名集合の順とします
+			gains.push_back(pair<double, int>(origin - p, j));
+		}
+		sort(gains.begin(), gains.end());
+		for (unsigned int k = 0; k < gains.size() && (int)result.size() < structure->sparse; k++) {
+			result.push_back((*titles)[gains[k].second]);
+		}
+	}
+};
+
+/*!
+ * @brief 全ての構造学習で共有する家族スコアのキャッシュを返します
+ */
+CompositeCache<double> &CompositeStructure::scores() {
+	static CompositeCache<double> storage(STRUCTURE_CACHE_CAPACITY);
+	return storage;
+}
+
+/*!
+ * 指定実データからネットワーク構造を作成し、その定義をファイル出力します
+ */
+int CompositeStructure::createNodeRelation() {
+	PROFILE_SCOPE(PROFILE_K2);
+	CHARS titles(*base->cnames()); // ノード名集合
+	// 並列に参照する前に、全列の一意値と状態名を作成します
+	if (prepare(&titles) != 0) {
+		cout << "[CompositeStructure::createNodeRelation]Function of prepare Failure" << endl;
+		return 1;
+	}
+	candidates.clear();
+	if (sparse > 0 && preselect(&titles) != 0) {
+		cout << "[CompositeStructure::createNodeRelation]Function of preselect Failure" << endl;
+		return 2;
+	}
+	// 構造を学習し、親候補が変わらなくなるまで選び直して学習し直します(前回の構造から再開します)
+	vector<CHARS> parents(titles.size());
+	for (int round = 0; ; round++) {
+		if (searchStructure(&titles, &parents) != 0) {
+			cout << "[CompositeStructure::createNodeRelation]Function of searchStructure Failure" << endl;
+			return 3;
+		}
+		if (candidates.empty() || round >= refines) break;
+		bool changed = false;
+		if (refine(&titles, &parents, &changed) != 0) {
+			cout << "[CompositeStructure::createNodeRelation]Function of refine Failure" << endl;
+			return 4;
+		}
+		TRACE(TRACE_INFO, "[CompositeStructure::createNodeRelation]Refine " << round << (changed ? " Changed" : " Unchanged"));
+		if (!changed) break;
+	}
+	traceScores("CompositeStructure::createNodeRelation");
+	// 作成した親子関係を子の順にファイルに書き出します(スレッド数によらず同じ定義となります)
+	if (createNodeDefine(RELATION_FILE, &parents, &titles) != 0) {
+		cout << "[CompositeStructure::createNodeRelation]Function of createNodeDefine Failure" << endl;
+		return 5;
+	}
+	return 0;
+}
+
+/*!
+ * @brief 親を追加できるか否か(親候補に含まれ、親の数が最大数未満であること)を返します
+ */
+bool CompositeStructure::allowed(string child, string parent, int count) {
+	if (maxParents > 0 && count >= maxParents) return false;
+	if (candidates.empty()) return true;
+	map<string, CHARS>::iterator found = candidates.find(child);
+	if (found == candidates.end()) return false;
+	return find(found->second.begin(), found->second.end(), parent) != found->second.end();
+}
+
+/*!
+ * @brief 全ての列の組の(条件付き)相互情報量を求めます
+ */
+int CompositeStructure::mutualInfo(CHARS *titles, vector<vector<double> > *infos, int given) {
+	int size = titles->size();
+	// 列を状態の番号に変換しておきます(以降は文字列を比較しません)
+	vector<vector<int> > codes(size);
+	vector<int> states(size, 0);
+	for (int i = 0; i < size; i++) {
+		CHARS &elements = domains[(*titles)[i]];
+		if (base->encode((*titles)[i], &elements, &codes[i]) != 0) return 1;
+		states[i] = elements.size();
+	}
+	infos->assign(size, vector<double>(size, 0.0));
+	CompositeStructureInfo work;
+	work.codes  = &codes;
+	work.states = &states;
+	work.given  = given;
+	work.infos  = infos;
+	parallel(threads, size, &work);
+	return 0;
+}
+
+/*!
+ * @brief 全ての列の組の相互情報量を求め、ノード毎に大きい順にsparse個を親候補とします
+ */
+int CompositeStructure::preselect(CHARS *titles) {
+	int size = titles->size();
+	vector<vector<double> > infos;
+	if (mutualInfo(titles, &infos) != 0) return 1;
+	// 相互情報量の大きい順(同じ場合はノード名集合の順)に親候補とします
+	for (int i = 0; i < size; i++) {
+		vector<pair<double, int> > order;
+		for (int j = 0; j < size; j++) {
+			if (j != i) order.push_back(pair<double, int>(-infos[i][j], j));
+		}
+		sort(order.begin(), order.end());
+		CHARS &selected = candidates[(*titles)[i]];
+		selected.clear();
+		for (int k = 0; k < (int)order.size() && k < sparse; k++) selected.push_back((*titles)[order[k].second]);
+	}
+	TRACE(TRACE_INFO, "[CompositeStructure::preselect]Candidates <- " << (sparse < size - 1 ? sparse : size - 1) << "/" << (size - 1));
+	return 0;
+}
+
+/*!
+ * @brief 学習した構造から親候補を選び直します
+ */
+int CompositeStructure::refine(CHARS *titles, vector<CHARS> *parents, bool *changed) {
+	vector<CHARS> selected(titles->size());
+	CompositeStructureRefine work;
+	work.structure = this;
+	work.titles    = titles;
+	work.parents   = parents;
+	work.selected  = &selected;
+	work.errors    = 0;
+	parallel(threads, titles->size(), &work);
+	if (work.errors != 0) {
+		cout << "[CompositeStructure::refine]could not score " << work.errors << " nodes" << endl;
+		return 1;
+	}
+	*changed = false;
+	for (unsigned int i = 0; i < titles->size(); i++) {
+		CHARS &next = selected[i], &previous = candidates[(*titles)[i]];
+		CHARS a(next), b(previous);
+		sort(a.begin(), a.end());
+		sort(b.begin(), b.end());
+		if (a != b) *changed = true;
+		previous.swap(next);
+	}
+	return 0;
+}
+
+/*!
+ * @brief PDAGにMeekの規則(R1〜R3)を変化がなくなるまで適用し、無向辺に向きを伝播します
+ */
+int CompositeStructure::propagate(vector<vector<char> > *graph) {
+	vector<vector<char> > &g = *graph;
+	int size = g.size(), oriented = 0;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int a = 0; a < size; a++) {
+			for (int b = 0; b < size; b++) {
+				// 無向辺a-bのみを対象とします
+				if (a == b || !g[a][b] || !g[b][a]) continue;
+				bool orient = false;
+				for (int c = 0; c < size && !orient; c++) {
+					if (c == a || c == b) continue;
+					// R1: c->a、a-b、cとbが隣接しない場合はa->b
+					if (g[c][a] && !g[a][c] && !g[c][b] && !g[b][c]) orient = true;
+					// R2: a->c->b、a-bの場合はa->b
+					else if (g[a][c] && !g[c][a] && g[c][b] && !g[b][c]) orient = true;
+				}
+				// R3: a-c、a-d、c->b、d->b、cとdが隣接しない場合はa->b
+				for (int c = 0; c < size && !orient; c++) {
+					if (c == a || c == b || !g[a][c] || !g[c][a] || !g[c][b] || g[b][c]) continue;
+					for (int d = c + 1; d < size && !orient; d++) {
+						if (d == a || d == b || !g[a][d] || !g[d][a] || !g[d][b] || g[b][d]) continue;
+						if (!g[c][d] && !g[d][c]) orient = true;
+					}
+				}
+				if (orient) {
+					g[b][a] = 0;
+					oriented++;
+					changed = true;
+				}
+			}
+		}
+	}
+	return oriented;
+}
+
+/*!
+ * @brief PDAGを、有向辺とv構造を変えないDAGに拡張します(Dor-Tarsi)
+ */
+int CompositeStructure::extend(CHARS *titles, vector<vector<char> > *graph, vector<CHARS> *parents) {
+	vector<vector<char> > &g = *graph;
+	int size = g.size(), ret = 0;
+	vector<char> removed(size, 0);
+	parents->assign(size, CHARS());
+	// 出る有向辺がなく、無向辺の隣接ノードが他の全ての隣接ノードと隣接するノードを順に取り除きます
+	// 取り除いたノードの親はまだ残っているノードのみの為、取り除いた順の逆がトポロジカル順となります
+	for (int left = size; left > 0; left--) {
+		int chosen = -1, sink = -1;
+		for (int x = 0; x < size && chosen < 0; x++) {
+			if (removed[x]) continue;
+			bool outgoing = false;
+			for (int y = 0; y < size && !outgoing; y++) {
+				if (!removed[y] && g[x][y] && !g[y][x]) outgoing = true;
+			}
+			if (outgoing) continue;
+			if (sink < 0) sink = x;
+			bool clique = true;
+			for (int y = 0; y < size && clique; y++) {
+				if (removed[y] || y == x || !g[x][y] || !g[y][x]) continue;
+				for (int z = 0; z < size && clique; z++) {
+					if (removed[z] || z == x || z == y || (!g[x][z] && !g[z][x])) continue;
+					if (!g[y][z] && !g[z][y]) clique = false;
+				}
+			}
+			if (clique) chosen = x;
+		}
+		if (chosen < 0) {
+			// 拡張できない場合は、シンク(なければ先頭のノード)の残る辺を全て入る辺とします
+			chosen = (sink >= 0 ? sink : 0);
+			while (removed[chosen]) chosen++;
+			TRACE(TRACE_INFO, "[CompositeStructure::extend]No Consistent Extension <- " << (*titles)[chosen]);
+			ret = 1;
+		}
+		for (int y = 0; y < size; y++) {
+			if (!removed[y] && y != chosen && (g[y][chosen] || g[chosen][y])) (*parents)[chosen].push_back((*titles)[y]);
+		}
+		removed[chosen] = 1;
+	}
+	return ret;
+}
+
+/*!
+ * @brief 家族(子と親集合)のスコアを返します(キャッシュにない場合のみcalScoreで求めます)
+ */
+int CompositeStructure::getScore(string child, CHARS *parents, double *result) {
+	// 親集合は順不同の為、整列してキーを作成します(実データの識別番号はプロセス全体で一意な為、別のデータや更新前のデータと区別できます)
+	CHARS sorted(*parents);
+	sort(sorted.begin(), sorted.end());
+	stringstream key;
+	key << base->revcnt() << '#' << score.name() << '#' << child << '|';
+	for (CHARS::iterator iter = sorted.begin(); iter != sorted.end(); iter++) {
+		key << (iter != sorted.begin() ? "\t" : "") << *iter;
+	}
+	if (scores().find(key.str(), result)) return 0;
+	if (calScore(child, parents, result) != 0) return 1;
+	scores().insert(key.str(), *result, sizeof(double));
+	return 0;
+}
+
+/*!
+ * @brief 全ノードの一意値と状態名を求めます(並列に件数を数える前に呼び出します)
+ */
+int CompositeStructure::prepare(CHARS *titles) {
+	if (base->prepare(titles, threads) != 0) return 1;
+	for (CHARS::iterator iter = titles->begin(); iter != titles->end(); iter++) {
+		PROBS temp; long total = 0;
+		if (base->prob(*iter, &temp, &total) != 0) return 2;
+		CHARS &elements = domains[*iter];
+		elements.clear();
+		for (PROBS::iterator itert = temp.begin(); itert != temp.end(); itert++) elements.push_back(itert->first);
+	}
+	return 0;
+}
+
+/*!
+ * @brief 家族のスコアを実データの件数表から求めます
+ */
+int CompositeStructure::calScore(string child, CHARS *parents, double *result) {
+	map<string, CHARS>::iterator found = domains.find(child);
+	if (found == domains.end()) {
+		cout << "[CompositeStructure::calScore]Not Prepared <- " << child << endl;
+		return 1;
+	}
+	for (CHARS::iterator iter = parents->begin(); iter != parents->end(); iter++) {
+		if (domains.find(*iter) != domains.end()) continue;
+		cout << "[CompositeStructure::calScore]Not Prepared <- " << *iter << endl;
+		return 1;
+	}
+	double q = 0.0;
+	vector<double> counts;
+	if (countFamily(child, parents, &q, &counts) != 0) {
+		cout << "[CompositeStructure::calScore]Function of countFamily Failure" << endl;
+		return 2;
+	}
+	*result = score.family(q, found->second.size(), &counts);
+	return 0;
+}
+
+/*!
+ * @brief 家族の件数表(親の状態の組毎に子の状態数分の件数)を作成します
+ */
+int CompositeStructure::countFamily(string child, CHARS *parents, double *q, vector<double> *counts) {
+	counts->clear();
+	if (parents->empty()) {
+		// 親がない場合は全件から数えます
+		PROBS temp; long total = 0;
+		if (base->prob(child, &temp, &total) != 0) return 1;
+		for (PROBS::iterator iter = temp.begin(); iter != temp.end(); iter++) counts->push_back(iter->second);
+	} else {
+		COND cond;
+		if (countPattern(child, &cond, parents->begin(), parents->end(), counts) != 0) return 2;
+	}
+	*q = (double)counts->size() / domains.find(child)->second.size();
+	return 0;
+}
+
+/*!
+ * @brief 親の状態の組を再帰的に列挙して件数表に子の状態毎の件数を追加します
+ */
+int CompositeStructure::countPattern(string child, COND *cond, CHARS::iterator bn, CHARS::iterator en, vector<double> *counts) {
+	if (bn == en) {
+		// 親の状態の組に合致する子の状態毎の件数を求めます(件数0の場合も0として扱います)
+		PROBS temp; long total;
+		if (base->prob(child, cond, &temp, &total, false) != 0) return 1;
+		for (PROBS::iterator iter = temp.begin(); iter != temp.end(); iter++) counts->push_back(iter->second);
+		return 0;
+	}
+	// 親の全状態について処理を行います
+	CHARS &elements = domains.find(*bn)->second;
+	for (CHARS::iterator iter = elements.begin(); iter != elements.end(); iter++) {
+		cond->push_back(COND_PAIR(*bn, *iter));
+		int ret = countPattern(child, cond, bn + 1, en, counts);
+		cond->pop_back();
+		if (ret != 0) return ret;
+	}
+	return 0;
+}
+
+/*!
+ * @brief 家族スコアのキャッシュの累計を出力します
+ */
+void CompositeStructure::traceScores(const char *caller) {
+	CompositeCache<double> &cache = scores();
+	TRACE(TRACE_INFO, "[" << caller << "]Score Cache hits=" << cache.hits << " misses=" << cache.misses
+		<< " rate=" << cache.rate() << " size=" << cache.size() << " evictions=" << cache.evictions);
+}
+
+/*!
+ * @brief 親子関係をその定義ファイルに書き出します
+ */
+int CompositeStructure::createNodeDefine(string file, RELATES *relations, CHARS *titles) {
+	try {
+		ofstream ofs(file.c_str(), ios::out);
+		// ノード数が多い場合は、隣接行列ではなく辺の一覧を書き出します
+		if (titles->size() > RELATION_DENSE_LIMIT) {
+			ofs << RELATION_EDGES << endl;
+			for (CHARS::iterator iter1 = titles->begin(); iter1 != titles->end(); iter1++) {
+				// 全てのノードを宣言し、子を持つ場合は続けて辺を書き出します
+				ofs << *iter1 << endl;
+				RELATES::iterator result = relations->find(*iter1);
+				if (result == relations->end()) continue;
+				CHARS *line = result->second;
+				for (CHARS::iterator iter2 = line->begin(); iter2 != line->end(); iter2++) {
+					ofs << *iter1 << "," << *iter2 << endl;
+				}
+			}
+			ofs.close();
+			return 0;
+		}
+		// タイトル行を書き込みます
+		for (CHARS::iterator iter = titles->begin(); iter != titles->end(); iter++) {
+			ofs << "," << *iter;
+		}
+		ofs << endl;
+		// 親子関係を書き込みます
+		for (CHARS::iterator iter1 = titles->begin(); iter1 != titles->end(); iter1++) {
+			// 見出し列を書き出します
+			ofs << *iter1;
+			// 親がない場合は、全て0を書き出します
+			RELATES::iterator result = relations->find(*iter1);
+			if (result == relations->end()) {
+				for (CHARS::iterator iter2 = titles->begin(); iter2 != titles->end(); iter2++) {
+					ofs << ",0";
+				}
+				ofs << endl;
+			} else {
+				// 親子関係を書き出します
+				CHARS *line = result->second;
+				for (CHARS::iterator iter2 = titles->begin(); iter2 != titles->end(); iter2++) {
+					CHARS::iterator result = find(line->begin(), line->end(), *iter2);
+					if (result == line->end()) ofs << ",0";
+					else ofs << ",1";
+				}
+				ofs << endl;
+			}
+		}
+		ofs.close();
+
+	} catch (...) {
+		cout << "[CompositeStructure::createNodeDefine]Nodes.csv Create Failure" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief ノード毎の親(ノード名集合の順)から親子関係を作成して定義ファイルに書き出します
+ */
+int CompositeStructure::createNodeDefine(string file, vector<CHARS> *parents, CHARS *titles) {
+	RELATES relations; // 親子関係(Map-Key=親,子集合)
+	for (unsigned int i = 0; i < titles->size(); i++) {
+		CHARS &line = (*parents)[i];
+		for (CHARS::iterator itero = line.begin(); itero != line.end(); itero++) {
+			vector<string> *children;
+			map<string, vector<string>* >::iterator iterr = relations.find(*itero);
+			if (iterr == relations.end()) {
+				// 親をキーとして新規追加します
+				children = new vector<string>();
+				relations.insert(pair<string, vector<string>* >(*itero, children));
+				TRACE(TRACE_DEBUG, "[CompositeStructure::createNodeDefine]New Parent <- " << *itero);
+			} else {
+				// 既存子集合を利用します
+				children = iterr->second;
+				TRACE(TRACE_DEBUG, "[CompositeStructure::createNodeDefine]Always Parent <- " << *itero);
+			}
+			children->push_back((*titles)[i]);
+			TRACE(TRACE_DEBUG, "[CompositeStructure::createNodeDefine]Add Child <- " << (*titles)[i]);
+		}
+	}
+	int ret = createNodeDefine(file, &relations, titles);
+	for (RELATES::iterator iter = relations.begin(); iter != relations.end(); iter++) delete iter->second;
+	return ret;
+}
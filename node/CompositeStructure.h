@@ -0,0 +1,256 @@
+//============================================================================
+// Name        : CompositeStructure.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITESTRUCTURE_H_
+#define COMPOSITESTRUCTURE_H_
+
+#include "BayesianDefine.h"
+#include "ProbabilityBase.h"
+#include "CompositeCache.h"
+#include "CompositeScore.h"
+
+/*!
+ * @brief 家族スコアキャッシュの既定の保持容量(バイト)を定義します
+ */
+#define STRUCTURE_CACHE_CAPACITY (64UL * 1024 * 1024)
+
+/*!
+ * @brief 親候補の事前選択(Sparse Candidate)の既定値を定義します
+ */
+#define SPARSE_CANDIDATES 0 // ノード毎の親候補数(0の場合は事前選択しません)
+#define SPARSE_REFINES    2 // 学習した構造から親候補を選び直す最大回数
+
+/*!
+ * @brief 実データからネットワーク構造を学習する処理の基底を定義します
+ * スコアは家族(子と親集合)毎に分解できる為、(実データ、子、整列した親集合)をキーとして
+ * 全ての構造学習で共有するキャッシュに保持し、同じ家族を再度数え上げないようにします
+ */
+class CompositeStructure {
+	friend struct CompositeStructureInfo;
+	friend struct CompositeStructureRefine;
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeStructure() {}
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositeStructure(ProbabilityBase *target) {
+		base    = target;
+		threads    = 0;
+		seed       = 20100316ULL;
+		sparse     = SPARSE_CANDIDATES;
+		refines    = SPARSE_REFINES;
+		maxParents = 0;
+		score.prepare(target->rowcnt());
+	}
+
+	/*!
+	 * @brief 終了処理を行います
+	 */
+	virtual ~CompositeStructure() {}
+
+public:
+	/*!
+	 * @brief 構造の探索に用いるスレッド数を保持します(0以下の場合はCPU数)
+	 * 結果はスレッド数によらず同じになります
+	 */
+	int threads;
+
+	/*!
+	 * @brief 乱数の種を保持します(同じ種からは同じ構造を作成します)
+	 */
+	unsigned long long seed;
+
+	/*!
+	 * @brief 家族のスコアを保持します(既定はK2、score.parseで選択します)
+	 */
+	CompositeScore score;
+
+	/*!
+	 * @brief ノード毎の親候補数を保持します(0以下の場合は全てのノードを親候補とします)
+	 * 相互情報量の大きい順に選び、以降は学習した構造のスコアの改善量で選び直します
+	 */
+	int sparse;
+
+	/*!
+	 * @brief 親候補を選び直す最大回数を保持します(候補が変わらなくなった場合はその時点で終了します)
+	 */
+	int refines;
+
+	/*!
+	 * @brief ノード毎の親の最大数を保持します(0以下の場合は無制限)
+	 */
+	int maxParents;
+
+public:
+	/*!
+	 * @brief 指定実データからネットワーク構造を作成し、その定義をファイル出力します
+	 * 親候補を事前選択する場合は、構造の学習と親候補の選び直しを候補が変わらなくなるまで繰り返します
+	 */
+	virtual int createNodeRelation();
+
+	/*!
+	 * @brief 全ての構造学習で共有する家族スコアのキャッシュを返します
+	 * 容量の変更はresize、ヒット率はhits/misses/rate()で参照します
+	 */
+	static CompositeCache<double> &scores();
+
+protected:
+	/*!
+	 * @brief 読み込み実データ
+	 */
+	ProbabilityBase *base;
+
+	/*!
+	 * @brief ノード毎の状態名を保持します(prepareで求めます)
+	 */
+	map<string, CHARS> domains;
+
+	/*!
+	 * @brief ノード毎の親候補を保持します(空の場合は全てのノードを親候補とします)
+	 */
+	map<string, CHARS> candidates;
+
+protected:
+	/*!
+	 * @brief ノード毎の親を学習します(学習方式毎に実装します)
+	 * @param[in]     CHARS*         ノード名集合
+	 * @param[in,out] vector<CHARS>* ノード毎(ノード名集合の順)の親(前回の学習結果を渡します、初回は全て空)
+	 * @return 0=正常終了
+	 */
+	virtual int searchStructure(CHARS *titles, vector<CHARS> *parents) = 0;
+
+	/*!
+	 * @brief 親を追加できるか否か(親候補に含まれ、親の数が最大数未満であること)を返します
+	 * @param[in] string 子のノード名
+	 * @param[in] string 親のノード名
+	 * @param[in] int    子の現在の親の数
+	 */
+	bool allowed(string child, string parent, int count);
+
+	/*!
+	 * @brief 全ての列の組の(条件付き)相互情報量を求めます
+	 * 列は状態の番号に変換しておき、ノード毎に実データを1回走査して後続の全てのノードとの件数を数えます
+	 * @param[in]  CHARS*                   ノード名集合
+	 * @param[out] vector<vector<double> >* ノードの組毎の相互情報量(対称、条件とするノードの行と列は0)
+	 * @param[in]  int                      条件とするノードの番号(負の場合は条件なし)
+	 * @return 0=正常終了
+	 */
+	int mutualInfo(CHARS *titles, vector<vector<double> > *infos, int given = -1);
+
+	/*!
+	 * @brief 全ての列の組の相互情報量を求め、ノード毎に大きい順にsparse個を親候補とします
+	 * @param[in] CHARS* ノード名集合
+	 * @return 0=正常終了
+	 */
+	int preselect(CHARS *titles);
+
+	/*!
+	 * @brief 学習した構造から親候補を選び直します
+	 * 現在の親は残し、残りは親に加えた場合の家族スコアの改善量が大きい順に選びます
+	 * @param[in]  CHARS*         ノード名集合
+	 * @param[in]  vector<CHARS>* ノード毎の親
+	 * @param[out] bool*          親候補が変わったか否か
+	 * @return 0=正常終了
+	 */
+	int refine(CHARS *titles, vector<CHARS> *parents, bool *changed);
+
+	/*!
+	 * @brief 部分有向グラフ(PDAG)にMeekの規則(R1〜R3)を変化がなくなるまで適用し、無向辺に向きを伝播します
+	 * PDAGはgraph[i][j]=1でiからjへの印を表し、両方向に印がある場合は無向辺とします
+	 * @param[in,out] vector<vector<char> >* PDAG
+	 * @return 向きを決めた辺の数
+	 */
+	int propagate(vector<vector<char> > *graph);
+
+	/*!
+	 * @brief PDAGを、有向辺とv構造を変えないDAGに拡張します(Dor-Tarsi)
+	 * 拡張できない場合は、閉路を作らないよう向きを決めてDAGとします(トレースに出力します)
+	 * @param[in]  CHARS*                  ノード名集合
+	 * @param[in]  vector<vector<char> >*  PDAG
+	 * @param[out] vector<CHARS>*          ノード毎(ノード名集合の順)の親
+	 * @return 0=正常終了、1=拡張できない為、向きを補いました
+	 */
+	int extend(CHARS *titles, vector<vector<char> > *graph, vector<CHARS> *parents);
+
+	/*!
+	 * @brief 全ノードの一意値と状態名を求めます(並列に件数を数える前に呼び出します)
+	 * @param[in] CHARS* ノード名集合
+	 * @return 0=正常終了
+	 */
+	int prepare(CHARS *titles);
+
+	/*!
+	 * @brief 家族(子と親集合)のスコアを返します(キャッシュにない場合のみcalScoreで求めます)
+	 * @param[in]  string  子のノード名
+	 * @param[in]  CHARS*  親のノード名(順不同)
+	 * @param[out] double* スコア
+	 * @return 0=正常終了
+	 */
+	int getScore(string child, CHARS *parents, double *result);
+
+	/*!
+	 * @brief 家族のスコアを実データの件数表から求めます
+	 */
+	virtual int calScore(string child, CHARS *parents, double *result);
+
+	/*!
+	 * @brief 家族の件数表(親の状態の組毎に子の状態数分の件数)を作成します
+	 * @param[in]  string          子のノード名
+	 * @param[in]  CHARS*          親のノード名
+	 * @param[out] double*         親の状態の組数(q)
+	 * @param[out] vector<double>* 件数表(q * r件)
+	 * @return 0=正常終了
+	 */
+	int countFamily(string child, CHARS *parents, double *q, vector<double> *counts);
+
+	/*!
+	 * @brief 親の状態の組を再帰的に列挙して件数表に子の状態毎の件数を追加します
+	 */
+	int countPattern(string child, COND *cond, CHARS::iterator bn, CHARS::iterator en, vector<double> *counts);
+
+	/*!
+	 * @brief カウンタベースの乱数(0以上1未満)を返します
+	 * 種、乱数列番号、カウンタのみから値が決まる為、スレッド間で状態を共有しません
+	 * @param[in] unsigned long long 乱数列番号
+	 * @param[in] unsigned long long カウンタ
+	 */
+	inline double random(unsigned long long stream, unsigned long long counter) {
+		unsigned long long z = seed ^ ((stream + 1) * 0xD1B54A32D192ED03ULL);
+		z += (counter + 1) * 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z = z ^ (z >> 31);
+		return (z >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/*!
+	 * @brief 家族スコアのキャッシュの累計を出力します
+	 */
+	void traceScores(const char *caller);
+
+	/*!
+	 * @brief 親子関係をその定義ファイルに書き出します
+	 * ノード数がRELATION_DENSE_LIMITを超える場合は隣接行列ではなく辺の一覧(parent,child)で書き出します
+	 */
+	int createNodeDefine(string file, RELATES *relations, CHARS *titles);
+
+	/*!
+	 * @brief ノード毎の親(ノード名集合の順)から親子関係を作成して定義ファイルに書き出します
+	 * 子はノード名集合の順に並べる為、同じ親からは常に同じ定義となります
+	 * @param[in] string         定義ファイル名
+	 * @param[in] vector<CHARS>* ノード毎の親
+	 * @param[in] CHARS*         ノード名集合
+	 */
+	int createNodeDefine(string file, vector<CHARS> *parents, CHARS *titles);
+
+};
+
+#endif /* COMPOSITESTRUCTURE_H_ */
@@ -0,0 +1,59 @@
+//============================================================================
+// Name        : CompositeTree.cpp
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#include "CompositeTree.h"
+#include "BayesianTrace.h"
+
+/*!
+ * @brief 相互情報量の最大全域木を作成し、ノード毎の親を返します(前回の親は用いません)
+ */
+int CompositeTree::searchStructure(CHARS *titles, vector<CHARS> *parents) {
+	int size = titles->size(), given = -1;
+	if (!classname.empty()) {
+		CHARS::iterator found = find(titles->begin(), titles->end(), classname);
+		if (found == titles->end()) {
+			cout << "[CompositeTree::searchStructure]Not Found Class <- " << classname << endl;
+			return 1;
+		}
+		given = found - titles->begin();
+	}
+	// TANの場合はクラスを条件とする条件付き相互情報量を求めます
+	vector<vector<double> > infos;
+	if (mutualInfo(titles, &infos, given) != 0) {
+		cout << "[CompositeTree::searchStructure]Function of mutualInfo Failure" << endl;
+		return 2;
+	}
+	// Prim法で最大全域木を作成します(同じ値の場合は番号の小さいノードとします)
+	// 木に加えたノードの親は、加えた時点で最も相互情報量の大きい木のノードとします
+	vector<char> joined(size, 0);
+	vector<int> from(size, -1);
+	vector<double> weights(size, -HUGE_VAL);
+	if (given >= 0) joined[given] = 1;
+	double total = 0.0;
+	int trees = 0;
+	for (int left = size - (given >= 0 ? 1 : 0); left > 0; left--) {
+		int next = -1;
+		for (int v = 0; v < size; v++) {
+			if (joined[v]) continue;
+			if (next < 0 || weights[v] > weights[next]) next = v;
+		}
+		// 木のノードと辺で結べない場合(親候補で辺を制限した場合)は、新たな木の根とします
+		if (from[next] < 0) trees++;
+		else total += weights[next];
+		joined[next] = 1;
+		(*parents)[next].clear();
+		if (from[next] >= 0) (*parents)[next].push_back((*titles)[from[next]]);
+		if (given >= 0) (*parents)[next].push_back((*titles)[given]);
+		for (int v = 0; v < size; v++) {
+			if (joined[v] || infos[next][v] <= weights[v]) continue;
+			if (!allowed((*titles)[v], (*titles)[next], 0) && !allowed((*titles)[next], (*titles)[v], 0)) continue;
+			weights[v] = infos[next][v];
+			from[v] = next;
+		}
+	}
+	if (given >= 0) (*parents)[given].clear();
+	TRACE(TRACE_INFO, "[CompositeTree::searchStructure]" << (given >= 0 ? "TAN" : "Chow-Liu") << " Trees=" << trees << " Mutual Information <- " << total);
+	return 0;
+}
@@ -0,0 +1,48 @@
+//============================================================================
+// Name        : CompositeTree.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITETREE_H_
+#define COMPOSITETREE_H_
+
+#include "CompositeStructure.h"
+
+/*!
+ * @brief 相互情報量の最大全域木で構造を学習します(Chow-Liu木、TAN)
+ * クラス列の指定がない場合は全ノードの相互情報量でChow-Liu木を作成し、先頭のノードを根として向きを決めます
+ * 各ノードの親は高々1つの為、λ/πメッセージの伝播で厳密に推論できます
+ * クラス列を指定した場合は、クラスを条件とする条件付き相互情報量で特徴の木を作成し、
+ * クラスを全ての特徴の親に加えます(TAN、特徴の親は高々2つです)
+ * 全ての組の相互情報量は実データを状態の番号に変換して求める為、スコアによる探索に比べて非常に高速です
+ */
+class CompositeTree : public CompositeStructure {
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeTree();
+
+public:
+	/*!
+	 * @brief 処理対象実データを必須とします
+	 */
+	CompositeTree(ProbabilityBase *target) : CompositeStructure(target) {}
+
+public:
+	/*!
+	 * @brief クラス列名を保持します(空の場合はChow-Liu木、指定した場合はTANを作成します)
+	 */
+	string classname;
+
+protected:
+	/*!
+	 * @brief 相互情報量の最大全域木を作成し、ノード毎の親を返します(前回の親は用いません)
+	 * 親候補を事前選択した場合は、候補の組のみを辺とします(木にならない場合は森となります)
+	 */
+	int searchStructure(CHARS *titles, vector<CHARS> *parents);
+
+};
+
+#endif /* COMPOSITETREE_H_ */
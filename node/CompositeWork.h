@@ -0,0 +1,84 @@
+//============================================================================
+// Name        : CompositeWork.h
+// Version     : 1.0
+// Description : Bayesian Network Processing in C++, Ansi-style
+//============================================================================
+#ifndef COMPOSITEWORK_H_
+#define COMPOSITEWORK_H_
+
+#include "CompositeNode.h"
+#include "BayesianArena.h"
+
+/*!
+ * @brief 1ノード分の推論状態(BP用の変数)を定義します
+ * 配列は全てノードの要素名(elements)の順、メッセージは親ノード(parentNodes)の順に保持します
+ */
+struct CompositeState {
+	vector<UD> eviPai;             // πエビデンス(π(X|e+)...親ノードを元にした証拠)
+	vector<UD> eviLambda;          // λエビデンス(λ(X|e-)...子ノードを元にした証拠)
+	vector<UD> posterior;          // 事後確率(α*π(X)λ(X))
+	vector<UD> likelihood;         // エビデンスによる状態毎の尤度(空の場合はエビデンスなし)
+	vector<UD> deviation;          // 近似推論(サンプリング)時の事後確率の標準誤差
+	vector<vector<UD> > msgPai;    // 親毎のπメッセージ(πX(Ui)...親ノードの状態毎)
+	vector<vector<UD> > msgLambda; // 親毎のλメッセージ(λX(Ui)...親ノードの状態毎)
+};
+
+/*!
+ * @brief 1問合せ分の推論状態(ワークスペース)を定義します
+ * ネットワーク構造と条件付き確率表(モデル)は変更せずに共有し、推論中に変化する値は全てここに保持します
+ * その為、ワークスペースをスレッド毎に用意すれば、1つのモデルに対して同時に推論できます
+ */
+class CompositeWork {
+
+private:
+	/*!
+	 * @brief デフォルトコンストラクタは公開しません
+	 */
+	CompositeWork();
+
+public:
+	/*!
+	 * @brief ノード数と連結成分数を必須引数とします(CompositeBase::createWorkで作成します)
+	 * @param[in] int ノード数
+	 * @param[in] int 連結成分数
+	 */
+	CompositeWork(int nodes, int components) : states(nodes), ready(components, 0) {
+		this->maximum = false;
+	}
+
+public:
+	/*!
+	 * @brief ノード番号毎の推論状態を保持します
+	 */
+	vector<CompositeState> states;
+
+	/*!
+	 * @brief 連結成分毎の初期化有無を保持します(初回の参照時に初期化します)
+	 */
+	vector<char> ready;
+
+	/*!
+	 * @brief 与えられたエビデンス(ノード名=状態名)を保持します
+	 */
+	LINE evidences;
+
+	/*!
+	 * @brief 最大積(max-product)で計算するか否かを保持します
+	 * trueの場合、π・λメッセージの親の状態の組に関する和を最大値に置き換え、事後確率は最大周辺確率となります
+	 */
+	bool maximum;
+
+	/*!
+	 * @brief メッセージ計算の一時領域(親の状態の組、状態毎の集計)を切り出すアロケータを保持します
+	 * 1メッセージ分の領域は転送後に、問合せ全体の領域は初期化(format)時に一括で解放します
+	 */
+	BayesianArena arena;
+
+	/*!
+	 * @brief 問合せで発生したエラーの内容を保持します(初期化(format)時に消去します)
+	 */
+	string message;
+
+};
+
+#endif /* COMPOSITEWORK_H_ */
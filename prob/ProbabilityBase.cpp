@@ -6,6 +6,25 @@
 //============================================================================
 #include "ProbabilityBase.h"
 #include "ProbabilityParse.h"
+#include "BayesianThread.h"
+#include "BayesianProfile.h"
+
+/*!
+ * @brief 列毎の一意値を並列に求める処理を定義します
+ */
+struct ProbabilityUniq {
+	vector<CHARS*> *columns;  // 対象列の実データ
+	vector<CHARS> *results;   // 対象列の一意値
+	void operator()(long index, int thread) {
+		CHARS *rows = (*columns)[index];
+		CHARS &element = (*results)[index];
+		for (CHARS::iterator iline = rows->begin(); iline != rows->end(); iline++) {
+			if (find(element.begin(), element.end(), *iline) == element.end()) {
+				element.push_back(*iline);
+			}
+		}
+	}
+};
 
 /*!
  * @brief 読み込み対象ファイル名を必須引数とします
@@ -16,10 +35,19 @@ ProbabilityBase::ProbabilityBase(string target) {
 	this->now = 0;
 	this->cols = -1;
 	this->rows = -1;
+	this->revision = issue();
 	titles.clear();
 	vals.clear();
 }
 
+/*!
+ * @brief プロセス全体で単調に増加する実データの識別番号を発行します
+ */
+long ProbabilityBase::issue() {
+	static volatile long issued = 0;
+	return __sync_add_and_fetch(&issued, 1);
+}
+
 /*!
  * @brief CSV形式の行データを末尾に追加します
  * @param[in] LINE 行データ
@@ -29,6 +57,30 @@ int ProbabilityBase::add(LINE *row) {
 		VALUES::iterator target = vals.find(iter->first);
 		target->second->push_back(iter->second);
 	}
+	revision = issue();
+	return 0;
+}
+
+/*!
+ * @brief 指定列を状態名の番号(elementsの位置)の列に変換します
+ * @param[in]  string       対象要素名
+ * @param[in]  CHARS*       状態名(この順の番号とします)
+ * @param[out] vector<int>* 行毎の状態の番号(状態名にない値は-1)
+ */
+int ProbabilityBase::encode(string variable, CHARS *elements, vector<int> *codes) {
+	VALUES::iterator icol = vals.find(variable);
+	if (icol == vals.end()) {
+		cout << "[ProbabilityBase::encode]not found key for csv(" << variable << ")" << endl;
+		return 1;
+	}
+	map<string, int> index;
+	for (unsigned int i = 0; i < elements->size(); i++) index[(*elements)[i]] = i;
+	CHARS *cells = icol->second;
+	codes->assign(rows > 0 ? rows : 0, -1);
+	for (long row = 0; row < (long)codes->size() && row < (long)cells->size(); row++) {
+		map<string, int>::iterator found = index.find((*cells)[row]);
+		if (found != index.end()) (*codes)[row] = found->second;
+	}
 	return 0;
 }
 
@@ -48,6 +100,7 @@ int ProbabilityBase::reload() {
 	titles.clear();
 	vals.clear();
 	cashes.clear();
+	revision = issue();
 	return 0;
 }
 
@@ -57,6 +110,7 @@ int ProbabilityBase::reload() {
  */
 int ProbabilityBase::load(long max)
 {
+	PROFILE_SCOPE(PROFILE_LOAD);
 	this->max = max;
 	this->now = 0;
 	titles.clear();
@@ -98,6 +152,7 @@ int ProbabilityBase::load(long max)
 		this->cols = colsize;
 		this->rows = rowsize;
 		this->now  = rowsize;
+		revision = issue();
 		// 最後まで読み込んだ場合は、ファイル参照を破棄します
 		if (parse.isEof()) ifs.close();
 
@@ -180,6 +235,7 @@ int ProbabilityBase::prob(string variable, COND *condition, PROBS *result, long
  * @param[in]  bool                         対象件数が0件の場合、Freq(一様分布)を与えるか否か
  */
 int ProbabilityBase::prob(string variable, COND *condition, PROBS *result, long *total, bool freq) {
+	PROFILE_COUNT(PROFILE_PROB, 1);
 	long count = 0;
 	vector<long> indexs;
 	for (COND::iterator icond = condition->begin(); icond != condition->end(); icond++) {
@@ -198,6 +254,7 @@ int ProbabilityBase::prob(string variable, COND *condition, PROBS *result, long
 			return 2;
 		}
 		// 対象行を特定します
+		PROFILE_COUNT(PROFILE_ROWS, (count == 0 ? rows->size() : indexs.size()));
 		if (count == 0) {
 			// 初回は全行精査と検索対象値(配列番号)の作成を行います
 			for (unsigned long row = 0; row < rows->size(); row++) {
@@ -233,6 +290,7 @@ int ProbabilityBase::prob(string variable, COND *condition, PROBS *result, long
 	// 一意な要素名を取得します
 	CHARS elements;
 	uniq(variable, &elements); // 対象行のUniqでは0件要素が求められない為、全件に変更(処理が遅くなります)
+	PROFILE_COUNT(PROFILE_ROWS, elements.size() * indexs.size());
 	for (CHARS::iterator ielement = elements.begin(); ielement != elements.end(); ielement++) {
 		double child = 0;
 		// 条件ありの場合は、取得した行番号の合致精査により件数を特定します
@@ -272,6 +330,7 @@ int ProbabilityBase::prob(string variable, COND *condition, PROBS *result, long
  */
 int ProbabilityBase::probConcrete(string variable, PROBS *result, long *total, bool num)
 {
+	PROFILE_COUNT(PROFILE_PROB, 1);
 	// 条件に合致する要素の確率、要素/条件合致数を求めます
 	// 条件なしの場合は全件数を使用します
 	*total = this->rows;
@@ -289,6 +348,7 @@ int ProbabilityBase::probConcrete(string variable, PROBS *result, long *total, b
 	// 一意な要素名を取得します
 	CHARS elements;
 	uniq(variable, &elements);
+	PROFILE_COUNT(PROFILE_ROWS, elements.size() * this->rows);
 	for (CHARS::iterator ielement = elements.begin(); ielement != elements.end(); ielement++) {
 		double child = 0;
 		// 条件なしの場合は、指定要素に合致する件数を全件からカウントします
@@ -339,3 +399,35 @@ int ProbabilityBase::uniq(string variable, CHARS *element) {
 	cashes.insert(RELATES_PAIR(variable, elementn));
 	return 0;
 }
+
+/*!
+ * @brief 指定列の一意値のキャッシュを並列に作成します
+ * @param[in] CHARS* 対象列名
+ * @param[in] int    スレッド数(0以下の場合はCPU数)
+ */
+int ProbabilityBase::prepare(CHARS *variables, int threads) {
+	// キャッシュにない列を対象とします
+	CHARS names;
+	vector<CHARS*> columns;
+	for (CHARS::iterator iter = variables->begin(); iter != variables->end(); iter++) {
+		if (cashes.find(*iter) != cashes.end()) continue;
+		if (find(names.begin(), names.end(), *iter) != names.end()) continue;
+		VALUES::iterator irow = vals.find(*iter);
+		if (irow == vals.end()) {
+			cout << "[ProbabilityBase::prepare]not found key for csv(" << *iter << ")" << endl;
+			return 1;
+		}
+		names.push_back(*iter);
+		columns.push_back(irow->second);
+	}
+	// 列毎に一意値を求めてキャッシュに保持します
+	vector<CHARS> results(columns.size());
+	ProbabilityUniq uniq;
+	uniq.columns = &columns;
+	uniq.results = &results;
+	parallel(threads, columns.size(), &uniq);
+	for (unsigned int i = 0; i < names.size(); i++) {
+		cashes.insert(RELATES_PAIR(names[i], new CHARS(results[i])));
+	}
+	return 0;
+}
@@ -18,7 +18,7 @@ protected:
 	/*!
 	 * @brief デフォルトコンストラクタは公開しません
 	 * */
-	ProbabilityBase() {}
+	ProbabilityBase() { this->revision = issue(); }
 
 public:
 	/*!
@@ -61,6 +61,17 @@ protected:
 	 */
 	VALUES vals;
 
+	/*!
+	 * @brief 実データの識別番号を保持します(条件付き確率の変更検知、構造学習のキャッシュのキーに利用します)
+	 * 生成、読み込み、追加の度にプロセス全体で一意な番号を振り直す為、別の実データと同じ番号になることはありません
+	 */
+	long revision;
+
+	/*!
+	 * @brief プロセス全体で単調に増加する実データの識別番号を発行します
+	 */
+	static long issue();
+
 protected:
 	/*!
 	 * @brief 読み込み対象ファイル名を保持します
@@ -111,6 +122,15 @@ public:
 	 */
 	int add(LINE *row);
 
+	/*!
+	 * @brief 指定列を状態名の番号(elementsの位置)の列に変換します
+	 * 構造学習で全ての列の組の件数を数える場合に、文字列の比較を一度で済ませる為に用います
+	 * @param[in]  string       対象要素名
+	 * @param[in]  CHARS*       状態名(この順の番号とします)
+	 * @param[out] vector<int>* 行毎の状態の番号(状態名にない値は-1)
+	 */
+	int encode(string variable, CHARS *elements, vector<int> *codes);
+
 	/*!
 	 * @brief 指定条件を満たす指定要素の全件数を返します
 	 * @param[in]  string 					         対象要素名
@@ -151,6 +171,14 @@ public:
 	 */
 	int cash(string variable, CHARS *result);
 
+	/*!
+	 * @brief 指定列の一意値のキャッシュを並列に作成します
+	 * キャッシュ作成後のprobは読み込みのみとなる為、複数スレッドから呼び出せます
+	 * @param[in] CHARS* 対象列名
+	 * @param[in] int    スレッド数(0以下の場合はCPU数)
+	 */
+	int prepare(CHARS *variables, int threads);
+
 	/*!
 	 * @brief 現在参照している行番号を返します
 	 */
@@ -166,6 +194,11 @@ public:
 	 */
 	CHARS *cnames() { return &titles; }
 
+	/*!
+	 * @brief 実データの識別番号を返します(更新の度に変わります)
+	 */
+	long revcnt() { return this->revision; }
+
 protected:
 	/*!
 	 * @brief 指定列データから一意な値を作成します